@@ -2,10 +2,20 @@
 // Copyright (C) 2024  Andy Frank Schoknecht
 
 #include "SVM.h"
+#include "optimize.h"
+#include "stats.h"
 
 #include <stdlib.h>
 #include <string.h>
 
+/* Symbols and literals are mostly small numbers,
+ * so a multiplicative hash spreads them well enough.
+ */
+#define SYM_SLOT(sym, mask) \
+	((int) (((unsigned) (sym) * 2654435761u) >> 8 & (mask)))
+#define LITERAL_SLOT(v, mask) \
+	((int) (((unsigned) (v).c.i * 2654435761u + (v).type) >> 8 & (mask)))
+
 int
 skip_tokens_to_statement_end(
 	struct Token *t,
@@ -16,23 +26,104 @@ skip_whitespace_tokens(
 	struct Token *t,
 	int tlen);
 
+/* Skips whitespace and a comment before the end of statement,
+ * anything else there is an error.
+ * Returns amount of skipped tokens.
+ */
 int
-translate_expression(
-	struct Scope *s,
-	struct Value *dest,
+skip_statement_end(
 	struct Token *t,
 	int tlen,
 	enum TranslateStatus *ts);
 
+/* Returns non zero if t, after whitespace, opens a parenthesis.
+ */
+int
+is_call(
+	struct Token *t,
+	int tlen);
+
+/* Returns non zero if the statement at t ends with "{".
+ */
+int
+opens_scope(
+	struct Token *t,
+	int tlen);
+
+/* Translates "name(params) {", the body follows as the statements of
+ * a new scope, which is added to s and reported as TS_new_scope_found.
+ * Returns amount of translated tokens.
+ */
+int
+translate_function(
+	struct Scope          *s,
+	struct Token          *t,
+	int                    tlen,
+	const char            *src,
+	enum TranslateStatus  *ts);
+
+/* Translates "name(args)", the value holding the result is written to
+ * result.
+ * Returns amount of translated tokens.
+ */
+int
+translate_call(
+	struct Scope          *s,
+	struct Operand        *result,
+	struct Token          *t,
+	int                    tlen,
+	const char            *src,
+	enum TranslateStatus  *ts);
+
+/* Translates the "}" that ends the function s.
+ * Returns amount of translated tokens.
+ */
+int
+translate_scope_end(
+	struct Scope          *s,
+	struct Token          *t,
+	int                    tlen,
+	enum TranslateStatus  *ts);
+
+/* Returns amount of translated tokens.
+ * The value holding the result is written to result.
+ */
+int
+translate_expression(
+	struct Scope          *s,
+	struct Operand        *result,
+	struct Token          *t,
+	int                    tlen,
+	const char            *src,
+	enum TranslateStatus  *ts);
+
+int
+translate_product(
+	struct Scope          *s,
+	struct Operand        *result,
+	struct Token          *t,
+	int                    tlen,
+	const char            *src,
+	enum TranslateStatus  *ts);
+
+int
+translate_operand(
+	struct Scope          *s,
+	struct Operand        *result,
+	struct Token          *t,
+	int                    tlen,
+	const char            *src,
+	enum TranslateStatus  *ts);
+
 void
 Instruction_add_value(
 	struct Instruction *i,
-	struct Value *v);
+	struct Operand v);
 
 void
 Instruction_add_value(
 	struct Instruction *i,
-	struct Value *v)
+	struct Operand v)
 {
 	i->vals[i->n_vals] = v;
 	i->n_vals++;
@@ -42,20 +133,26 @@ int
 tokens_to_statement(
 	struct Token *t,
 	int tlen,
+	const char *src,
 	struct Scope *s,
 	enum TranslateStatus *ts)
 {
 	int begin;
 	int i = 0;
-	int var_idx;
+	struct Instruction instr;
+	struct Operand dest = {
+		.type = OT_var,
+		.idx = 0
+	};
+	struct Operand value;
+	int sym;
 
 	if (tlen == 0)
 		return 0;
 
-	while (i < tlen &&
-	       t[i].type == TT_whitespace) {
-		i++;
-	}
+	i += skip_whitespace_tokens(&t[i], tlen - i);
+	if (i >= tlen)
+		return i;
 
 	begin = i;
 
@@ -66,11 +163,22 @@ tokens_to_statement(
 		break;
 
 	case TT_identifier:
-		if (i + 1 >= tlen) {
-			*ts = TS_expected_operator;
-			return i;
+		/* a call by itself, unless a body follows */
+		if (is_call(&t[i + 1], tlen - i - 1)) {
+			if (opens_scope(&t[i], tlen - i)) {
+				return i + translate_function(s, &t[i], tlen - i,
+				                              src, ts);
+			}
+
+			i += translate_call(s, &value, &t[i], tlen - i, src, ts);
+			if (*ts) {
+				return i;
+			}
+			i += skip_statement_end(&t[i], tlen - i, ts);
+			return *ts ? i : i + 1;
 		}
 
+		i++;
 		i += skip_whitespace_tokens(&t[i], tlen - i);
 
 		if (i >= tlen ||
@@ -79,42 +187,92 @@ tokens_to_statement(
 			*ts = TS_expected_operator;
 			return i;
 		}
-		var_idx = Scope_find_var(s, t[begin].c.identifier);
-		if (var_idx == -1) {
-			var_idx = Scope_add_var(s, t[begin].c.identifier);
-		};
 		i++;
 
-		i += skip_whitespace_tokens(&t[i], tlen - i);
-
-		i = translate_expression(s, &s->var_vals[var_idx],
-		                        &t[i], tlen - i,
-		                        ts);
+		i += translate_expression(s, &value, &t[i], tlen - i, src, ts);
+		if (*ts) {
+			return i;
+		}
 
-		if (i >= tlen ||
-		    (t[i].type != TT_separator &&
-		     t[i].c.separator != '\n')) {
-			*ts = TS_expected_end_of_statement;
+		i += skip_statement_end(&t[i], tlen - i, ts);
+		if (*ts) {
 			return i;
 		}
+
+		sym = Interner_intern(s->names,
+		                      &src[t[begin].c.identifier.off],
+		                      t[begin].c.identifier.len);
+		if (sym == -1) {
+			*ts = TS_malloc_failed;
+			return begin;
+		}
+		dest.idx = Scope_find_var(s, sym);
+		if (dest.idx == -1) {
+			dest.idx = Scope_add_var(s, sym);
+			if (dest.idx == -1) {
+				*ts = TS_malloc_failed;
+				return begin;
+			}
+		}
+		instr = Instruction_new_mov(dest, value);
+		instr.row = t[begin].row;
+		if (Scope_add_instruction(s, instr)) {
+			*ts = TS_malloc_failed;
+			return begin;
+		}
+		/* tmp values are reused later, see Scope_allocate_tmps */
+		if (s->n_vars + s->n_literals > CODE_MAX_REGISTERS) {
+			*ts = TS_scope_limit_reached;
+			return begin;
+		}
+		return i + 1;
 		break;
 
 	case TT_keyword:
+		/* return is the only keyword that starts a statement */
+		if (t[i].c.keyword != KW_return) {
+			*ts = TS_expected_identifier;
+			return i;
+		}
+		if (s->parent == NULL) {
+			*ts = TS_return_outside_function;
+			return i;
+		}
+		i++;
+
+		i += translate_expression(s, &value, &t[i], tlen - i, src, ts);
+		if (*ts) {
+			return i;
+		}
+		i += skip_statement_end(&t[i], tlen - i, ts);
+		if (*ts) {
+			return i;
+		}
+
+		instr = Instruction_new_return(value);
+		instr.row = t[begin].row;
+		if (Scope_add_instruction(s, instr)) {
+			*ts = TS_malloc_failed;
+			return begin;
+		}
+		return i + 1;
 		break;
 
 	case TT_separator:
+		if (t[i].c.separator == '}') {
+			return i + translate_scope_end(s, &t[i], tlen - i, ts);
+		}
 		if (t[i].c.separator != '\n') {
 			*ts = TS_expected_identifier;
-			i = skip_tokens_to_statement_end(&t[i], tlen - i);
+			return i;
 		}
-		return i;
+		return i + 1;
 		break;
 
 	case TT_operator:
 	case TT_literal:
 	case TT_whitespace:
 		*ts = TS_expected_identifier;
-		i = skip_tokens_to_statement_end(&t[i], tlen - i);
 		return i;
 		break;
 	}
@@ -146,19 +304,28 @@ InstructionType_fprint(
 	case IT_modulus:
 		fprintf(file, "modulus");
 		break;
+	case IT_call:
+		fprintf(file, "call");
+		break;
+	case IT_return:
+		fprintf(file, "return");
+		break;
 	}
 }
 
 struct Instruction
 Instruction_new_math(
 	enum InstructionType type,
-	struct Value *dest,
-	struct Value *left,
-	struct Value *right)
+	struct Operand dest,
+	struct Operand left,
+	struct Operand right)
 {
-	struct Instruction ret;
+	struct Instruction ret = {
+		.type = type,
+		.row = 0,
+		.n_vals = 0
+	};
 
-	ret.type = type;
 	Instruction_add_value(&ret, dest);
 	Instruction_add_value(&ret, left);
 	Instruction_add_value(&ret, right);
@@ -168,12 +335,15 @@ Instruction_new_math(
 
 struct Instruction
 Instruction_new_mov(
-	struct Value *dest,
-	struct Value *src)
+	struct Operand dest,
+	struct Operand src)
 {
-	struct Instruction ret;
+	struct Instruction ret = {
+		.type = IT_mov,
+		.row = 0,
+		.n_vals = 0
+	};
 
-	ret.type = IT_mov;
 	Instruction_add_value(&ret, dest);
 	Instruction_add_value(&ret, src);
 
@@ -182,49 +352,81 @@ Instruction_new_mov(
 
 struct Instruction
 Instruction_new_add(
-	struct Value *dest,
-	struct Value *left,
-	struct Value *right)
+	struct Operand dest,
+	struct Operand left,
+	struct Operand right)
 {
 	return Instruction_new_math(IT_add, dest, left, right);
 }
 
 struct Instruction
 Instruction_new_sub(
-	struct Value *dest,
-	struct Value *left,
-	struct Value *right)
+	struct Operand dest,
+	struct Operand left,
+	struct Operand right)
 {
 	return Instruction_new_math(IT_sub, dest, left, right);
 }
 
 struct Instruction
 Instruction_new_mul(
-	struct Value *dest,
-	struct Value *left,
-	struct Value *right)
+	struct Operand dest,
+	struct Operand left,
+	struct Operand right)
 {
 	return Instruction_new_math(IT_mul, dest, left, right);
 }
 
 struct Instruction
 Instruction_new_div(
-	struct Value *dest,
-	struct Value *left,
-	struct Value *right)
+	struct Operand dest,
+	struct Operand left,
+	struct Operand right)
 {
 	return Instruction_new_math(IT_div, dest, left, right);
 }
 
 struct Instruction
 Instruction_new_modulus(
-	struct Value *dest,
-	struct Value *left,
-	struct Value *right)
+	struct Operand dest,
+	struct Operand left,
+	struct Operand right)
 {
 	return Instruction_new_math(IT_modulus, dest, left, right);
 }
 
+struct Instruction
+Instruction_new_call(
+	struct Operand dest,
+	struct Operand func)
+{
+	struct Instruction ret = {
+		.type = IT_call,
+		.row = 0,
+		.n_vals = 0
+	};
+
+	Instruction_add_value(&ret, dest);
+	Instruction_add_value(&ret, func);
+
+	return ret;
+}
+
+struct Instruction
+Instruction_new_return(
+	struct Operand value)
+{
+	struct Instruction ret = {
+		.type = IT_return,
+		.row = 0,
+		.n_vals = 0
+	};
+
+	Instruction_add_value(&ret, value);
+
+	return ret;
+}
+
 void
 Instruction_fprint(
 	const struct Instruction *instr,
@@ -235,23 +437,91 @@ Instruction_fprint(
 	InstructionType_fprint(instr->type, f);
 	for (i = 0; i < instr->n_vals; i++) {
 		fprintf(f, " ");
-		Value_fprint(instr->vals[i], f);
+		Operand_fprint(&instr->vals[i], f);
+	}
+}
+
+void
+Operand_fprint(
+	const struct Operand *o,
+	FILE *f)
+{
+	switch (o->type) {
+	case OT_var:
+		fprintf(f, "var%i", o->idx);
+		break;
+	case OT_tmp:
+		fprintf(f, "tmp%i", o->idx);
+		break;
+	case OT_literal:
+		fprintf(f, "lit%i", o->idx);
+		break;
+	case OT_arg:
+		fprintf(f, "arg%i", o->idx);
+		break;
+	case OT_func:
+		fprintf(f, "func%i", o->idx);
+		break;
 	}
 }
 
 struct Scope
-Scope_new(
-	char *name,
-	struct Scope *parent)
+*Scope_new(
+	char            *name,
+	struct Scope    *parent,
+	struct Interner *names,
+	struct Arena    *arena)
 {
-	struct Scope ret = {
-		.name = name,
-		.parent = parent,
-		.n_literals = 0,
-		.n_tmp_vals = 0,
-		.n_vars = 0,
-		.n_instrs = 0
-	};
+	struct Scope *ret;
+
+	ret = Arena_alloc(arena, sizeof(struct Scope));
+	if (ret == NULL) {
+		return NULL;
+	}
+
+	ret->name = name;
+	ret->parent = parent;
+	ret->idx = -1;
+	ret->sym = -1;
+	ret->n_params = 0;
+	ret->n_args = 0;
+	ret->funcs_size = 0;
+	ret->n_funcs = 0;
+	ret->funcs = NULL;
+	ret->names = names;
+	ret->arena = arena;
+	ret->lits_size = 0;
+	ret->n_literals = 0;
+	ret->literals = NULL;
+	ret->lit_table = NULL;
+	ret->n_tmp_vals = 0;
+	ret->vars_size = 0;
+	ret->n_vars = 0;
+	ret->var_names = NULL;
+	ret->var_table = NULL;
+	ret->instrs_size = 0;
+	ret->n_instrs = 0;
+	ret->instrs = NULL;
+	ret->code.ops = NULL;
+	ret->code.rows = NULL;
+	ret->code.n_ops = 0;
+	ret->code.consts = NULL;
+	ret->code.n_consts = 0;
+	ret->code.n_params = 0;
+	ret->code.n_vars = 0;
+	ret->code.n_tmps = 0;
+	ret->code.n_regs = 0;
+	ret->code.n_args = 0;
+	ret->code.stack_size = 0;
+	ret->code.codes = NULL;
+	ret->code.n_codes = 0;
+	ret->code.hot_runs = -1;
+	ret->code.n_runs = 0;
+	ret->code.jit = NULL;
+	ret->code.jit_failed = 0;
+	ret->frame = NULL;
+	ret->translate_secs = 0;
+
 	return ret;
 }
 
@@ -259,13 +529,14 @@ int
 Scope_from_tokens(
 	struct Token *t,
 	int tlen,
+	const char *src,
 	struct Scope *s,
 	enum TranslateStatus *ts)
 {
 	int i;
 
 	for (i = 0; i < tlen;) {
-		i += tokens_to_statement(&t[i], tlen - i, s, ts);
+		i += tokens_to_statement(&t[i], tlen - i, src, s, ts);
 		switch (*ts) {
 		case TS_ok:
 			break;
@@ -289,66 +560,277 @@ Scope_fprint(
 	struct Scope *s,
 	FILE *f)
 {
+	int i;
+
 	fprintf(f, "<---\nScope begin\n"
 	           "name = \"%s\"\n"
 	           "parent = %p\n"
 	           "n_literals = %i\n"
 	           "literals = %p\n"
 	           "n_tmp_vals = %i\n"
-	           "tmp_vals = %p\n"
 	           "n_vars = %i\n"
 	           "var_names = %p\n"
-	           "var_vals = %p\n"
 	           "n_instrs = %i\n"
 	           "instrs = %p\n"
-	           "Scope end\n--->\n",
+	           "instrs size = %lu bytes\n",
 	        s->name, (void*) s->parent, s->n_literals, (void*) s->literals,
-	        s->n_tmp_vals, (void*) s->tmp_vals, s->n_vars,
-	        (void*) s->var_names, (void*) s->var_vals, s->n_instrs,
-	        (void*) s->instrs);
+	        s->n_tmp_vals, s->n_vars, (void*) s->var_names, s->n_instrs,
+	        (void*) s->instrs,
+	        (unsigned long) (sizeof(struct Instruction) * s->n_instrs));
+
+	for (i = 0; i < s->n_vars && s->frame != NULL; i++) {
+		fprintf(f, "var %.*s = ",
+		        Interner_name_len(s->names, s->var_names[i]),
+		        Interner_name(s->names, s->var_names[i]));
+		Value_fprint(&s->frame[i], f);
+		fprintf(f, "\n");
+	}
+
+	Code_fprint(&s->code, f);
+	fprintf(f, "Scope end\n--->\n");
 }
 
-void
+int
 Scope_add_instruction(
 	struct Scope *s,
 	struct Instruction i)
 {
+	int size;
+
+	if (s->n_instrs >= s->instrs_size) {
+		size = s->instrs_size == 0 ? SCOPE_MIN_SIZE : s->instrs_size * 2;
+		s->instrs = Arena_grow(s->arena, s->instrs,
+		                       sizeof(struct Instruction) * s->instrs_size,
+		                       sizeof(struct Instruction) * size);
+		if (s->instrs == NULL) {
+			return 1;
+		}
+		s->instrs_size = size;
+	}
+
 	s->instrs[s->n_instrs] = i;
 	s->n_instrs++;
+	return 0;
+}
+
+struct Scope
+*Scope_find_func(
+	const struct Scope *s,
+	int sym)
+{
+	int i;
+
+	for (; s != NULL; s = s->parent) {
+		for (i = s->n_funcs - 1; i >= 0; i--) {
+			if (s->funcs[i]->sym == sym) {
+				return s->funcs[i];
+			}
+		}
+	}
+
+	return NULL;
+}
+
+int
+Scope_add_func(
+	struct Scope *s,
+	struct Scope *func)
+{
+	int size;
+
+	if (s->n_funcs >= s->funcs_size) {
+		size = s->funcs_size == 0 ? SCOPE_MIN_SIZE : s->funcs_size * 2;
+		s->funcs = Arena_grow(s->arena, s->funcs,
+		                      sizeof(struct Scope *) * s->funcs_size,
+		                      sizeof(struct Scope *) * size);
+		if (s->funcs == NULL) {
+			return 1;
+		}
+		s->funcs_size = size;
+	}
+
+	s->funcs[s->n_funcs] = func;
+	s->n_funcs++;
+	return 0;
 }
 
-/* Returns index of newly created variable.
- */
 int
 Scope_add_var(
 	struct Scope *s,
-	char *name)
+	int sym)
 {
-	s->var_names[s->n_vars] = name;
+	int i;
+	int size;
+	int slot;
+	int mask;
+
+	if (s->n_vars >= s->vars_size) {
+		size = s->vars_size == 0 ? SCOPE_MIN_SIZE : s->vars_size * 2;
+		s->var_names = Arena_grow(s->arena, s->var_names,
+		                          sizeof(int) * s->vars_size,
+		                          sizeof(int) * size);
+		s->var_table = Arena_alloc(s->arena, sizeof(int) * size * 2);
+		if (s->var_names == NULL || s->var_table == NULL) {
+			return -1;
+		}
+		s->vars_size = size;
+
+		memset(s->var_table, 0, sizeof(int) * size * 2);
+		mask = size * 2 - 1;
+		for (i = 0; i < s->n_vars; i++) {
+			slot = SYM_SLOT(s->var_names[i], mask);
+			while (s->var_table[slot] != 0) {
+				slot = (slot + 1) & mask;
+			}
+			s->var_table[slot] = i + 1;
+		}
+	}
+
+	mask = s->vars_size * 2 - 1;
+	slot = SYM_SLOT(sym, mask);
+	while (s->var_table[slot] != 0) {
+		slot = (slot + 1) & mask;
+	}
+	s->var_table[slot] = s->n_vars + 1;
+
+	s->var_names[s->n_vars] = sym;
 	s->n_vars++;
 	return s->n_vars - 1;
 }
 
-struct Value
-*Scope_add_tmp_val(
-	struct Scope *s,
-	struct Value v)
+struct Operand
+Scope_add_tmp_val(
+	struct Scope *s)
 {
-	s->tmp_vals[s->n_tmp_vals] = v;
+	struct Operand ret = {
+		.type = OT_tmp,
+		.idx = s->n_tmp_vals
+	};
+
 	s->n_tmp_vals++;
-	return &s->tmp_vals[s->n_tmp_vals - 1];
+	return ret;
 }
 
 int
-Scope_find_var(
+Scope_add_literal(
 	struct Scope *s,
-	char *name)
+	struct Value v)
 {
 	int i;
+	int size;
+	int slot;
+	int mask;
+	int lit_idx;
+
+	if (s->lits_size > 0) {
+		mask = s->lits_size * 2 - 1;
+		for (slot = LITERAL_SLOT(v, mask);
+		     s->lit_table[slot] != 0;
+		     slot = (slot + 1) & mask) {
+			lit_idx = s->lit_table[slot] - 1;
+			if (Value_equal(&s->literals[lit_idx], &v)) {
+				return lit_idx;
+			}
+		}
+	}
 
-	for (i = 0; i < s->n_vars; i++) {
-		if (strcmp(name, s->var_names[i]) == 0) {
-			return i;
+	if (s->n_literals >= s->lits_size) {
+		size = s->lits_size == 0 ? SCOPE_MIN_SIZE : s->lits_size * 2;
+		s->literals = Arena_grow(s->arena, s->literals,
+		                         sizeof(struct Value) * s->lits_size,
+		                         sizeof(struct Value) * size);
+		s->lit_table = Arena_alloc(s->arena, sizeof(int) * size * 2);
+		if (s->literals == NULL || s->lit_table == NULL) {
+			return -1;
+		}
+		s->lits_size = size;
+
+		memset(s->lit_table, 0, sizeof(int) * size * 2);
+		mask = size * 2 - 1;
+		for (i = 0; i < s->n_literals; i++) {
+			slot = LITERAL_SLOT(s->literals[i], mask);
+			while (s->lit_table[slot] != 0) {
+				slot = (slot + 1) & mask;
+			}
+			s->lit_table[slot] = i + 1;
+		}
+	}
+
+	mask = s->lits_size * 2 - 1;
+	slot = LITERAL_SLOT(v, mask);
+	while (s->lit_table[slot] != 0) {
+		slot = (slot + 1) & mask;
+	}
+	s->lit_table[slot] = s->n_literals + 1;
+
+	s->literals[s->n_literals] = v;
+	s->n_literals++;
+	return s->n_literals - 1;
+}
+
+void
+Scope_truncate(
+	struct Scope *s,
+	int n_instrs,
+	int n_vars,
+	int n_literals,
+	int n_tmp_vals)
+{
+	int slot;
+	int mask;
+
+	/* Tables are always filled in index order, also when grown,
+	 * so removing the newest entry first never cuts a probe chain.
+	 */
+	mask = s->vars_size * 2 - 1;
+	for (; s->n_vars > n_vars; s->n_vars--) {
+		slot = SYM_SLOT(s->var_names[s->n_vars - 1], mask);
+		while (s->var_table[slot] != s->n_vars) {
+			slot = (slot + 1) & mask;
+		}
+		s->var_table[slot] = 0;
+	}
+
+	mask = s->lits_size * 2 - 1;
+	for (; s->n_literals > n_literals; s->n_literals--) {
+		slot = LITERAL_SLOT(s->literals[s->n_literals - 1], mask);
+		while (s->lit_table[slot] != s->n_literals) {
+			slot = (slot + 1) & mask;
+		}
+		s->lit_table[slot] = 0;
+	}
+
+	s->n_instrs = n_instrs;
+	s->n_tmp_vals = n_tmp_vals;
+}
+
+int
+Scope_n_regs(
+	const struct Scope *s)
+{
+	return s->n_vars + s->n_tmp_vals + s->n_literals;
+}
+
+int
+Scope_find_var(
+	const struct Scope *s,
+	int sym)
+{
+	int slot;
+	int mask;
+	int var_idx;
+
+	if (s->vars_size == 0) {
+		return -1;
+	}
+
+	mask = s->vars_size * 2 - 1;
+	for (slot = SYM_SLOT(sym, mask);
+	     s->var_table[slot] != 0;
+	     slot = (slot + 1) & mask) {
+		var_idx = s->var_table[slot] - 1;
+		if (s->var_names[var_idx] == sym) {
+			return var_idx;
 		}
 	}
 
@@ -361,15 +843,81 @@ Module_new(
 {
 	struct Module ret = {
 		.name = name,
+		.src = {
+			.buf = NULL,
+			.len = 0,
+			.mapped = 0
+		},
+		.cache = {
+			.buf = NULL,
+			.len = 0,
+			.mapped = 0
+		},
+		.arena = Arena_new(),
+		.names = Interner_new(NULL),
+		.t = NULL,
 		.tsize = 0,
 		.tlen = 0,
 		.tc = 0,
+		.s = NULL,
 		.ssize = 0,
 		.slen = 0,
+		.codes = NULL,
+		.codes_size = 0,
+		.cur = NULL,
+		.ic = 0,
+		.jit_hot_runs = JIT_HOT_RUNS,
+		.inline_max = INLINE_MAX_INSTRS,
+		.inlined = NULL,
+		.inlined_size = 0,
+		.n_inlined = 0,
+		.n_tokens = 0,
+		.stats = NULL,
+		.tokenize_threads = 1,
 	};
 	return ret;
 }
 
+struct Scope
+*Module_add_scope(
+	struct Module *mod,
+	char          *name,
+	struct Scope  *parent)
+{
+	struct Scope *s;
+
+	s = Scope_new(name, parent, &mod->names, &mod->arena);
+	if (NULL == s || Module_append_scope(mod, s)) {
+		return NULL;
+	}
+
+	return s;
+}
+
+int
+Module_append_scope(
+	struct Module *mod,
+	struct Scope  *s)
+{
+	int size;
+
+	if (mod->slen >= mod->ssize) {
+		size = mod->ssize == 0 ? 1 : mod->ssize * 2;
+		mod->s = Arena_grow(&mod->arena, mod->s,
+		                    sizeof(struct Scope *) * mod->ssize,
+		                    sizeof(struct Scope *) * size);
+		if (NULL == mod->s) {
+			return 1;
+		}
+		mod->ssize = size;
+	}
+
+	s->idx = mod->slen;
+	mod->s[mod->slen] = s;
+	mod->slen++;
+	return 0;
+}
+
 int
 Module_from_file(
 	struct Module        *mod,
@@ -377,31 +925,100 @@ Module_from_file(
 	char                 *filename,
 	enum TokenizerError  *te,
 	enum TranslateStatus *ts)
+{
+	struct Source src;
+
+	if (Source_from_file(&src, f)) {
+		mod->src = src;
+		*te = TE_file_read_failed;
+		*ts = TS_ok;
+		return 0;
+	}
+
+	return Module_from_source(mod, &src, filename, te, ts);
+}
+
+int
+Module_from_file_streaming(
+	struct Module        *mod,
+	FILE                 *f,
+	char                 *filename,
+	enum TokenizerError  *te,
+	enum TranslateStatus *ts)
+{
+	struct Source src;
+
+	if (Source_from_file(&src, f)) {
+		mod->src = src;
+		*te = TE_file_read_failed;
+		*ts = TS_ok;
+		return 0;
+	}
+
+	return Module_from_source_streaming(mod, &src, filename, te, ts);
+}
+
+int
+Module_from_source(
+	struct Module        *mod,
+	struct Source        *src,
+	char                 *filename,
+	enum TokenizerError  *te,
+	enum TranslateStatus *ts)
 {
 	int tokens_read;
 	int loop;
+	struct Tokenizer tz;
 
-	*mod = Module_new(filename);
-	mod->tsize = 64;
-	mod->t = malloc(sizeof(struct Token) * mod->tsize);
+	mod->names = Interner_new(&mod->arena);
+	mod->src = *src;
+	*te = TE_ok;
+	*ts = TS_ok;
+
+	if (mod->stats != NULL) {
+		Stats_begin(mod->stats, "tokenize", &mod->arena);
+	}
+
+	if (mod->tokenize_threads > 1 && mod->src.len >= TOKENIZE_CHUNK_MIN) {
+		mod->tlen = Tokens_from_text_parallel(mod->src.buf,
+		                                      mod->src.len,
+		                                      mod->tokenize_threads,
+		                                      &mod->arena,
+		                                      &mod->t,
+		                                      &mod->tsize,
+		                                      te);
+		if (mod->tlen == -1) {
+			mod->tlen = 0;
+			return 1;
+		}
+		goto tokenized;
+	}
+
+	Tokenizer_init(&tz, mod->src.buf, mod->src.len);
+
+	/* roughly one token per four characters */
+	mod->tsize = 64 + mod->src.len / 4;
+	mod->t = Arena_alloc(&mod->arena, sizeof(struct Token) * mod->tsize);
 	if (mod->t == NULL) {
 		return 1;
 	}
 
 	for (loop = 1; loop; ) {
-		tokens_read = Tokens_from_file(f,
-		                               &mod->t[mod->tlen],
-		                               mod->tsize - mod->tlen,
-		                               te);
+		tokens_read = Tokenizer_read(&tz,
+		                             &mod->t[mod->tlen],
+		                             mod->tsize - mod->tlen,
+		                             te);
 		mod->tlen += tokens_read;
 
 		switch (*te) {
 		case TE_tbuf_too_small:
-			mod->tsize *= 2;
-			mod->t = realloc(mod->t, mod->tsize);
+			mod->t = Arena_grow(&mod->arena, mod->t,
+			                    sizeof(struct Token) * mod->tsize,
+			                    sizeof(struct Token) * mod->tsize * 2);
 			if (mod->t == NULL) {
 				return 1;
 			}
+			mod->tsize *= 2;
 			break;
 
 		default:
@@ -410,54 +1027,285 @@ Module_from_file(
 		}
 	}
 
-	mod->ssize = 8;
-	mod->s = malloc(sizeof(struct Scope) * mod->ssize);
-	if (NULL == mod->s) {
+tokenized:
+	mod->n_tokens = mod->tlen;
+	if (mod->stats != NULL) {
+		Stats_end(mod->stats, &mod->arena);
+	}
+
+	if (*te) {
+		return 0;
+	}
+
+	if (NULL == Module_add_scope(mod, filename, NULL)) {
 		return 1;
 	}
-	mod->s[mod->slen] = Scope_new(filename, NULL);
-	mod->tc = Scope_from_tokens(mod->t, mod->tlen, &mod->s[mod->slen], ts);
-	mod->slen++;
+	mod->cur = mod->s[0];
 
-	for (loop = 1; loop; ) {
-		switch (*ts) {
-		case TS_new_scope_found:
-			if (mod->slen >= mod->ssize) {
-				mod->s = realloc(mod->s,
-				                 sizeof(struct Scope) *
-				                 mod->ssize * 2);
-				if (NULL == mod->s) {
+	if (mod->stats != NULL) {
+		Stats_begin(mod->stats, "translate", &mod->arena);
+	}
+	mod->tc = Module_translate_tokens(mod, mod->t, mod->tlen, ts);
+	if (mod->stats != NULL) {
+		Stats_end(mod->stats, &mod->arena);
+	}
+	if (*ts == TS_ok && mod->cur != mod->s[0]) {
+		*ts = TS_expected_scope_end;
+		mod->tc = mod->tlen - 1;
+	}
+	return 0;
+}
+
+int
+Module_from_source_streaming(
+	struct Module        *mod,
+	struct Source        *src,
+	char                 *filename,
+	enum TokenizerError  *te,
+	enum TranslateStatus *ts)
+{
+	int tokens_read;
+	struct Tokenizer tz;
+
+	mod->names = Interner_new(&mod->arena);
+	mod->src = *src;
+	*te = TE_ok;
+	*ts = TS_ok;
+
+	Source_advise_sequential(&mod->src);
+	Tokenizer_init(&tz, mod->src.buf, mod->src.len);
+
+	if (NULL == Module_add_scope(mod, filename, NULL)) {
+		return 1;
+	}
+	mod->cur = mod->s[0];
+
+	/* one statement at a time, so t only grows for long statements */
+	mod->tsize = 64;
+	mod->t = Arena_alloc(&mod->arena, sizeof(struct Token) * mod->tsize);
+	if (mod->t == NULL) {
+		return 1;
+	}
+
+	while (!tz.done) {
+		if (mod->stats != NULL) {
+			Stats_begin(mod->stats, "tokenize", &mod->arena);
+		}
+		mod->tlen = 0;
+		do {
+			if (*te == TE_tbuf_too_small) {
+				mod->t = Arena_grow(&mod->arena, mod->t,
+				                    sizeof(struct Token) * mod->tsize,
+				                    sizeof(struct Token) *
+				                    mod->tsize * 2);
+				if (mod->t == NULL) {
 					return 1;
 				}
+				mod->tsize *= 2;
 			}
 
-			mod->s[mod->slen] = Scope_new(mod->t[mod->tc].c.identifier,
-			                              &mod->s[mod->slen - 1]);
-			mod->tc = Scope_from_tokens(&mod->t[mod->tc],
-			                            mod->tlen - mod->tc,
-			                            &mod->s[mod->slen],
-			                            ts);
-			mod->slen++;
+			tokens_read = Tokenizer_read_statement(&tz,
+			                                       &mod->t[mod->tlen],
+			                                       mod->tsize - mod->tlen,
+			                                       te);
+			mod->tlen += tokens_read;
+		} while (*te == TE_tbuf_too_small);
+		mod->n_tokens += mod->tlen;
+		if (mod->stats != NULL) {
+			Stats_end(mod->stats, &mod->arena);
+		}
+
+		if (*te) {
+			return 0;
+		}
+
+		if (mod->stats != NULL) {
+			Stats_begin(mod->stats, "translate", &mod->arena);
+		}
+		mod->tc = Module_translate_tokens(mod, mod->t, mod->tlen, ts);
+		if (mod->stats != NULL) {
+			Stats_end(mod->stats, &mod->arena);
+		}
+		if (*ts) {
+			return 0;
+		}
+	}
+
+	if (mod->cur != mod->s[0]) {
+		*ts = TS_expected_scope_end;
+		mod->tc = mod->tlen > 0 ? mod->tlen - 1 : 0;
+	}
+	return 0;
+}
+
+int
+Module_translate_tokens(
+	struct Module        *mod,
+	struct Token         *t,
+	int                   tlen,
+	enum TranslateStatus *ts)
+{
+	int i = 0;
+	double begin = 0;
+
+	while (i < tlen) {
+		if (mod->stats != NULL) {
+			begin = Stats_now();
+		}
+		i += Scope_from_tokens(&t[i], tlen - i, mod->src.buf, mod->cur, ts);
+		if (mod->stats != NULL) {
+			mod->cur->translate_secs += Stats_now() - begin;
+		}
+
+		switch (*ts) {
+		case TS_new_scope_found:
+			/* the translator added the function to its scope */
+			if (Module_append_scope(mod, mod->cur->funcs[
+			                             mod->cur->n_funcs - 1])) {
+				*ts = TS_malloc_failed;
+				return i;
+			}
+			mod->cur = mod->s[mod->slen - 1];
+			*ts = TS_ok;
 			break;
 
 		case TS_scope_ended:
-			if (&mod->s[0] == mod->s[mod->slen - 1].parent) {
-				loop = 0;
-				break;
+			if (NULL == mod->cur->parent) {
+				return i;
 			}
-
-			mod->tc = Scope_from_tokens(&mod->t[mod->tc],
-			                            mod->tlen - mod->tc,
-			                            mod->s[mod->slen - 1].parent,
-			                            ts);
+			mod->cur = mod->cur->parent;
+			*ts = TS_ok;
 			break;
 
 		default:
-			return 0;
+			return i;
 			break;
 		}
 	}
 
+	return i;
+}
+
+int
+Module_n_instrs(
+	const struct Module *mod)
+{
+	int i;
+	int n = 0;
+
+	for (i = 0; i < mod->slen; i++) {
+		n += mod->s[i]->n_instrs;
+	}
+
+	return n;
+}
+
+int
+Module_optimize(
+	struct Module *mod,
+	int level)
+{
+	int i;
+
+	if (level >= 1 && Module_inline(mod) == -1) {
+		return 1;
+	}
+	for (i = 0; i < mod->slen; i++) {
+		if (Scope_optimize(mod->s[i], level)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int
+Module_lower(
+	struct Module *mod)
+{
+	int i;
+
+	for (i = 0; i < mod->slen; i++) {
+		if (Code_from_scope(&mod->s[i]->code, mod->s[i], &mod->arena)) {
+			return 1;
+		}
+	}
+
+	return Module_link(mod);
+}
+
+/* Sizes the frame stack of codes[i], see Module_link.
+ * state: per code, 0 if not sized yet, 1 while being sized, 2 if done
+ */
+static int
+Module_size_stack(
+	struct Module *mod,
+	int            i,
+	char          *state)
+{
+	int n;
+	int below;
+	struct Code *c = mod->codes[i];
+	const struct Op *op;
+
+	if (state[i] == 2) {
+		return c->stack_size;
+	}
+	/* recursion, which only the runtime checks can bound */
+	if (state[i] == 1) {
+		return CODE_STACK_MAX;
+	}
+	state[i] = 1;
+
+	below = c->n_args;
+	for (op = c->ops; op->code != OP_halt; op++) {
+		if (op->code != OP_call) {
+			continue;
+		}
+		n = Module_size_stack(mod, op->b, state);
+		if (n > below) {
+			below = n;
+		}
+	}
+
+	c->stack_size = below > CODE_STACK_MAX - c->n_regs ?
+	                CODE_STACK_MAX : c->n_regs + below;
+	state[i] = 2;
+	return c->stack_size;
+}
+
+int
+Module_link(
+	struct Module *mod)
+{
+	int i;
+	char *state;
+
+	if (mod->slen > mod->codes_size) {
+		mod->codes = Arena_grow(&mod->arena, mod->codes,
+		                        sizeof(struct Code *) * mod->codes_size,
+		                        sizeof(struct Code *) * mod->ssize);
+		if (mod->codes == NULL) {
+			return 1;
+		}
+		mod->codes_size = mod->ssize;
+	}
+
+	for (i = 0; i < mod->slen; i++) {
+		mod->codes[i] = &mod->s[i]->code;
+		mod->codes[i]->codes = mod->codes;
+		mod->codes[i]->n_codes = mod->slen;
+	}
+
+	state = calloc(mod->slen + 1, 1);
+	if (state == NULL) {
+		return 1;
+	}
+	for (i = 0; i < mod->slen; i++) {
+		Module_size_stack(mod, i, state);
+	}
+
+	free(state);
 	return 0;
 }
 
@@ -473,18 +1321,24 @@ Module_fprint(
 	           "tlen = %i\n"
 	           "ssize = %i\n"
 	           "slen = %i\n"
+	           "arena blocks = %lu\n"
+	           "arena allocs = %lu\n"
+	           "arena bytes = %lu\n"
 	           "global = ",
 	        mod->name,
 	        (void*) mod->t,
 	        mod->tsize,
 	        mod->tlen,
 	        mod->ssize,
-	        mod->slen);
+	        mod->slen,
+	        (unsigned long) mod->arena.n_blocks,
+	        (unsigned long) mod->arena.n_allocs,
+	        (unsigned long) mod->arena.bytes_allocated);
 
 	if (NULL == mod->s) {
 		fprintf(f, "NULL\n");
 	} else {
-		Scope_fprint(&mod->s[0], f);
+		Scope_fprint(mod->s[0], f);
 	}
 	fprintf(f, "Module end\n--->\n");
 }
@@ -495,16 +1349,21 @@ Module_free(
 {
 	int i;
 
-	for (i = 0; i < mod->tlen; i++) {
-		Token_free(&mod->t[i]);
+	for (i = 0; i < mod->slen; i++) {
+		free(mod->s[i]->frame);
+		Jit_free(mod->s[i]->code.jit);
 	}
-	free(mod->t);
+
+	Arena_free(&mod->arena);
+	mod->t = NULL;
 	mod->tsize = 0;
 	mod->tlen = 0;
-
-	free(mod->s);
+	mod->s = NULL;
 	mod->ssize = 0;
 	mod->slen = 0;
+
+	Source_free(&mod->src);
+	Source_free(&mod->cache);
 }
 
 int
@@ -515,13 +1374,15 @@ skip_tokens_to_statement_end(
 	int i = 0;
 
 	while (i < tlen &&
-	       (t[i].type != TT_separator && t[i].c.separator != '\n')) {
+	       (t[i].type != TT_separator || t[i].c.separator != '\n')) {
 		i++;
 	}
 
 	return i + 1;
 }
 
+/* Returns amount of skipped tokens.
+ */
 int
 skip_whitespace_tokens(
 	struct Token *t,
@@ -530,138 +1391,562 @@ skip_whitespace_tokens(
 	int i = 0;
 
 	while (i < tlen &&
-	       t[i].type != TT_whitespace) {
+	       t[i].type == TT_whitespace) {
 		i++;
 	}
 
-	return i + 1;
+	return i;
 }
 
 int
-translate_expression(
-	struct Scope *s,
-	struct Value *dest,
+skip_statement_end(
 	struct Token *t,
 	int tlen,
 	enum TranslateStatus *ts)
 {
-	int a;
 	int i = 0;
-	struct Instruction instr;
-	struct Value *first;
-	struct Value *second;
-	struct Value  tmpval = {
-		.type = VT_int,
-		.c.i = 0
-	};
-	char operator;
 
-	i = skip_whitespace_tokens(&t[i], tlen - i);
+	i += skip_whitespace_tokens(&t[i], tlen - i);
+	if (i < tlen && t[i].type == TT_comment) {
+		i++;
+	}
+	if (i < tlen &&
+	    (t[i].type != TT_separator || t[i].c.separator != '\n')) {
+		*ts = TS_expected_end_of_statement;
+	}
 
-	switch (t[i].type) {
-	case TT_literal:
-		first = &t[i].c.literal;
-		break;
-	default:
-		*ts = TS_expected_value;
-		return i;
-		break;
+	return i;
+}
+
+int
+is_call(
+	struct Token *t,
+	int tlen)
+{
+	int i = skip_whitespace_tokens(t, tlen);
+
+	return i < tlen && t[i].type == TT_separator && t[i].c.separator == '(';
+}
+
+int
+opens_scope(
+	struct Token *t,
+	int tlen)
+{
+	int i;
+	int last = -1;
+
+	for (i = 0;
+	     i < tlen &&
+	     (t[i].type != TT_separator || t[i].c.separator != '\n');
+	     i++) {
+		if (t[i].type != TT_whitespace && t[i].type != TT_comment) {
+			last = i;
+		}
 	}
-	i++;
 
-	i = skip_whitespace_tokens(&t[i], tlen - i);
+	return last != -1 &&
+	       t[last].type == TT_separator &&
+	       t[last].c.separator == '{';
+}
 
-	if (i >= tlen) {
-		*ts = TS_expected_value;
+int
+translate_expression(
+	struct Scope          *s,
+	struct Operand        *result,
+	struct Token          *t,
+	int                    tlen,
+	const char            *src,
+	enum TranslateStatus  *ts)
+{
+	int i = 0;
+	struct Instruction instr;
+	struct Operand left;
+	struct Operand right;
+	struct Operand dest;
+	enum InstructionType type;
+	int row;
+
+	i += translate_product(s, &left, &t[i], tlen - i, src, ts);
+	if (*ts) {
 		return i;
 	}
-	if (t[i].type != TT_operator) {
-		*ts = TS_expected_operator;
+
+	while (1) {
+		i += skip_whitespace_tokens(&t[i], tlen - i);
+		if (i >= tlen || t[i].type != TT_operator) {
+			break;
+		}
+
+		switch (t[i].c.operator) {
+		case '+':
+			type = IT_add;
+			break;
+		case '-':
+			type = IT_sub;
+			break;
+		default:
+			goto expression_end;
+			break;
+		}
+		row = t[i].row;
+		i++;
+
+		i += translate_product(s, &right, &t[i], tlen - i, src, ts);
+		if (*ts) {
+			return i;
+		}
+
+		dest = Scope_add_tmp_val(s);
+		instr = Instruction_new_math(type, dest, left, right);
+		instr.row = row;
+		if (Scope_add_instruction(s, instr)) {
+			*ts = TS_malloc_failed;
+			return i;
+		}
+		left = dest;
+	}
+
+expression_end:
+	*result = left;
+	return i;
+}
+
+int
+translate_product(
+	struct Scope          *s,
+	struct Operand        *result,
+	struct Token          *t,
+	int                    tlen,
+	const char            *src,
+	enum TranslateStatus  *ts)
+{
+	int i = 0;
+	struct Instruction instr;
+	struct Operand left;
+	struct Operand right;
+	struct Operand dest;
+	enum InstructionType type;
+	int row;
+
+	i += translate_operand(s, &left, &t[i], tlen - i, src, ts);
+	if (*ts) {
 		return i;
 	}
-	operator = t[i].c.operator;
-	i++;
 
-	i = skip_whitespace_tokens(&t[i], tlen - i);
+	while (1) {
+		i += skip_whitespace_tokens(&t[i], tlen - i);
+		if (i >= tlen || t[i].type != TT_operator) {
+			break;
+		}
 
+		switch (t[i].c.operator) {
+		case '*':
+			type = IT_mul;
+			break;
+		case '/':
+			type = IT_div;
+			break;
+		case '%':
+			type = IT_modulus;
+			break;
+		default:
+			goto product_end;
+			break;
+		}
+		row = t[i].row;
+		i++;
+
+		i += translate_operand(s, &right, &t[i], tlen - i, src, ts);
+		if (*ts) {
+			return i;
+		}
+
+		dest = Scope_add_tmp_val(s);
+		instr = Instruction_new_math(type, dest, left, right);
+		instr.row = row;
+		if (Scope_add_instruction(s, instr)) {
+			*ts = TS_malloc_failed;
+			return i;
+		}
+		left = dest;
+	}
+
+product_end:
+	*result = left;
+	return i;
+}
+
+int
+translate_operand(
+	struct Scope          *s,
+	struct Operand        *result,
+	struct Token          *t,
+	int                    tlen,
+	const char            *src,
+	enum TranslateStatus  *ts)
+{
+	int i = 0;
+	int sym;
+	int var_idx;
+
+	i += skip_whitespace_tokens(&t[i], tlen - i);
 	if (i >= tlen) {
-		*ts = TS_expected_value;
+		*ts = TS_expected_expression;
 		return i;
 	}
+
 	switch (t[i].type) {
 	case TT_literal:
-		second = &t[i].c.literal;
+		result->type = OT_literal;
+		result->idx = Scope_add_literal(s, t[i].c.literal);
+		if (result->idx == -1) {
+			*ts = TS_malloc_failed;
+			return i;
+		}
+		break;
+
+	case TT_identifier:
+		if (is_call(&t[i + 1], tlen - i - 1)) {
+			return i + translate_call(s, result, &t[i], tlen - i,
+			                          src, ts);
+		}
+
+		sym = Interner_find(s->names,
+		                    &src[t[i].c.identifier.off],
+		                    t[i].c.identifier.len);
+		var_idx = sym == -1 ? -1 : Scope_find_var(s, sym);
+		if (var_idx == -1) {
+			*ts = TS_unknown_variable_referenced;
+			return i;
+		}
+		result->type = OT_var;
+		result->idx = var_idx;
 		break;
 
 	case TT_separator:
-		if (t[i].c.separator == '(') {
-			second = Scope_add_tmp_val(s, tmpval);
-			i = translate_expression(s, second, &t[i], tlen - i, ts);
-			if (*ts) {
-				return i;
-			}
+		if (t[i].c.separator != '(') {
+			*ts = TS_expected_expression;
+			return i;
+		}
+		i++;
+
+		i += translate_expression(s, result, &t[i], tlen - i, src, ts);
+		if (*ts) {
+			return i;
+		}
+
+		i += skip_whitespace_tokens(&t[i], tlen - i);
+		if (i >= tlen ||
+		    t[i].type != TT_separator ||
+		    t[i].c.separator != ')') {
+			*ts = TS_expected_closing_parenthesis;
+			return i;
 		}
 		break;
 
 	default:
-		*ts = TS_expected_value;
+		*ts = TS_expected_expression;
 		return i;
 		break;
 	}
 	i++;
 
-	switch (operator) {
-	case '*':
-		instr = Instruction_new_mul(dest, first, second);
-		break;
-	case '/':
-		instr = Instruction_new_div(dest, first, second);
-		break;
-	case '%':
-		instr = Instruction_new_modulus(dest, first, second);
-		break;
-
-	case '+':
-		instr = Instruction_new_add(dest, first, second);
-		goto low_prio_instr;
-	case '-':
-		instr = Instruction_new_sub(dest, first, second);
-		goto low_prio_instr;
-
-low_prio_instr:
-		for (a = i + 1; a < tlen; a++) {
-			switch (t[a].type) {
-			case TT_operator:
-				if (t[a].c.operator != '+' &&
-				    t[a].c.operator != '-') {
-					second = Scope_add_tmp_val(s, tmpval);
-					i++;
-					i = translate_expression(s, second, &t[i], tlen - i, ts);
-					if (*ts) {
-						return i;
-					}
-				}
-				break;
-			case TT_comment:
-			case TT_separator:
-				a = tlen;
-				break;
-			default:
-				break;
-			}
+	return i;
+}
+
+int
+translate_function(
+	struct Scope          *s,
+	struct Token          *t,
+	int                    tlen,
+	const char            *src,
+	enum TranslateStatus  *ts)
+{
+	int i = 0;
+	int sym;
+	struct Scope *func;
+
+	func = Scope_new(NULL, s, s->names, s->arena);
+	if (func == NULL) {
+		*ts = TS_malloc_failed;
+		return i;
+	}
+	func->sym = Interner_intern(s->names,
+	                            &src[t[i].c.identifier.off],
+	                            t[i].c.identifier.len);
+	if (func->sym == -1) {
+		*ts = TS_malloc_failed;
+		return i;
+	}
+	i++;
+	i += skip_whitespace_tokens(&t[i], tlen - i);
+	i++;
+
+	/* parameters are the first variables */
+	while (1) {
+		i += skip_whitespace_tokens(&t[i], tlen - i);
+		if (i < tlen &&
+		    t[i].type == TT_separator &&
+		    t[i].c.separator == ')' &&
+		    func->n_params == 0) {
+			break;
+		}
+		if (i >= tlen || t[i].type != TT_identifier) {
+			*ts = TS_expected_identifier;
+			return i;
+		}
+
+		sym = Interner_intern(s->names,
+		                      &src[t[i].c.identifier.off],
+		                      t[i].c.identifier.len);
+		if (sym == -1) {
+			*ts = TS_malloc_failed;
+			return i;
+		}
+		if (Scope_find_var(func, sym) != -1) {
+			*ts = TS_duplicate_parameter;
+			return i;
+		}
+		if (Scope_add_var(func, sym) == -1) {
+			*ts = TS_malloc_failed;
+			return i;
+		}
+		func->n_params++;
+		i++;
+
+		i += skip_whitespace_tokens(&t[i], tlen - i);
+		if (i < tlen &&
+		    t[i].type == TT_separator &&
+		    t[i].c.separator == ',') {
+			i++;
+			continue;
+		}
+		if (i >= tlen ||
+		    t[i].type != TT_separator ||
+		    t[i].c.separator != ')') {
+			*ts = TS_expected_closing_parenthesis;
+			return i;
 		}
 		break;
+	}
+	i++;
 
-	default:
-		fprintf(stderr, "You are a wizard, Harry.\n");
+	i += skip_whitespace_tokens(&t[i], tlen - i);
+	if (i >= tlen ||
+	    t[i].type != TT_separator ||
+	    t[i].c.separator != '{') {
+		*ts = TS_expected_scope_begin;
+		return i;
+	}
+	i++;
+	i += skip_statement_end(&t[i], tlen - i, ts);
+	if (*ts) {
+		return i;
+	}
+
+	if (Scope_add_func(s, func)) {
+		*ts = TS_malloc_failed;
+		return i;
+	}
+	*ts = TS_new_scope_found;
+	return i + 1;
+}
+
+int
+translate_call(
+	struct Scope          *s,
+	struct Operand        *result,
+	struct Token          *t,
+	int                    tlen,
+	const char            *src,
+	enum TranslateStatus  *ts)
+{
+	int i = 0;
+	int n;
+	int sym;
+	struct Instruction instr;
+	struct Operand args;
+	struct Operand value;
+	struct Operand arg = {
+		.type = OT_arg,
+		.idx = 0
+	};
+	struct Operand func = {
+		.type = OT_func,
+		.idx = 0
+	};
+	const struct Scope *callee;
+
+	sym = Interner_find(s->names,
+	                    &src[t[i].c.identifier.off],
+	                    t[i].c.identifier.len);
+	callee = sym == -1 ? NULL : Scope_find_func(s, sym);
+	if (callee == NULL) {
+		*ts = TS_unknown_function_called;
 		return i;
+	}
+	func.idx = callee->idx;
+	i++;
+	i += skip_whitespace_tokens(&t[i], tlen - i);
+	i++;
+
+	/* Arguments are kept in tmp values until all are known,
+	 * since calls among them use the same argument registers.
+	 */
+	args.type = OT_tmp;
+	args.idx = s->n_tmp_vals;
+	for (n = 0; n < callee->n_params; n++) {
+		Scope_add_tmp_val(s);
+	}
+
+	for (n = 0; ; n++) {
+		i += skip_whitespace_tokens(&t[i], tlen - i);
+		if (n == 0 &&
+		    i < tlen &&
+		    t[i].type == TT_separator &&
+		    t[i].c.separator == ')') {
+			break;
+		}
+		if (n >= callee->n_params) {
+			*ts = TS_wrong_argument_count;
+			return i;
+		}
+
+		i += translate_expression(s, &value, &t[i], tlen - i, src, ts);
+		if (*ts) {
+			return i;
+		}
+		instr = Instruction_new_mov(args, value);
+		instr.vals[0].idx += n;
+		instr.row = t[0].row;
+		if (Scope_add_instruction(s, instr)) {
+			*ts = TS_malloc_failed;
+			return i;
+		}
+
+		i += skip_whitespace_tokens(&t[i], tlen - i);
+		if (i < tlen &&
+		    t[i].type == TT_separator &&
+		    t[i].c.separator == ',') {
+			i++;
+			continue;
+		}
+		if (i >= tlen ||
+		    t[i].type != TT_separator ||
+		    t[i].c.separator != ')') {
+			*ts = TS_expected_closing_parenthesis;
+			return i;
+		}
+		n++;
 		break;
 	}
+	if (n != callee->n_params) {
+		*ts = TS_wrong_argument_count;
+		return i;
+	}
+	i++;
+
+	for (n = 0; n < callee->n_params; n++) {
+		arg.idx = n;
+		value = args;
+		value.idx += n;
+		instr = Instruction_new_mov(arg, value);
+		instr.row = t[0].row;
+		if (Scope_add_instruction(s, instr)) {
+			*ts = TS_malloc_failed;
+			return i;
+		}
+	}
+	if (callee->n_params > s->n_args) {
+		s->n_args = callee->n_params;
+	}
+
+	*result = Scope_add_tmp_val(s);
+	instr = Instruction_new_call(*result, func);
+	instr.row = t[0].row;
+	if (Scope_add_instruction(s, instr)) {
+		*ts = TS_malloc_failed;
+		return i;
+	}
 
-	Scope_add_instruction(s, instr);
 	return i;
 }
 
+int
+translate_scope_end(
+	struct Scope          *s,
+	struct Token          *t,
+	int                    tlen,
+	enum TranslateStatus  *ts)
+{
+	int i = 0;
+	struct Instruction instr;
+	struct Value zero = {
+		.type = VT_int,
+		.c.i = 0
+	};
+	struct Operand value = {
+		.type = OT_literal,
+		.idx = 0
+	};
+
+	if (s->parent == NULL) {
+		*ts = TS_unexpected_scope_end;
+		return i;
+	}
+	i++;
+	i += skip_statement_end(&t[i], tlen - i, ts);
+	if (*ts) {
+		return i;
+	}
+
+	/* every function returns, see OP_ret */
+	if (s->n_instrs == 0 || s->instrs[s->n_instrs - 1].type != IT_return) {
+		value.idx = Scope_add_literal(s, zero);
+		if (value.idx == -1) {
+			*ts = TS_malloc_failed;
+			return i;
+		}
+		instr = Instruction_new_return(value);
+		instr.row = t[0].row;
+		if (Scope_add_instruction(s, instr)) {
+			*ts = TS_malloc_failed;
+			return i;
+		}
+	}
+
+	*ts = TS_scope_ended;
+	return i + 1;
+}
+
+long
+Module_run(
+	struct Module      *mod,
+	enum RuntimeStatus *rs)
+{
+	int i;
+	struct Scope *s;
+
+	*rs = RS_ok;
+	if (mod->slen == 0) {
+		return 0;
+	}
+	/* functions are counted on their calls */
+	for (i = 0; i < mod->slen; i++) {
+		mod->s[i]->code.hot_runs = mod->jit_hot_runs;
+	}
+	s = mod->s[0];
+
+	free(s->frame);
+	s->frame = Code_new_frame(&s->code);
+	if (s->frame == NULL) {
+		return -1;
+	}
+
+	return Code_run_tiered(&s->code, s->frame, &mod->ic, rs);
+}
+
 void
 TranslateStatus_print(
 	const enum TranslateStatus ts,
@@ -699,9 +1984,61 @@ case TS_expected_value:
 		printf("%s:%i:%i: Expected value\n", filename, line, col);
 		break;
 
+	case TS_expected_closing_parenthesis:
+		printf("%s:%i:%i: Expected closing parenthesis\n",
+		       filename, line, col);
+		break;
+
 	case TS_expected_end_of_statement:
 		printf("%s:%i:%i: Expected end of statement\n",
 		       filename, line, col);
 		break;
+
+	case TS_malloc_failed:
+		printf("%s:%i:%i: Out of memory\n", filename, line, col);
+		break;
+
+	case TS_scope_limit_reached:
+		printf("%s:%i:%i: Scope can't hold more instructions, "
+		       "variables or tmp values\n",
+		       filename, line, col);
+		break;
+
+	case TS_unexpected_scope_end:
+		printf("%s:%i:%i: Unexpected end of scope, "
+		       "outside of any function\n",
+		       filename, line, col);
+		break;
+
+	case TS_expected_scope_end:
+		printf("%s:%i:%i: Expected end of scope, "
+		       "before the end of the file\n",
+		       filename, line, col);
+		break;
+
+	case TS_expected_scope_begin:
+		printf("%s:%i:%i: Expected begin of scope\n",
+		       filename, line, col);
+		break;
+
+	case TS_duplicate_parameter:
+		printf("%s:%i:%i: Parameter is named twice\n",
+		       filename, line, col);
+		break;
+
+	case TS_unknown_function_called:
+		printf("%s:%i:%i: Unknown function called\n",
+		       filename, line, col);
+		break;
+
+	case TS_wrong_argument_count:
+		printf("%s:%i:%i: Wrong amount of arguments for function\n",
+		       filename, line, col);
+		break;
+
+	case TS_return_outside_function:
+		printf("%s:%i:%i: Return outside of any function\n",
+		       filename, line, col);
+		break;
 	}
 }
@@ -6,12 +6,15 @@
 
 #include <stdio.h>
 
+#include "arena.h"
+#include "bytecode.h"
+#include "intern.h"
+#include "jit.h"
 #include "tokenize.h"
 
-#define SCOPE_MAX_INSTRUCTIONS 2048
-#define SCOPE_MAX_LITERALS     128
-#define SCOPE_MAX_VARIABLES    128
-#define SCOPE_MAX_TMP_VALUES   128
+#define SCOPE_MIN_SIZE 8 /* initial capacity of each scope array */
+
+struct Stats;
 
 enum TranslateStatus {
 	TS_ok,
@@ -22,7 +25,17 @@ enum TranslateStatus {
 	TS_expected_operator,
 	TS_expected_expression,
 	TS_expected_value,
+	TS_expected_closing_parenthesis,
 	TS_expected_end_of_statement,
+	TS_scope_limit_reached,
+	TS_unexpected_scope_end,
+	TS_expected_scope_end,
+	TS_expected_scope_begin,
+	TS_duplicate_parameter,
+	TS_unknown_function_called,
+	TS_wrong_argument_count,
+	TS_return_outside_function,
+	TS_malloc_failed,
 };
 
 void
@@ -38,38 +51,111 @@ enum InstructionType {
 	IT_sub,
 	IT_mul,
 	IT_div,
-	IT_modulus
+	IT_modulus,
+	IT_call,  /* dest, func, after the arguments were moved into place */
+	IT_return /* value, the only instruction without a destination */
+};
+
+/* Arguments are the registers right behind the scope's own,
+ * which become the first variables of the called function's frame.
+ */
+enum OperandType {
+	OT_var,
+	OT_tmp,
+	OT_literal,
+	OT_arg,
+	OT_func  /* index of a scope in the module */
+};
+
+/* Refers to a value of a scope by index.
+ */
+struct Operand {
+	enum OperandType type;
+	int              idx;
 };
 
+void
+Operand_fprint(
+	const struct Operand *o,
+	FILE *f);
+
 struct Instruction {
 	enum InstructionType type;
+	int                  row;
 	int                  n_vals;
-	struct Value         *vals[8];
+	struct Operand       vals[3];
 };
 
+/* All arrays start small and grow in the module's arena.
+ * Tmp values only exist at runtime, so the scope only counts them.
+ * Functions are scopes whose first variables are their parameters,
+ * they only see their own variables and the functions of the scopes
+ * around them.
+ */
 struct Scope {
 	char               *name;
 	struct Scope       *parent;
+	int                 idx;      /* in the module */
+	int                 sym;      /* of the function name, or -1 */
+	int                 n_params;
+	int                 n_args;   /* most arguments of a call in it */
+	int                 funcs_size;
+	int                 n_funcs;
+	struct Scope      **funcs;    /* defined in it, newest last */
+	struct Interner    *names; /* shared by all scopes of a module */
+	struct Arena       *arena; /* shared by all scopes of a module */
+	int                 lits_size;
 	int                 n_literals;
-	struct Value        literals[SCOPE_MAX_LITERALS];
+	struct Value       *literals;
+	int                *lit_table; /* literal idx + 1, lits_size * 2 */
 	int                 n_tmp_vals;
-	struct Value        tmp_vals[SCOPE_MAX_TMP_VALUES];
+	int                 vars_size;
 	int                 n_vars;
-	char               *var_names[SCOPE_MAX_VARIABLES];
-	struct Value        var_vals[SCOPE_MAX_VARIABLES];
+	int                *var_names; /* symbols */
+	int                *var_table; /* var idx + 1, vars_size * 2 */
+	int                 instrs_size;
 	int                 n_instrs;
-	struct Instruction  instrs[SCOPE_MAX_INSTRUCTIONS];
+	struct Instruction *instrs;
+	struct Code         code;  /* lowered instrs */
+	struct Value       *frame; /* registers of the last run */
+	double              translate_secs; /* only counted with stats */
+};
+
+/* A call, that Module_inline replaced with the body of the callee.
+ */
+struct InlinedCall {
+	int caller; /* scope index */
+	int callee;
+	int row;
 };
 
+/* Everything but frames and the source text lives in arena.
+ */
 struct Module {
 	char         *name;
+	struct Arena  arena;
+	struct Source src;
+	struct Source cache; /* mapped .sonc, if loaded from one */
+	struct Interner names;
 	struct Token *t;
 	int           tsize;
 	int           tlen;
 	int           tc; /* token cursor */
-	struct Scope *s;
+	struct Scope **s;
 	int           ssize;
 	int           slen;
+	struct Code **codes; /* of all scopes, see Module_link */
+	int           codes_size;
+	struct Scope *cur; /* scope being translated */
+	int           ic; /* op cursor, of the last run */
+	int           jit_hot_runs; /* see JIT_HOT_RUNS */
+	int           inline_max; /* see INLINE_MAX_INSTRS */
+	struct InlinedCall *inlined; /* by the last optimizing */
+	int           inlined_size;
+	int           n_inlined;
+	int           n_tokens; /* read in total, also when streaming */
+	struct Stats *stats; /* phases are recorded, if not NULL */
+	int           tokenize_threads; /* see Tokens_from_text_parallel */
 };
 
 /* Returns amount of translated tokens.
@@ -78,6 +164,7 @@ int
 tokens_to_statement(
 	struct Token *t,
 	int tlen,
+	const char *src,
 	struct Scope *s,
 	enum TranslateStatus *ts);
 
@@ -89,54 +176,67 @@ InstructionType_fprint(
 struct Instruction
 Instruction_new_math(
 	enum InstructionType type,
-	struct Value *dest,
-	struct Value *left,
-	struct Value *right);
+	struct Operand dest,
+	struct Operand left,
+	struct Operand right);
 
 struct Instruction
 Instruction_new_mov(
-	struct Value *dest,
-	struct Value *src);
+	struct Operand dest,
+	struct Operand src);
 
 struct Instruction
 Instruction_new_add(
-	struct Value *dest,
-	struct Value *left,
-	struct Value *right);
+	struct Operand dest,
+	struct Operand left,
+	struct Operand right);
 
 struct Instruction
 Instruction_new_sub(
-	struct Value *dest,
-	struct Value *left,
-	struct Value *right);
+	struct Operand dest,
+	struct Operand left,
+	struct Operand right);
 
 struct Instruction
 Instruction_new_mul(
-	struct Value *dest,
-	struct Value *left,
-	struct Value *right);
+	struct Operand dest,
+	struct Operand left,
+	struct Operand right);
 
 struct Instruction
 Instruction_new_div(
-	struct Value *dest,
-	struct Value *left,
-	struct Value *right);
+	struct Operand dest,
+	struct Operand left,
+	struct Operand right);
 
 struct Instruction
 Instruction_new_modulus(
-	struct Value *dest,
-	struct Value *left,
-	struct Value *right);
+	struct Operand dest,
+	struct Operand left,
+	struct Operand right);
+
+struct Instruction
+Instruction_new_call(
+	struct Operand dest,
+	struct Operand func);
+
+struct Instruction
+Instruction_new_return(
+	struct Operand value);
 
 void
 Instruction_fprint(
 	const struct Instruction *i,
 	FILE *f);
 
+/* Returns a scope allocated from arena, or NULL if malloc failed.
+ */
 struct Scope
-Scope_new(
-	char         *name,
-	struct Scope *parent);
+*Scope_new(
+	char            *name,
+	struct Scope    *parent,
+	struct Interner *names,
+	struct Arena    *arena);
 
 /* Returns amount of translated tokens.
  */
@@ -144,6 +244,7 @@ int
 Scope_from_tokens(
 	struct Token *t,
 	int tlen,
+	const char *src,
 	struct Scope *s,
 	enum TranslateStatus *ts);
 
@@ -152,37 +253,99 @@ Scope_fprint(
 	struct Scope *s,
 	FILE *f);
 
-void
+/* Returns non zero if malloc failed.
+ */
+int
 Scope_add_instruction(
 	struct Scope *s,
 	struct Instruction i);
 
+/* Returns the function that sym names in s or the scopes around it,
+ * or NULL if there is none.
+ */
+struct Scope
+*Scope_find_func(
+	const struct Scope *s,
+	int sym);
+
+/* Returns non zero if malloc failed.
+ */
+int
+Scope_add_func(
+	struct Scope *s,
+	struct Scope *func);
+
+/* Returns index of newly created variable, or -1 if malloc failed.
+ */
 int
 Scope_add_var(
 	struct Scope *s,
-	char *name);
+	int sym);
+
+/* Returns operand of a newly created tmp value.
+ */
+struct Operand
+Scope_add_tmp_val(
+	struct Scope *s);
 
-/* Returns pointer to newly created value.
+/* Equal literals share one index.
+ * Returns index of the literal, or -1 if malloc failed.
  */
-struct Value
-*Scope_add_tmp_val(
+int
+Scope_add_literal(
 	struct Scope *s,
 	struct Value v);
 
-/* s:    Scope
- * name: Name of variable
+/* Drops all that was translated since the scope held the given amounts,
+ * as if it never had been.
+ * Only for scopes that were not optimized, which may add literals.
+ */
+void
+Scope_truncate(
+	struct Scope *s,
+	int n_instrs,
+	int n_vars,
+	int n_literals,
+	int n_tmp_vals);
+
+/* Returns amount of registers the lowered scope needs.
+ */
+int
+Scope_n_regs(
+	const struct Scope *s);
+
+/* s:   Scope
+ * sym: Symbol of the variable's name
  * Returns index if found, otherwise returns -1
  */
 int
 Scope_find_var(
-	struct Scope *s,
-	char *name);
+	const struct Scope *s,
+	int sym);
 
 struct Module
 Module_new(
 	char *name);
 
-/* Returns non zero on odd error cases, like mallocs being impossible.
+/* Returns the new scope, or NULL if malloc failed.
+ */
+struct Scope
+*Module_add_scope(
+	struct Module *mod,
+	char          *name,
+	struct Scope  *parent);
+
+/* Adds a scope made by the translator, see TS_new_scope_found.
+ * Returns non zero if malloc failed.
+ */
+int
+Module_append_scope(
+	struct Module *mod,
+	struct Scope  *s);
+
+/* Translates a file, the module still needs to be lowered to run.
+ * mod must come from Module_new, so that stats can be set beforehand.
+ * Returns non zero on odd error cases, like mallocs being impossible.
  */
 int
 Module_from_file(
@@ -192,6 +355,94 @@ Module_from_file(
 	enum TokenizerError  *te,
 	enum TranslateStatus *ts);
 
+/* Like Module_from_file, but the source text is already read.
+ * The module takes ownership of src.
+ * Large texts are tokenized on mod->tokenize_threads threads.
+ */
+int
+Module_from_source(
+	struct Module        *mod,
+	struct Source        *src,
+	char                 *filename,
+	enum TokenizerError  *te,
+	enum TranslateStatus *ts);
+
+/* See Module_from_file_streaming.
+ */
+int
+Module_from_source_streaming(
+	struct Module        *mod,
+	struct Source        *src,
+	char                 *filename,
+	enum TokenizerError  *te,
+	enum TranslateStatus *ts);
+
+/* Like Module_from_file, but each statement is translated as soon as
+ * it is tokenized, reusing one token buffer.
+ * So t only holds the last statement, which keeps memory proportional
+ * to the longest statement instead of the whole file.
+ */
+int
+Module_from_file_streaming(
+	struct Module        *mod,
+	FILE                 *f,
+	char                 *filename,
+	enum TokenizerError  *te,
+	enum TranslateStatus *ts);
+
+/* Translates tokens into the current scope,
+ * entering and leaving scopes as they are found.
+ * Returns amount of translated tokens.
+ */
+int
+Module_translate_tokens(
+	struct Module        *mod,
+	struct Token         *t,
+	int                   tlen,
+	enum TranslateStatus *ts);
+
+/* Returns amount of instructions in all scopes.
+ */
+int
+Module_n_instrs(
+	const struct Module *mod);
+
+/* Optimizes all scopes, see Scope_optimize,
+ * after inlining small functions on level 1, see Module_inline.
+ * Returns non zero if malloc failed.
+ */
+int
+Module_optimize(
+	struct Module *mod,
+	int level);
+
+/* Lowers all scopes into code and links them, see Module_link.
+ * Call after translating and optimizing, before running.
+ * Returns non zero if malloc failed or a scope has too many registers.
+ */
+int
+Module_lower(
+	struct Module *mod);
+
+/* Points the code of every scope at the codes of the module,
+ * which call ops index, and sizes each frame stack to hold the frames
+ * of all calls below it, or CODE_STACK_MAX values where calls recurse.
+ * Call again after lowering scopes on their own.
+ * Returns non zero if malloc failed.
+ */
+int
+Module_link(
+	struct Module *mod);
+
+/* Runs the global scope, tiering it and its calls by jit_hot_runs,
+ * see Code_run_tiered.
+ * Returns amount of executed ops.
+ */
+long
+Module_run(
+	struct Module      *mod,
+	enum RuntimeStatus *rs);
+
 void
 Module_fprint(
 	struct Module *mod,
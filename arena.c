@@ -0,0 +1,110 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ALIGN_UP(n) (((n) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+#define BLOCK_DATA(b) ((unsigned char *) (b) + ALIGN_UP(sizeof(struct ArenaBlock)))
+
+struct Arena
+Arena_new(void)
+{
+	struct Arena ret = {
+		.head = NULL,
+		.n_blocks = 0,
+		.n_allocs = 0,
+		.bytes_allocated = 0,
+		.bytes_reserved = 0
+	};
+	return ret;
+}
+
+void
+*Arena_alloc(
+	struct Arena *a,
+	size_t        size)
+{
+	struct ArenaBlock *b;
+	size_t block_size;
+	void *ret;
+
+	size = ALIGN_UP(size == 0 ? 1 : size);
+
+	if (a->head == NULL || a->head->size - a->head->used < size) {
+		block_size = size > ARENA_BLOCK_SIZE / 4 ? size :
+		                                           ARENA_BLOCK_SIZE;
+		b = malloc(ALIGN_UP(sizeof(struct ArenaBlock)) + block_size);
+		if (b == NULL) {
+			return NULL;
+		}
+		b->size = block_size;
+		b->used = 0;
+		a->n_blocks++;
+		a->bytes_reserved += block_size;
+
+		/* big ones don't take the place of the current block */
+		if (a->head != NULL && block_size == size) {
+			b->next = a->head->next;
+			a->head->next = b;
+		} else {
+			b->next = a->head;
+			a->head = b;
+		}
+	} else {
+		b = a->head;
+	}
+
+	ret = BLOCK_DATA(b) + b->used;
+	b->used += size;
+	a->n_allocs++;
+	a->bytes_allocated += size;
+
+	return ret;
+}
+
+void
+*Arena_grow(
+	struct Arena *a,
+	void         *old,
+	size_t        old_size,
+	size_t        new_size)
+{
+	struct ArenaBlock *b = a->head;
+	void *ret;
+
+	old_size = ALIGN_UP(old_size);
+	new_size = ALIGN_UP(new_size);
+
+	if (old != NULL && b != NULL &&
+	    (unsigned char *) old + old_size == BLOCK_DATA(b) + b->used &&
+	    b->used - old_size + new_size <= b->size) {
+		b->used = b->used - old_size + new_size;
+		a->bytes_allocated += new_size - old_size;
+		return old;
+	}
+
+	ret = Arena_alloc(a, new_size);
+	if (ret != NULL && old != NULL) {
+		memcpy(ret, old, old_size < new_size ? old_size : new_size);
+	}
+
+	return ret;
+}
+
+void
+Arena_free(
+	struct Arena *a)
+{
+	struct ArenaBlock *b;
+	struct ArenaBlock *next;
+
+	for (b = a->head; b != NULL; b = next) {
+		next = b->next;
+		free(b);
+	}
+
+	*a = Arena_new();
+}
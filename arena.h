@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE 65536
+#define ARENA_ALIGN      16
+
+struct ArenaBlock {
+	struct ArenaBlock *next;
+	size_t             size;
+	size_t             used;
+};
+
+/* Bump allocator, everything allocated from it is freed at once.
+ */
+struct Arena {
+	struct ArenaBlock *head;
+	size_t             n_blocks;
+	size_t             n_allocs;
+	size_t             bytes_allocated;
+	size_t             bytes_reserved;
+};
+
+struct Arena
+Arena_new(void);
+
+/* Returns ARENA_ALIGN aligned memory, or NULL if malloc failed.
+ */
+void
+*Arena_alloc(
+	struct Arena *a,
+	size_t        size);
+
+/* Like realloc, but old is not freed.
+ * If old was the last allocation and there is room behind it,
+ * it grows in place.
+ * Returns NULL if malloc failed.
+ */
+void
+*Arena_grow(
+	struct Arena *a,
+	void         *old,
+	size_t        old_size,
+	size_t        new_size);
+
+void
+Arena_free(
+	struct Arena *a);
+
+#endif /* _ARENA_H */
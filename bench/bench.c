@@ -0,0 +1,449 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+/* Measures each stage of the pipeline on the given scripts,
+ * see gen.c for synthetic ones.
+ * usage: bench [-r REPS] FILE...
+ * Prints one JSON object per line and stage, times are the best of REPS.
+ * Files with "scopes" in their name are split into a scope every
+ * SCOPE_STATEMENTS statements while translating.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "../SVM.h"
+#include "../optimize.h"
+
+#define REPS_DEFAULT     5
+#define MIN_LOOKUPS      1000000
+#define SCOPE_STATEMENTS 64 /* keep in sync with gen.c */
+
+struct Corpus {
+	char         *path;
+	struct Source src;
+	struct Token *t;
+	int           tsize;
+	int           tlen;
+	int           n_statements;
+	int           split; /* into scopes */
+};
+
+double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+long
+peak_rss_kb(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) != 0) {
+		return -1;
+	}
+	return ru.ru_maxrss;
+}
+
+void
+json_begin(
+	const struct Corpus *c,
+	const char          *bench,
+	int                  reps)
+{
+	printf("{\"file\": \"%s\", \"bench\": \"%s\", \"reps\": %i",
+	       c->path, bench, reps);
+}
+
+void
+json_end(void)
+{
+	printf("}\n");
+	fflush(stdout);
+}
+
+/* Returns non zero if malloc failed or the text has unknown tokens.
+ */
+int
+bench_tokenize(
+	struct Corpus *c,
+	int            reps)
+{
+	int r;
+	int i;
+	double t0;
+	double best = -1;
+	struct Tokenizer tz;
+	struct Token *grown;
+	enum TokenizerError te = TE_ok;
+
+	for (r = 0; r < reps; r++) {
+		t0 = now();
+		Tokenizer_init(&tz, c->src.buf, c->src.len);
+		c->tlen = 0;
+		while (!tz.done) {
+			if (te == TE_tbuf_too_small || c->tsize == 0) {
+				c->tsize = c->tsize == 0 ? 1024 : c->tsize * 2;
+				grown = realloc(c->t, sizeof(struct Token) * c->tsize);
+				if (grown == NULL) {
+					return 1;
+				}
+				c->t = grown;
+			}
+			c->tlen += Tokenizer_read(&tz, &c->t[c->tlen],
+			                          c->tsize - c->tlen, &te);
+			if (te != TE_ok && te != TE_tbuf_too_small) {
+				return 1;
+			}
+		}
+		t0 = now() - t0;
+		if (best < 0 || t0 < best) {
+			best = t0;
+		}
+	}
+
+	c->n_statements = 0;
+	for (i = 0; i < c->tlen; i++) {
+		if (c->t[i].type == TT_separator && c->t[i].c.separator == '\n' &&
+		    i > 0 && c->t[i - 1].type != TT_separator) {
+			c->n_statements++;
+		}
+	}
+
+	json_begin(c, "tokenize", reps);
+	printf(", \"secs\": %.6f, \"bytes\": %i, \"tokens\": %i"
+	       ", \"bytes_per_sec\": %.0f, \"tokens_per_sec\": %.0f",
+	       best, c->src.len, c->tlen,
+	       c->src.len / best, c->tlen / best);
+	json_end();
+	return 0;
+}
+
+/* Translates the tokens of c into a new scope every SCOPE_STATEMENTS
+ * statements.
+ */
+void
+Module_translate_split(
+	struct Module        *mod,
+	struct Corpus        *c,
+	enum TranslateStatus *ts)
+{
+	int i = 0;
+	int end;
+	int n = 0;
+
+	while (i < c->tlen && *ts == TS_ok) {
+		end = i;
+		while (end < c->tlen - 1 &&
+		       (c->t[end].type != TT_separator ||
+		        c->t[end].c.separator != '\n')) {
+			end++;
+		}
+
+		if (n == SCOPE_STATEMENTS) {
+			if (NULL == Module_add_scope(mod, NULL, mod->s[0])) {
+				*ts = TS_malloc_failed;
+				return;
+			}
+			mod->cur = mod->s[mod->slen - 1];
+			n = 0;
+		}
+
+		Module_translate_tokens(mod, &c->t[i], end + 1 - i, ts);
+		n++;
+		i = end + 1;
+	}
+}
+
+/* Leaves the module of the last rep in mod, which borrows the source.
+ * Returns non zero if translating failed.
+ */
+int
+bench_translate(
+	struct Corpus *c,
+	struct Module *mod,
+	int            reps)
+{
+	int r;
+	double t0;
+	double best = -1;
+	enum TranslateStatus ts = TS_ok;
+
+	for (r = 0; r < reps; r++) {
+		if (r > 0) {
+			mod->src = (struct Source) {0};
+			Module_free(mod);
+		}
+
+		t0 = now();
+		*mod = Module_new(c->path);
+		mod->names = Interner_new(&mod->arena);
+		mod->src = c->src;
+		if (NULL == Module_add_scope(mod, c->path, NULL)) {
+			return 1;
+		}
+		mod->cur = mod->s[0];
+
+		if (c->split) {
+			Module_translate_split(mod, c, &ts);
+		} else {
+			Module_translate_tokens(mod, c->t, c->tlen, &ts);
+		}
+		if (ts != TS_ok) {
+			TranslateStatus_print(ts, c->path, 0, 0);
+			return 1;
+		}
+		t0 = now() - t0;
+		if (best < 0 || t0 < best) {
+			best = t0;
+		}
+	}
+
+	json_begin(c, c->split ? "translate_scopes" : "translate", reps);
+	printf(", \"secs\": %.6f, \"statements\": %i, \"scopes\": %i"
+	       ", \"instructions\": %i, \"statements_per_sec\": %.0f"
+	       ", \"arena_bytes\": %zu, \"arena_blocks\": %zu",
+	       best, c->n_statements, mod->slen, Module_n_instrs(mod),
+	       c->n_statements / best,
+	       mod->arena.bytes_allocated, mod->arena.n_blocks);
+	json_end();
+	return 0;
+}
+
+void
+bench_find_var(
+	struct Corpus *c,
+	struct Module *mod,
+	int            reps)
+{
+	int r;
+	int i;
+	int v;
+	int n_vars = 0;
+	long lookups = 0;
+	long found = 0;
+	double t0;
+	double best = -1;
+	struct Scope *s;
+
+	for (i = 0; i < mod->slen; i++) {
+		n_vars += mod->s[i]->n_vars;
+	}
+	if (n_vars == 0) {
+		return;
+	}
+
+	for (r = 0; r < reps; r++) {
+		t0 = now();
+		lookups = 0;
+		found = 0;
+		while (lookups < MIN_LOOKUPS) {
+			for (i = 0; i < mod->slen; i++) {
+				s = mod->s[i];
+				for (v = 0; v < s->n_vars; v++) {
+					found += Scope_find_var(s, s->var_names[v]) == v;
+				}
+			}
+			lookups += n_vars;
+		}
+		t0 = now() - t0;
+		if (best < 0 || t0 < best) {
+			best = t0;
+		}
+	}
+
+	json_begin(c, "find_var", reps);
+	printf(", \"secs\": %.6f, \"vars\": %i, \"lookups\": %li"
+	       ", \"found\": %li, \"lookups_per_sec\": %.0f",
+	       best, n_vars, lookups, found, lookups / best);
+	json_end();
+}
+
+/* Runs all scopes, interpreted or as native code.
+ * Returns non zero if malloc failed or a run failed.
+ */
+int
+bench_run(
+	struct Corpus *c,
+	struct Module *mod,
+	int            reps,
+	int            jit)
+{
+	int r;
+	int i;
+	int ic;
+	int failed = 1;
+	long ops = 0;
+	double t0;
+	double best = -1;
+	double compile = 0;
+	struct Value **frames;
+	struct JitCode **code;
+	enum RuntimeStatus rs = RS_ok;
+
+	frames = calloc(mod->slen, sizeof(struct Value *));
+	code = calloc(mod->slen, sizeof(struct JitCode *));
+	if (frames == NULL || code == NULL) {
+		free(frames);
+		free(code);
+		return 1;
+	}
+
+	if (jit) {
+		t0 = now();
+		for (i = 0; i < mod->slen; i++) {
+			code[i] = Jit_compile(&mod->s[i]->code);
+			if (code[i] == NULL) {
+				/* not supported here */
+				failed = 0;
+				goto cleanup;
+			}
+		}
+		compile = now() - t0;
+	}
+
+	for (r = 0; r < reps; r++) {
+		for (i = 0; i < mod->slen; i++) {
+			free(frames[i]);
+			frames[i] = Code_new_frame(&mod->s[i]->code);
+			if (frames[i] == NULL) {
+				goto cleanup;
+			}
+		}
+
+		ops = 0;
+		t0 = now();
+		for (i = 0; i < mod->slen && rs == RS_ok; i++) {
+			if (jit) {
+				ops += Jit_run(code[i], &mod->s[i]->code,
+				               frames[i], &ic, &rs);
+			} else {
+				ops += Code_run(&mod->s[i]->code, frames[i],
+				                &ic, &rs);
+			}
+		}
+		t0 = now() - t0;
+		if (rs != RS_ok) {
+			RuntimeStatus_print(rs, c->path, mod->s[i - 1]->code.rows[ic]);
+			goto cleanup;
+		}
+		if (best < 0 || t0 < best) {
+			best = t0;
+		}
+	}
+
+	json_begin(c, jit ? "run_jit" : "run", reps);
+	printf(", \"secs\": %.6f, \"ops\": %li, \"ops_per_sec\": %.0f",
+	       best, ops, ops / best);
+	if (jit) {
+		printf(", \"compile_secs\": %.6f", compile);
+	}
+	json_end();
+	failed = 0;
+
+cleanup:
+	for (i = 0; i < mod->slen; i++) {
+		free(frames[i]);
+		Jit_free(code[i]);
+	}
+	free(frames);
+	free(code);
+	return failed;
+}
+
+/* Returns non zero if any stage failed.
+ */
+int
+bench_file(
+	char *path,
+	int   reps)
+{
+	int ret = 1;
+	FILE *f;
+	struct Module mod = {0};
+	struct Corpus c = {0};
+
+	c.path = path;
+	c.split = strstr(path, "scopes") != NULL;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "File \"%s\" could not be opened\n", path);
+		return 1;
+	}
+	if (Source_from_file(&c.src, f)) {
+		fprintf(stderr, "File \"%s\" could not be read\n", path);
+		fclose(f);
+		return 1;
+	}
+	fclose(f);
+
+	if (bench_tokenize(&c, reps)) {
+		fprintf(stderr, "%s: Tokenizing failed\n", path);
+		goto cleanup;
+	}
+	if (bench_translate(&c, &mod, reps)) {
+		fprintf(stderr, "%s: Translating failed\n", path);
+		goto cleanup;
+	}
+	bench_find_var(&c, &mod, reps);
+
+	/* the scripts have no input, so -O1 would fold them into constants */
+	if (Module_optimize(&mod, 0) || Module_lower(&mod)) {
+		fprintf(stderr, "%s: Lowering failed\n", path);
+		goto cleanup;
+	}
+	if (bench_run(&c, &mod, reps, 0) || bench_run(&c, &mod, reps, 1)) {
+		goto cleanup;
+	}
+
+	json_begin(&c, "memory", reps);
+	printf(", \"arena_bytes\": %zu, \"arena_reserved\": %zu"
+	       ", \"peak_rss_kb\": %li",
+	       mod.arena.bytes_allocated, mod.arena.bytes_reserved,
+	       peak_rss_kb());
+	json_end();
+	ret = 0;
+
+cleanup:
+	/* the module only borrowed the source */
+	mod.src = (struct Source) {0};
+	Module_free(&mod);
+	Source_free(&c.src);
+	free(c.t);
+	return ret;
+}
+
+int
+main(
+	int argc,
+	char *argv[])
+{
+	int i = 1;
+	int reps = REPS_DEFAULT;
+	int ret = 0;
+
+	if (argc > 2 && strcmp(argv[1], "-r") == 0) {
+		reps = atoi(argv[2]);
+		i = 3;
+	}
+	if (i >= argc || reps < 1) {
+		fprintf(stderr, "usage: %s [-r REPS] FILE...\n", argv[0]);
+		return 1;
+	}
+
+	for (; i < argc; i++) {
+		ret |= bench_file(argv[i], reps);
+	}
+
+	return ret;
+}
@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+/* Writes a synthetic script of a given shape and size to stdout.
+ * usage: gen SHAPE N
+ * vars:   N distinct variables, each computed from the previous one
+ * deep:   N statements with expressions nested 32 levels deep
+ * long:   N short statements over a handful of variables
+ * scopes: N blocks like long, each of SCOPE_STATEMENTS statements that
+ *         each define their own variables, so the benchmark can put
+ *         every block into its own scope
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEEP_LEVELS      32
+#define LONG_VARS        8
+#define SCOPE_STATEMENTS 64 /* keep in sync with bench.c */
+
+/* Identifiers may only contain letters, so numbers are written in base 26.
+ */
+void
+name_fprint(
+	int n,
+	FILE *f)
+{
+	char buf[16];
+	int i = sizeof(buf) - 1;
+
+	buf[i] = '\0';
+	do {
+		i--;
+		buf[i] = 'a' + n % 26;
+		n /= 26;
+	} while (n > 0);
+
+	fprintf(f, "v%s", &buf[i]);
+}
+
+void
+gen_vars(
+	int n,
+	FILE *f)
+{
+	int i;
+
+	fprintf(f, "va = 1\n");
+	for (i = 1; i < n; i++) {
+		name_fprint(i, f);
+		fprintf(f, " = ");
+		name_fprint(i - 1, f);
+		fprintf(f, " + %i\n", i % 97);
+	}
+}
+
+void
+gen_deep(
+	int n,
+	FILE *f)
+{
+	static const char ops[] = "+-*%";
+	int i;
+	int d;
+
+	fprintf(f, "x = 1\n");
+	for (i = 0; i < n; i++) {
+		fprintf(f, "x = ");
+		for (d = 0; d < DEEP_LEVELS; d++) {
+			fprintf(f, "(");
+		}
+		fprintf(f, "x");
+		for (d = 0; d < DEEP_LEVELS; d++) {
+			fprintf(f, " %c %i)", ops[d % 4], d % 7 + 2);
+		}
+		fprintf(f, " %% 1000\n");
+	}
+}
+
+void
+gen_long_statement(
+	int i,
+	int comments,
+	FILE *f)
+{
+	name_fprint(i % LONG_VARS, f);
+	fprintf(f, " = ");
+	name_fprint((i + 3) % LONG_VARS, f);
+	fprintf(f, " * %i + ", i % 13 + 1);
+	name_fprint((i + 5) % LONG_VARS, f);
+	fprintf(f, " / %i", i % 5 + 1);
+	if (comments && i % 4 == 0) {
+		fprintf(f, " # comment %i", i);
+	}
+	fprintf(f, "\n");
+}
+
+void
+gen_long_vars(
+	FILE *f)
+{
+	int i;
+
+	for (i = 0; i < LONG_VARS; i++) {
+		name_fprint(i, f);
+		fprintf(f, " = %i\n", i + 1);
+	}
+}
+
+void
+gen_long(
+	int n,
+	FILE *f)
+{
+	int i;
+
+	gen_long_vars(f);
+	for (i = 0; i < n; i++) {
+		gen_long_statement(i, 1, f);
+	}
+}
+
+void
+gen_scopes(
+	int n,
+	FILE *f)
+{
+	int i;
+	int s;
+
+	for (s = 0; s < n; s++) {
+		gen_long_vars(f);
+		for (i = LONG_VARS; i < SCOPE_STATEMENTS; i++) {
+			gen_long_statement(i, 0, f);
+		}
+	}
+}
+
+int
+main(
+	int argc,
+	char *argv[])
+{
+	int n;
+
+	if (argc != 3 || (n = atoi(argv[2])) <= 0) {
+		fprintf(stderr, "usage: %s vars|deep|long|scopes N\n", argv[0]);
+		return 1;
+	}
+
+	if (strcmp(argv[1], "vars") == 0) {
+		gen_vars(n, stdout);
+	} else if (strcmp(argv[1], "deep") == 0) {
+		gen_deep(n, stdout);
+	} else if (strcmp(argv[1], "long") == 0) {
+		gen_long(n, stdout);
+	} else if (strcmp(argv[1], "scopes") == 0) {
+		gen_scopes(n, stdout);
+	} else {
+		fprintf(stderr, "unknown shape \"%s\"\n", argv[1]);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,1074 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#include "bytecode.h"
+#include "SVM.h"
+#include "jit.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Computed goto is a GNU extension, so it's only used where available.
+ * Define SVM_NO_COMPUTED_GOTO to force the portable switch dispatch.
+ */
+#if defined(__GNUC__) && !defined(SVM_NO_COMPUTED_GOTO)
+#define SVM_COMPUTED_GOTO
+#endif
+
+/* GCC merges the equal ends of ops into one shared dispatch,
+ * which the cpu then predicts far worse than one dispatch per op.
+ */
+#if defined(SVM_COMPUTED_GOTO) && !defined(__clang__)
+#define CODE_RUN_ATTRIBUTES __attribute__((optimize("no-crossjumping")))
+#else
+#define CODE_RUN_ATTRIBUTES
+#endif
+
+static inline uint16_t
+Code_register_of(
+	const struct Code    *c,
+	const struct Operand *o)
+{
+	switch (o->type) {
+	case OT_var:
+		return o->idx;
+	case OT_tmp:
+		return c->n_vars + o->idx;
+	case OT_literal:
+		return c->n_vars + c->n_tmps + o->idx;
+	case OT_arg:
+		return c->n_vars + c->n_tmps + c->n_consts + o->idx;
+	case OT_func:
+		return o->idx;
+	}
+
+	return 0;
+}
+
+void
+Opcode_fprint(
+	enum Opcode oc,
+	FILE *f)
+{
+	switch (oc) {
+	case OP_halt:
+		fprintf(f, "halt");
+		break;
+	case OP_mov:
+		fprintf(f, "mov");
+		break;
+	case OP_add:
+		fprintf(f, "add");
+		break;
+	case OP_sub:
+		fprintf(f, "sub");
+		break;
+	case OP_mul:
+		fprintf(f, "mul");
+		break;
+	case OP_div:
+		fprintf(f, "div");
+		break;
+	case OP_modulus:
+		fprintf(f, "modulus");
+		break;
+	case OP_movi:
+		fprintf(f, "movi");
+		break;
+	case OP_addi:
+		fprintf(f, "addi");
+		break;
+	case OP_subi:
+		fprintf(f, "subi");
+		break;
+	case OP_muli:
+		fprintf(f, "muli");
+		break;
+	case OP_inci:
+		fprintf(f, "inci");
+		break;
+	case OP_muladd_ii:
+		fprintf(f, "muladd_ii");
+		break;
+	case OP_call:
+		fprintf(f, "call");
+		break;
+	case OP_ret:
+		fprintf(f, "ret");
+		break;
+	default:
+		if (oc < OP_add_ii || oc > OP_modulus_ff) {
+			break;
+		}
+		Opcode_fprint(Opcode_generic(oc), f);
+		fprintf(f, "_%c%c",
+		        (oc - OP_add_ii) & 2 ? 'f' : 'i',
+		        (oc - OP_add_ii) & 1 ? 'f' : 'i');
+		break;
+	}
+}
+
+enum Opcode
+Opcode_generic(
+	enum Opcode oc)
+{
+	switch (oc) {
+	case OP_movi:
+		return OP_mov;
+	case OP_addi:
+	case OP_inci:
+		return OP_add;
+	case OP_subi:
+		return OP_sub;
+	case OP_muli:
+	case OP_muladd_ii:
+		/* the add is the next op */
+		return OP_mul;
+	default:
+		break;
+	}
+
+	if (oc < OP_add_ii || oc > OP_modulus_ff) {
+		return oc;
+	}
+	return OP_add + (oc - OP_add_ii) / 4;
+}
+
+enum Opcode
+Opcode_specialize(
+	enum Opcode    oc,
+	enum ValueType left,
+	enum ValueType right)
+{
+	return OP_add_ii + (oc - OP_add) * 4 +
+	       (left == VT_float) * 2 + (right == VT_float);
+}
+
+int
+Code_from_scope(
+	struct Code  *c,
+	struct Scope *s,
+	struct Arena *arena)
+{
+	return Code_from_instructions(c, s, 0, arena);
+}
+
+int
+Code_from_instructions(
+	struct Code  *c,
+	struct Scope *s,
+	int           first,
+	struct Arena *arena)
+{
+	int i;
+	int v;
+	uint16_t regs[3];
+	const struct Instruction *instr;
+
+	if (Scope_n_regs(s) + s->n_args > CODE_MAX_REGISTERS) {
+		return 1;
+	}
+
+	c->n_ops = s->n_instrs - first;
+	c->n_params = s->n_params;
+	c->n_vars = s->n_vars;
+	c->n_tmps = s->n_tmp_vals;
+	c->n_consts = s->n_literals;
+	c->n_args = s->n_args;
+	c->consts = s->literals;
+	c->ops = Arena_alloc(arena, sizeof(struct Op) * (c->n_ops + 1));
+	c->rows = Arena_alloc(arena, sizeof(int) * (c->n_ops + 1));
+	if (c->ops == NULL || c->rows == NULL) {
+		return 1;
+	}
+
+	for (i = 0; i < c->n_ops; i++) {
+		instr = &s->instrs[first + i];
+
+		for (v = 0; v < instr->n_vals; v++) {
+			regs[v] = Code_register_of(c, &instr->vals[v]);
+		}
+
+		switch (instr->type) {
+		case IT_mov:
+			c->ops[i].code = OP_mov;
+			regs[2] = 0;
+			break;
+		case IT_add:
+			c->ops[i].code = OP_add;
+			break;
+		case IT_sub:
+			c->ops[i].code = OP_sub;
+			break;
+		case IT_mul:
+			c->ops[i].code = OP_mul;
+			break;
+		case IT_div:
+			c->ops[i].code = OP_div;
+			break;
+		case IT_modulus:
+			c->ops[i].code = OP_modulus;
+			break;
+		case IT_call:
+			c->ops[i].code = OP_call;
+			regs[2] = 0;
+			break;
+		case IT_return:
+			c->ops[i].code = OP_ret;
+			regs[1] = 0;
+			regs[2] = 0;
+			break;
+		}
+		c->ops[i].imm = 0;
+		c->ops[i].a = regs[0];
+		c->ops[i].b = regs[1];
+		c->ops[i].c = regs[2];
+		c->rows[i] = instr->row;
+	}
+
+	c->ops[c->n_ops].code = OP_halt;
+	c->ops[c->n_ops].imm = 0;
+	c->ops[c->n_ops].a = 0;
+	c->ops[c->n_ops].b = 0;
+	c->ops[c->n_ops].c = 0;
+	c->rows[c->n_ops] = 0;
+	c->n_regs = c->n_vars + c->n_tmps + c->n_consts;
+	/* until Module_link knows the calls */
+	c->stack_size = c->n_regs + c->n_args;
+	c->codes = NULL;
+	c->n_codes = 0;
+	c->hot_runs = -1;
+	c->n_runs = 0;
+	c->jit = NULL;
+	c->jit_failed = 0;
+
+	if (Code_specialize(c)) {
+		return 1;
+	}
+	Code_fuse(c);
+	return 0;
+}
+
+/* Returns non zero if register r is an int constant, that fits into imm,
+ * which is then set to it.
+ */
+static int
+Code_small_int(
+	const struct Code *c,
+	uint16_t           r,
+	int8_t            *imm)
+{
+	const struct Value *v;
+
+	if (r < c->n_vars + c->n_tmps || r >= c->n_regs) {
+		return 0;
+	}
+	v = &c->consts[r - c->n_vars - c->n_tmps];
+	if (v->type != VT_int || v->c.i < INT8_MIN || v->c.i > INT8_MAX) {
+		return 0;
+	}
+
+	if (imm != NULL) {
+		*imm = v->c.i;
+	}
+	return 1;
+}
+
+int
+Code_fuse(
+	struct Code *c)
+{
+	int i;
+	int ret = 0;
+	uint16_t swap;
+	struct Op *op;
+
+	for (i = 0; i < c->n_ops; i++) {
+		op = &c->ops[i];
+
+		switch (op->code) {
+		case OP_mov:
+			if (Code_small_int(c, op->b, &op->imm)) {
+				op->code = OP_movi;
+				ret++;
+			}
+			break;
+
+		case OP_mul_ii:
+			if (i + 1 < c->n_ops && c->ops[i + 1].code == OP_add_ii) {
+				op->code = OP_muladd_ii;
+				ret++;
+				i++;
+				break;
+			}
+			/* fall through */
+		case OP_add_ii:
+			/* both are commutative, so the constant can go right */
+			if (Code_small_int(c, op->b, NULL) &&
+			    !Code_small_int(c, op->c, NULL)) {
+				swap = op->b;
+				op->b = op->c;
+				op->c = swap;
+			}
+			if (!Code_small_int(c, op->c, &op->imm)) {
+				break;
+			}
+			if (op->code == OP_mul_ii) {
+				op->code = OP_muli;
+			} else {
+				op->code = op->a == op->b ? OP_inci : OP_addi;
+			}
+			ret++;
+			break;
+
+		case OP_sub_ii:
+			if (Code_small_int(c, op->c, &op->imm)) {
+				op->code = OP_subi;
+				ret++;
+			}
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	return ret;
+}
+
+/* Marks a register whose type depends on the run,
+ * since code has no jumps, only parameters and results of calls.
+ */
+#define TYPE_UNKNOWN 0xFF
+
+int
+Code_specialize(
+	struct Code *c)
+{
+	int i;
+	enum Opcode oc;
+	unsigned char *types;
+	struct Op *op;
+
+	types = malloc(c->n_regs + c->n_args + 1);
+	if (types == NULL) {
+		return 1;
+	}
+	/* frames start with int zeros, but parameters are passed in */
+	for (i = 0; i < c->n_vars + c->n_tmps; i++) {
+		types[i] = i < c->n_params ? TYPE_UNKNOWN : VT_int;
+	}
+	for (i = 0; i < c->n_consts; i++) {
+		types[c->n_vars + c->n_tmps + i] = c->consts[i].type;
+	}
+
+	for (i = 0; i < c->n_ops; i++) {
+		op = &c->ops[i];
+		oc = Opcode_generic(op->code);
+
+		switch (oc) {
+		case OP_halt:
+		case OP_ret:
+			break;
+
+		case OP_mov:
+			types[op->a] = types[op->b];
+			break;
+
+		case OP_call:
+			types[op->a] = TYPE_UNKNOWN;
+			break;
+
+		default:
+			if (types[op->b] == TYPE_UNKNOWN ||
+			    types[op->c] == TYPE_UNKNOWN) {
+				op->code = oc;
+				types[op->a] = TYPE_UNKNOWN;
+				break;
+			}
+			op->code = Opcode_specialize(oc, types[op->b],
+			                             types[op->c]);
+			types[op->a] = types[op->b] == VT_int &&
+			               types[op->c] == VT_int ?
+			               VT_int : VT_float;
+			break;
+		}
+	}
+
+	free(types);
+	return 0;
+}
+
+int
+Code_validate(
+	const struct Code *c)
+{
+	int i;
+	const struct Op *op;
+
+	if (c->n_ops < 0 ||
+	    c->n_vars < 0 || c->n_tmps < 0 || c->n_consts < 0 ||
+	    c->n_params < 0 || c->n_params > c->n_vars || c->n_args < 0 ||
+	    c->n_vars + c->n_tmps + c->n_consts != c->n_regs ||
+	    c->n_regs + c->n_args > CODE_MAX_REGISTERS) {
+		return 1;
+	}
+
+	for (i = 0; i < c->n_ops; i++) {
+		op = &c->ops[i];
+
+		switch (op->code) {
+		case OP_halt:
+			return 1;
+
+		case OP_mov:
+		case OP_movi:
+			if (op->a >= c->n_regs + c->n_args ||
+			    op->b >= c->n_regs) {
+				return 1;
+			}
+			break;
+
+		case OP_call:
+			if (op->a >= c->n_regs + c->n_args ||
+			    op->b >= c->n_codes) {
+				return 1;
+			}
+			break;
+
+		case OP_ret:
+			if (op->a >= c->n_regs) {
+				return 1;
+			}
+			break;
+
+		case OP_muladd_ii:
+			/* the add is run without a dispatch of its own */
+			if (i + 1 >= c->n_ops || op[1].code != OP_add_ii ||
+			    op->a >= c->n_regs ||
+			    op->b >= c->n_regs ||
+			    op->c >= c->n_regs) {
+				return 1;
+			}
+			break;
+
+		case OP_add:
+		case OP_sub:
+		case OP_mul:
+		case OP_div:
+		case OP_modulus:
+		default:
+			/* specialized ops only differ in how they read
+			 * their sources, which are always inside the frame,
+			 * and results may be written as arguments of a call */
+			if (op->code >= N_OPCODES ||
+			    op->a >= c->n_regs + c->n_args ||
+			    op->b >= c->n_regs ||
+			    op->c >= c->n_regs) {
+				return 1;
+			}
+			break;
+		}
+	}
+
+	return c->ops[c->n_ops].code != OP_halt;
+}
+
+struct Value
+*Code_new_frame(
+	const struct Code *c)
+{
+	struct Value *regs;
+
+	/* zero bits are int zeros, so the frames of calls never hold
+	 * anything but values either */
+	regs = calloc(c->stack_size > 0 ? c->stack_size : 1,
+	              sizeof(struct Value));
+	if (regs == NULL) {
+		return NULL;
+	}
+
+	/* consts are NULL, if there are none */
+	if (c->n_consts > 0) {
+		memcpy(&regs[c->n_vars + c->n_tmps],
+		       c->consts,
+		       sizeof(struct Value) * c->n_consts);
+	}
+
+	return regs;
+}
+
+/* Integer math wraps around instead of overflowing.
+ */
+#define INT_MATH(dest, left, right, OP)                           \
+	(dest)->type = VT_int;                                    \
+	(dest)->c.i = (int) ((unsigned) (left) OP (unsigned) (right))
+
+#define FLOAT_MATH(dest, left, right, OP) \
+	(dest)->c.f = (left) OP (right);  \
+	(dest)->type = VT_float
+
+#define VALUE_MATH(dest, left, right, OP)                                  \
+	if ((left)->type == VT_int && (right)->type == VT_int) {           \
+		INT_MATH(dest, (left)->c.i, (right)->c.i, OP);             \
+	} else {                                                           \
+		FLOAT_MATH(dest, Value_to_float(left), Value_to_float(right), \
+		           OP);                                            \
+	}
+
+static inline float
+Value_to_float(
+	const struct Value *v)
+{
+	return v->type == VT_int ? (float) v->c.i : v->c.f;
+}
+
+/* Returns non zero on division by zero.
+ */
+static inline int
+Value_div_int(
+	struct Value *dest,
+	const int left,
+	const int right,
+	const int modulus)
+{
+	if (right == 0) {
+		return 1;
+	}
+	dest->type = VT_int;
+	if (left == INT_MIN && right == -1) {
+		dest->c.i = modulus ? 0 : INT_MIN;
+	} else {
+		dest->c.i = modulus ? left % right : left / right;
+	}
+
+	return 0;
+}
+
+static inline void
+Value_div_float(
+	struct Value *dest,
+	const float left,
+	const float right,
+	const int modulus)
+{
+	dest->c.f = modulus ? fmodf(left, right) : left / right;
+	dest->type = VT_float;
+}
+
+/* Returns non zero on division by zero.
+ */
+static inline int
+Value_div(
+	struct Value *dest,
+	const struct Value *left,
+	const struct Value *right,
+	const int modulus)
+{
+	if (left->type == VT_int && right->type == VT_int) {
+		return Value_div_int(dest, left->c.i, right->c.i, modulus);
+	}
+
+	Value_div_float(dest, Value_to_float(left), Value_to_float(right),
+	                modulus);
+	return 0;
+}
+
+enum RuntimeStatus
+Value_apply(
+	struct Value       *dest,
+	enum Opcode         oc,
+	const struct Value *left,
+	const struct Value *right)
+{
+	/* specialized ops give the same results on the types they expect */
+	switch (Opcode_generic(oc)) {
+	case OP_halt:
+		break;
+	case OP_mov:
+		*dest = *left;
+		break;
+	case OP_add:
+		VALUE_MATH(dest, left, right, +);
+		break;
+	case OP_sub:
+		VALUE_MATH(dest, left, right, -);
+		break;
+	case OP_mul:
+		VALUE_MATH(dest, left, right, *);
+		break;
+	case OP_div:
+		if (Value_div(dest, left, right, 0)) {
+			return RS_division_by_zero;
+		}
+		break;
+	case OP_modulus:
+		if (Value_div(dest, left, right, 1)) {
+			return RS_division_by_zero;
+		}
+		break;
+	default:
+		break;
+	}
+
+	return RS_ok;
+}
+
+int
+Code_enter(
+	const struct Code  *c,
+	struct Value       *regs,
+	const struct Value *end,
+	int                 depth)
+{
+	if (depth >= CODE_MAX_CALLS || c->n_regs + c->n_args > end - regs) {
+		return 0;
+	}
+
+	if (c->n_consts > 0) {
+		memcpy(&regs[c->n_vars + c->n_tmps],
+		       c->consts,
+		       sizeof(struct Value) * c->n_consts);
+	}
+	return 1;
+}
+
+/* Runs code op by op through Value_apply,
+ * for frames that do not fit the specialized ops.
+ * A function stops at its ret op, which ic then points at.
+ */
+static long
+Code_run_generic(
+	const struct Code  *c,
+	struct Value       *regs,
+	const struct Value *end,
+	int                 depth,
+	int                *ic,
+	enum RuntimeStatus *rs)
+{
+	long n_called = 0;
+	const struct Op *op;
+
+	*rs = RS_ok;
+
+	for (op = c->ops; op->code != OP_halt; op++) {
+		if (op->code == OP_ret) {
+			*ic = op - c->ops;
+			return n_called + (op - c->ops + 1);
+		}
+
+		if (op->code == OP_call) {
+			n_called += Code_call(c, op, regs, end, depth, rs);
+		} else {
+			*rs = Value_apply(&regs[op->a], op->code,
+			                  &regs[op->b], &regs[op->c]);
+		}
+		if (*rs) {
+			*ic = op - c->ops;
+			return n_called + (op - c->ops + 1);
+		}
+	}
+
+	*ic = op - c->ops - 1;
+	return n_called + (op - c->ops);
+}
+
+long
+Code_call(
+	const struct Code  *c,
+	const struct Op    *op,
+	struct Value       *regs,
+	const struct Value *end,
+	int                 depth,
+	enum RuntimeStatus *rs)
+{
+	int ic;
+	long n;
+	const struct Code *callee = c->codes[op->b];
+	struct Value *frame = &regs[c->n_regs];
+
+	if (!Code_enter(callee, frame, end, depth)) {
+		*rs = RS_stack_overflow;
+		return 0;
+	}
+
+	n = Code_run_generic(callee, frame, end, depth + 1, &ic, rs);
+	if (*rs) {
+		return n;
+	}
+
+	/* functions end with ret, but would return zero otherwise */
+	if (ic >= 0 && callee->ops[ic].code == OP_ret) {
+		regs[op->a] = frame[callee->ops[ic].a];
+	} else {
+		regs[op->a].type = VT_int;
+		regs[op->a].c.i = 0;
+	}
+	return n;
+}
+
+/* Some cpus forward a store to a later load much faster, if both address
+ * the value through the same base register. Hiding the pointer from the
+ * compiler keeps it from folding the index into each access instead.
+ */
+static inline struct Value
+*Code_reg(
+	struct Value *regs,
+	uint16_t      r)
+{
+	struct Value *ret = &regs[r];
+
+#ifdef __GNUC__
+	__asm__("" : "+r" (ret));
+#endif
+	return ret;
+}
+
+/* Where a call returns to.
+ */
+struct CodeCall {
+	const struct Code *c;
+	const struct Op   *op;
+	struct Value      *regs;
+};
+
+#ifdef SVM_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+CODE_RUN_ATTRIBUTES long
+Code_run(
+	const struct Code  *c,
+	struct Value       *regs,
+	int                *ic,
+	enum RuntimeStatus *rs)
+{
+	int i;
+	int native;
+	int depth = 0;
+	long n_called = 0; /* ops run by calls, which have their own begin */
+	const struct Op *begin = c->ops;
+	const struct Op *op = begin;
+	const struct Code *cur = c;
+	const struct Code *callee;
+	const struct Value *end = &regs[c->stack_size];
+	struct Value *frame;
+	struct Value result;
+	struct CodeCall calls[CODE_MAX_CALLS];
+
+#ifdef SVM_COMPUTED_GOTO
+#define SPECIALIZED(oc)                     \
+	[OP_##oc##_ii] = &&do_##oc##_ii,    \
+	[OP_##oc##_if] = &&do_##oc##_if,    \
+	[OP_##oc##_fi] = &&do_##oc##_fi,    \
+	[OP_##oc##_ff] = &&do_##oc##_ff
+	static void *const dispatch_table[] = {
+		[OP_halt]    = &&do_halt,
+		[OP_mov]     = &&do_mov,
+		[OP_add]     = &&do_add,
+		[OP_sub]     = &&do_sub,
+		[OP_mul]     = &&do_mul,
+		[OP_div]     = &&do_div,
+		[OP_modulus] = &&do_modulus,
+		SPECIALIZED(add),
+		SPECIALIZED(sub),
+		SPECIALIZED(mul),
+		SPECIALIZED(div),
+		SPECIALIZED(modulus),
+		[OP_movi]      = &&do_movi,
+		[OP_addi]      = &&do_addi,
+		[OP_subi]      = &&do_subi,
+		[OP_muli]      = &&do_muli,
+		[OP_inci]      = &&do_inci,
+		[OP_muladd_ii] = &&do_muladd_ii,
+		[OP_call]      = &&do_call,
+		[OP_ret]       = &&do_ret,
+	};
+#undef SPECIALIZED
+#define DISPATCH() goto *dispatch_table[op->code]
+#define CASE(oc)   do_##oc:
+#define NEXT()     op++; DISPATCH()
+#define JUMP()     DISPATCH()
+#else
+#define CASE(oc)   case OP_##oc:
+#define NEXT()     op++; continue
+#define JUMP()     continue
+#endif
+#define A  Code_reg(regs, op->a)
+#define BI Code_reg(regs, op->b)->c.i
+#define BF Code_reg(regs, op->b)->c.f
+#define CI Code_reg(regs, op->c)->c.i
+#define CF Code_reg(regs, op->c)->c.f
+#define CASE_MATH(oc, OP)                         \
+	CASE(oc##_ii)                             \
+		INT_MATH(A, BI, CI, OP);          \
+		NEXT();                           \
+	CASE(oc##_if)                             \
+		FLOAT_MATH(A, (float) BI, CF, OP); \
+		NEXT();                           \
+	CASE(oc##_fi)                             \
+		FLOAT_MATH(A, BF, (float) CI, OP); \
+		NEXT();                           \
+	CASE(oc##_ff)                             \
+		FLOAT_MATH(A, BF, CF, OP);        \
+		NEXT();
+#define CASE_DIV(oc, modulus)                             \
+	CASE(oc##_ii)                                     \
+		if (Value_div_int(A, BI, CI, modulus)) {  \
+			*rs = RS_division_by_zero;        \
+			goto run_end;                     \
+		}                                         \
+		NEXT();                                   \
+	CASE(oc##_if)                                     \
+		Value_div_float(A, (float) BI, CF, modulus); \
+		NEXT();                                   \
+	CASE(oc##_fi)                                     \
+		Value_div_float(A, BF, (float) CI, modulus); \
+		NEXT();                                   \
+	CASE(oc##_ff)                                     \
+		Value_div_float(A, BF, CF, modulus);      \
+		NEXT();
+
+	/* specialized ops were inferred from a new frame */
+	for (i = 0; i < c->n_vars; i++) {
+		if (regs[i].type != VT_int) {
+			return Code_run_generic(c, regs, end, 0, ic, rs);
+		}
+	}
+
+	*rs = RS_ok;
+
+#ifdef SVM_COMPUTED_GOTO
+	DISPATCH();
+	{
+#else
+	for (;;) switch (op->code) {
+#endif
+	CASE(halt)
+		if (depth == 0) {
+			goto run_end;
+		}
+		/* functions end with ret, but would return zero otherwise */
+		result.type = VT_int;
+		result.c.i = 0;
+		goto call_return;
+
+	CASE(call)
+		callee = cur->codes[op->b];
+		if (callee->hot_runs >= 0) {
+			native = Code_call_tiered(cur, op, regs, end, depth,
+			                          &n_called, rs);
+			if (native > 0) {
+				goto run_end;
+			} else if (native == 0) {
+				NEXT();
+			}
+		}
+		frame = &regs[cur->n_regs];
+		if (!Code_enter(callee, frame, end, depth)) {
+			*rs = RS_stack_overflow;
+			goto run_end;
+		}
+		calls[depth].c = cur;
+		calls[depth].op = op;
+		calls[depth].regs = regs;
+		depth++;
+		cur = callee;
+		regs = frame;
+		op = callee->ops;
+		JUMP();
+
+	CASE(ret)
+		result = regs[op->a];
+	call_return:
+		n_called += op - cur->ops + 1;
+		depth--;
+		cur = calls[depth].c;
+		op = calls[depth].op;
+		regs = calls[depth].regs;
+		regs[op->a] = result;
+		NEXT();
+
+	CASE(mov)
+		regs[op->a] = regs[op->b];
+		NEXT();
+
+	CASE(add)
+		VALUE_MATH(&regs[op->a], &regs[op->b], &regs[op->c], +);
+		NEXT();
+
+	CASE(sub)
+		VALUE_MATH(&regs[op->a], &regs[op->b], &regs[op->c], -);
+		NEXT();
+
+	CASE(mul)
+		VALUE_MATH(&regs[op->a], &regs[op->b], &regs[op->c], *);
+		NEXT();
+
+	CASE(div)
+		if (Value_div(&regs[op->a], &regs[op->b], &regs[op->c], 0)) {
+			*rs = RS_division_by_zero;
+			goto run_end;
+		}
+		NEXT();
+
+	CASE(modulus)
+		if (Value_div(&regs[op->a], &regs[op->b], &regs[op->c], 1)) {
+			*rs = RS_division_by_zero;
+			goto run_end;
+		}
+		NEXT();
+
+	CASE_MATH(add, +)
+	CASE_MATH(sub, -)
+	CASE_MATH(mul, *)
+	CASE_DIV(div, 0)
+	CASE_DIV(modulus, 1)
+
+	CASE(movi)
+		INT_MATH(A, op->imm, 0, +);
+		NEXT();
+
+	CASE(addi)
+		INT_MATH(A, BI, op->imm, +);
+		NEXT();
+
+	CASE(subi)
+		INT_MATH(A, BI, op->imm, -);
+		NEXT();
+
+	CASE(muli)
+		INT_MATH(A, BI, op->imm, *);
+		NEXT();
+
+	CASE(inci)
+		/* a is known to hold an int already */
+		A->c.i = (int) ((unsigned) A->c.i + (unsigned) op->imm);
+		NEXT();
+
+	CASE(muladd_ii)
+		INT_MATH(A, BI, CI, *);
+		op++;
+		INT_MATH(A, BI, CI, +);
+		NEXT();
+	}
+
+#ifdef SVM_COMPUTED_GOTO
+#undef DISPATCH
+#endif
+#undef CASE
+#undef NEXT
+#undef JUMP
+#undef A
+#undef BI
+#undef BF
+#undef CI
+#undef CF
+#undef CASE_MATH
+#undef CASE_DIV
+
+run_end:
+	/* errors in calls are reported at the outermost call */
+	if (depth > 0) {
+		n_called += op - cur->ops + 1;
+		while (depth > 1) {
+			depth--;
+			n_called += calls[depth].op - calls[depth].c->ops + 1;
+		}
+		op = calls[0].op;
+	}
+	if (*rs) {
+		*ic = op - begin;
+		return n_called + (op - begin + 1);
+	}
+	*ic = op - begin - 1;
+	return n_called + (op - begin);
+}
+
+#ifdef SVM_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
+
+void
+Code_fprint(
+	const struct Code *c,
+	FILE *f)
+{
+	int i;
+
+	fprintf(f, "<---\nCode begin\n"
+	           "n_ops = %i\n"
+	           "ops size = %lu bytes\n"
+	           "n_vars = %i\n"
+	           "n_tmps = %i\n"
+	           "n_consts = %i\n",
+	        c->n_ops,
+	        (unsigned long) (sizeof(struct Op) * (c->n_ops + 1)),
+	        c->n_vars,
+	        c->n_tmps,
+	        c->n_consts);
+
+	for (i = 0; i < c->n_consts; i++) {
+		fprintf(f, "r%i = ", c->n_vars + c->n_tmps + i);
+		Value_fprint(&c->consts[i], f);
+		fprintf(f, "\n");
+	}
+
+	for (i = 0; i <= c->n_ops; i++) {
+		fprintf(f, "%4i: ", c->rows[i]);
+		Opcode_fprint(c->ops[i].code, f);
+		switch (c->ops[i].code) {
+		case OP_halt:
+			break;
+		case OP_mov:
+			fprintf(f, " r%i, r%i", c->ops[i].a, c->ops[i].b);
+			break;
+		case OP_movi:
+			fprintf(f, " r%i, %i", c->ops[i].a, c->ops[i].imm);
+			break;
+		case OP_call:
+			fprintf(f, " r%i, code%i", c->ops[i].a, c->ops[i].b);
+			break;
+		case OP_ret:
+			fprintf(f, " r%i", c->ops[i].a);
+			break;
+		case OP_addi:
+		case OP_subi:
+		case OP_muli:
+		case OP_inci:
+			fprintf(f, " r%i, r%i, %i",
+			        c->ops[i].a, c->ops[i].b, c->ops[i].imm);
+			break;
+		default:
+			fprintf(f, " r%i, r%i, r%i",
+			        c->ops[i].a, c->ops[i].b, c->ops[i].c);
+			break;
+		}
+		fprintf(f, "\n");
+	}
+
+	fprintf(f, "Code end\n--->\n");
+}
+
+void
+RuntimeStatus_print(
+	const enum RuntimeStatus rs,
+	const char *filename,
+	const int row)
+{
+	switch (rs) {
+	case RS_ok:
+		break;
+
+	case RS_division_by_zero:
+		printf("%s:%i: Division by zero\n", filename, row);
+		break;
+
+	case RS_stack_overflow:
+		printf("%s:%i: Calls nest too deep\n", filename, row);
+		break;
+	}
+}
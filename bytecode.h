@@ -0,0 +1,266 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#ifndef _BYTECODE_H
+#define _BYTECODE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "arena.h"
+#include "tokenize.h"
+
+#define CODE_MAX_REGISTERS 65535
+#define CODE_MAX_CALLS     256     /* calls in progress at once */
+#define CODE_STACK_MAX     1048576 /* values of a frame stack, see Module_link */
+
+struct Scope;
+struct JitCode;
+
+enum RuntimeStatus {
+	RS_ok,
+	RS_division_by_zero,
+	RS_stack_overflow
+};
+
+void
+RuntimeStatus_print(
+	const enum RuntimeStatus rs,
+	const char *filename,
+	const int row);
+
+enum Opcode {
+	OP_halt,
+	OP_mov,
+	OP_add,
+	OP_sub,
+	OP_mul,
+	OP_div,
+	OP_modulus,
+	/* math on sources of known types, i for int and f for float,
+	 * in the order of Opcode_specialize */
+	OP_add_ii,
+	OP_add_if,
+	OP_add_fi,
+	OP_add_ff,
+	OP_sub_ii,
+	OP_sub_if,
+	OP_sub_fi,
+	OP_sub_ff,
+	OP_mul_ii,
+	OP_mul_if,
+	OP_mul_fi,
+	OP_mul_ff,
+	OP_div_ii,
+	OP_div_if,
+	OP_div_fi,
+	OP_div_ff,
+	OP_modulus_ii,
+	OP_modulus_if,
+	OP_modulus_fi,
+	OP_modulus_ff,
+	/* int ops with the constant source also in imm, see Code_fuse */
+	OP_movi,
+	OP_addi,
+	OP_subi,
+	OP_muli,
+	OP_inci,     /* addi with a == b */
+	/* mul_ii, followed by an add_ii, which is run by the same dispatch */
+	OP_muladd_ii,
+	/* runs code b of the module on the frame behind this one,
+	 * which starts with the arguments, and writes its result to a */
+	OP_call,
+	/* returns a to the caller, every function ends with one */
+	OP_ret
+};
+
+#define N_OPCODES (OP_ret + 1) /* keep in sync with the last opcode */
+
+/* One operation, always 8 bytes.
+ * a is the destination register, b and c are the source registers.
+ * imm is a copy of a small constant, that a source register holds,
+ * so that ops can tell it without loading the register.
+ */
+struct Op {
+	uint8_t  code;
+	int8_t   imm;
+	uint16_t a;
+	uint16_t b;
+	uint16_t c;
+};
+
+/* Registers are laid out in a frame as follows:
+ * [0, n_vars)                  variables, the first n_params are set
+ *                              by the caller
+ * [n_vars, n_vars + n_tmps)    tmp values
+ * [n_vars + n_tmps, n_regs)    constants, copied in from consts
+ * [n_regs, n_regs + n_args)    arguments, which are the first
+ *                              variables of the frame of a call
+ * Frames of calls follow each other on one stack, that is allocated
+ * with the frame of the code that is run.
+ */
+struct Code {
+	struct Op    *ops;
+	int          *rows;     /* source row per op */
+	int           n_ops;    /* without the final halt */
+	struct Value *consts;
+	int           n_consts;
+	int           n_params;
+	int           n_vars;
+	int           n_tmps;
+	int           n_regs;
+	int           n_args;
+	int           stack_size; /* values of the frame and all calls */
+	struct Code **codes;      /* that call ops index, see Module_link */
+	int           n_codes;
+	int             hot_runs;   /* before it is compiled, -1 never */
+	int             n_runs;     /* counted by Code_run_tiered */
+	struct JitCode *jit;        /* native version, if hot */
+	int             jit_failed; /* don't try to compile again */
+};
+
+void
+Opcode_fprint(
+	enum Opcode oc,
+	FILE *f);
+
+/* Returns the math op, that oc is a specialized form of, otherwise oc.
+ */
+enum Opcode
+Opcode_generic(
+	enum Opcode oc);
+
+/* oc:    generic math op
+ * left:  type of the left source
+ * right: type of the right source
+ * Returns the form of oc, that only works on sources of these types.
+ */
+enum Opcode
+Opcode_specialize(
+	enum Opcode    oc,
+	enum ValueType left,
+	enum ValueType right);
+
+/* Lowers the instructions of a translated scope into code,
+ * which is allocated from arena.
+ * Math ops are specialized on the types of their sources,
+ * where these are known, see Code_specialize.
+ * Returns non zero on odd error cases, like mallocs being impossible.
+ */
+int
+Code_from_scope(
+	struct Code  *c,
+	struct Scope *s,
+	struct Arena *arena);
+
+/* Same as Code_from_scope, but only lowers the instructions from first on.
+ * Registers are laid out for the whole scope as it is now.
+ */
+int
+Code_from_instructions(
+	struct Code  *c,
+	struct Scope *s,
+	int           first,
+	struct Arena *arena);
+
+/* Rewrites int ops on small constants into forms that read the constant
+ * from imm, and fuses a mul_ii directly followed by an add_ii into
+ * one dispatch.
+ * Sources stay in place, so each op still works as its generic form,
+ * and code has no jumps, that could enter a fused pair in the middle.
+ * Call after Code_specialize.
+ * Returns amount of rewritten ops.
+ */
+int
+Code_fuse(
+	struct Code *c);
+
+/* Infers the type of each register before each op, starting from a new
+ * frame, and rewrites math into the forms specialized on these types.
+ * Parameters and results of calls have unknown types,
+ * ops whose source types are unknown are left generic.
+ * Returns non zero if malloc failed.
+ */
+int
+Code_specialize(
+	struct Code *c);
+
+/* Checks code that was not lowered by this process,
+ * so that running it can not touch memory outside of its frame.
+ * Returns non zero if an op is unknown or uses a register outside
+ * of the frame, or the code does not end with halt.
+ */
+int
+Code_validate(
+	const struct Code *c);
+
+/* Returns a new frame stack of stack_size values,
+ * all int zeros but the constants in place,
+ * or NULL if malloc failed.
+ */
+struct Value
+*Code_new_frame(
+	const struct Code *c);
+
+/* c:    code
+ * regs: frame, see Code_new_frame
+ *       Specialized ops trust their sources to hold the types inferred
+ *       from a new frame, so frames whose variables are not all ints
+ *       anymore are run with generic ops instead.
+ * ic:   instruction cursor, after return the index of the last op
+ *       that was executed, errors in calls are at the outermost call op
+ * rs:   pointer to status, if function runs as expected writes ok value here
+ * Returns amount of executed ops, those of calls included.
+ */
+long
+Code_run(
+	const struct Code  *c,
+	struct Value       *regs,
+	int                *ic,
+	enum RuntimeStatus *rs);
+
+/* Returns non zero if a call into c fits on the frame stack,
+ * with a frame that begins at regs, then puts its constants in place.
+ * end:   end of the frame stack
+ * depth: calls already in progress
+ */
+int
+Code_enter(
+	const struct Code  *c,
+	struct Value       *regs,
+	const struct Value *end,
+	int                 depth);
+
+/* Runs the function, that the call op at op of c calls, on its own frame
+ * behind regs, and writes its result into regs.
+ * Code_run handles calls on its own, this is for the slower runners.
+ * end:   end of the frame stack
+ * depth: calls already in progress
+ * rs:    pointer to status, if function runs as expected writes ok value here
+ * Returns amount of executed ops.
+ */
+long
+Code_call(
+	const struct Code  *c,
+	const struct Op    *op,
+	struct Value       *regs,
+	const struct Value *end,
+	int                 depth,
+	enum RuntimeStatus *rs);
+
+/* Applies one op to values, exactly as Code_run would.
+ * Used to fold constants at translation time.
+ */
+enum RuntimeStatus
+Value_apply(
+	struct Value       *dest,
+	enum Opcode         oc,
+	const struct Value *left,
+	const struct Value *right);
+
+void
+Code_fprint(
+	const struct Code *c,
+	FILE *f);
+
+#endif /* _BYTECODE_H */
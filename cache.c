@@ -0,0 +1,405 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CACHE_ENDIAN 0x01020304
+#define CACHE_ALIGN_UP(n) \
+	(((n) + CACHE_ALIGN - 1) & ~((uint64_t) CACHE_ALIGN - 1))
+
+/* Returns non zero if [off, off + len) is not within the cache.
+ */
+static int
+Cache_out_of_bounds(
+	const struct CacheHeader *h,
+	uint64_t off,
+	uint64_t len)
+{
+	return off % CACHE_ALIGN != 0 || off > h->size || len > h->size - off;
+}
+
+/* Writes len bytes and pads them up to the next alignment.
+ * Returns non zero if writing failed.
+ */
+static int
+Cache_write(
+	FILE       *f,
+	const void *buf,
+	uint64_t    len)
+{
+	static const char zeros[CACHE_ALIGN] = {0};
+	uint64_t pad = CACHE_ALIGN_UP(len) - len;
+
+	if (len > 0 && fwrite(buf, 1, len, f) != len) {
+		return 1;
+	}
+	if (pad > 0 && fwrite(zeros, 1, pad, f) != pad) {
+		return 1;
+	}
+
+	return 0;
+}
+
+uint64_t
+Source_hash(
+	const struct Source *src)
+{
+	int i;
+	uint64_t hash = 14695981039346656037u;
+
+	for (i = 0; i < src->len; i++) {
+		hash ^= (unsigned char) src->buf[i];
+		hash *= 1099511628211u;
+	}
+
+	return hash;
+}
+
+char
+*Cache_path_of(
+	const char *src_path)
+{
+	size_t len = strlen(src_path);
+	char *ret;
+
+	ret = malloc(len + sizeof(".sonc"));
+	if (ret == NULL) {
+		return NULL;
+	}
+
+	strcpy(ret, src_path);
+	if (len >= 4 && strcmp(&src_path[len - 4], ".son") == 0) {
+		strcat(ret, "c");
+	} else {
+		strcat(ret, ".sonc");
+	}
+
+	return ret;
+}
+
+int
+Module_from_cache(
+	struct Module    *mod,
+	struct Source    *src,
+	FILE             *cf,
+	char             *filename,
+	int               opt_level,
+	enum CacheStatus *cs)
+{
+	uint32_t i;
+	uint32_t v;
+	int sym;
+	const char *base;
+	const struct CacheHeader *h;
+	const struct CacheSym *syms;
+	const struct CacheScope *cscopes;
+	const struct CacheScope *cscope;
+	const struct Op *op;
+	struct Scope *s;
+
+	*mod = Module_new(filename);
+	mod->names = Interner_new(&mod->arena);
+	*cs = CS_ok;
+
+	if (Source_from_file(&mod->cache, cf)) {
+		*cs = CS_read_failed;
+		return 0;
+	}
+
+	base = mod->cache.buf;
+	h = (const struct CacheHeader *) base;
+	if ((uint64_t) mod->cache.len < sizeof(struct CacheHeader) ||
+	    memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) != 0 ||
+	    h->version != CACHE_VERSION ||
+	    h->endian != CACHE_ENDIAN ||
+	    h->value_size != sizeof(struct Value) ||
+	    h->op_size != sizeof(struct Op) ||
+	    h->size != (uint64_t) mod->cache.len) {
+		*cs = CS_invalid;
+		return 0;
+	}
+
+	if (h->opt_level != (uint32_t) opt_level ||
+	    h->src_len != (uint64_t) src->len ||
+	    h->src_hash != Source_hash(src)) {
+		*cs = CS_stale;
+		return 0;
+	}
+
+	if (h->n_scopes == 0 ||
+	    Cache_out_of_bounds(h, h->syms_off,
+	                        (uint64_t) h->n_syms *
+	                        sizeof(struct CacheSym)) ||
+	    Cache_out_of_bounds(h, h->names_off, h->names_len) ||
+	    Cache_out_of_bounds(h, h->scopes_off,
+	                        (uint64_t) h->n_scopes *
+	                        sizeof(struct CacheScope))) {
+		*cs = CS_invalid;
+		return 0;
+	}
+	syms = (const struct CacheSym *) &base[h->syms_off];
+	cscopes = (const struct CacheScope *) &base[h->scopes_off];
+
+	/* interning in order hands out the same symbols again */
+	for (i = 0; i < h->n_syms; i++) {
+		if ((uint64_t) syms[i].off + syms[i].len > h->names_len) {
+			*cs = CS_invalid;
+			return 0;
+		}
+		sym = Interner_intern(&mod->names,
+		                      &base[h->names_off + syms[i].off],
+		                      syms[i].len);
+		if (sym == -1) {
+			return 1;
+		}
+		if ((uint32_t) sym != i) {
+			*cs = CS_invalid;
+			return 0;
+		}
+	}
+
+	for (i = 0; i < h->n_scopes; i++) {
+		cscope = &cscopes[i];
+
+		if ((i == 0) != (cscope->parent == -1) ||
+		    (cscope->parent != -1 && (uint32_t) cscope->parent >= i) ||
+		    cscope->n_ops >= INT32_MAX ||
+		    (uint64_t) cscope->n_vars + cscope->n_tmps +
+		    cscope->n_consts + cscope->n_args > CODE_MAX_REGISTERS ||
+		    Cache_out_of_bounds(h, cscope->ops_off,
+		                        ((uint64_t) cscope->n_ops + 1) *
+		                        sizeof(struct Op)) ||
+		    Cache_out_of_bounds(h, cscope->rows_off,
+		                        ((uint64_t) cscope->n_ops + 1) *
+		                        sizeof(int)) ||
+		    Cache_out_of_bounds(h, cscope->consts_off,
+		                        (uint64_t) cscope->n_consts *
+		                        sizeof(struct Value)) ||
+		    Cache_out_of_bounds(h, cscope->vars_off,
+		                        (uint64_t) cscope->n_vars * sizeof(int))) {
+			*cs = CS_invalid;
+			return 0;
+		}
+
+		s = Module_add_scope(mod,
+		                     i == 0 ? filename : NULL,
+		                     i == 0 ? NULL : mod->s[cscope->parent]);
+		if (s == NULL) {
+			return 1;
+		}
+
+		for (v = 0; v < cscope->n_vars; v++) {
+			sym = ((const int *) &base[cscope->vars_off])[v];
+			if (sym < 0 || (uint32_t) sym >= h->n_syms ||
+			    Scope_find_var(s, sym) != -1) {
+				*cs = CS_invalid;
+				return 0;
+			}
+			if (Scope_add_var(s, sym) == -1) {
+				return 1;
+			}
+		}
+
+		s->code.ops = (struct Op *) &base[cscope->ops_off];
+		s->code.rows = (int *) &base[cscope->rows_off];
+		s->code.n_ops = cscope->n_ops;
+		s->code.consts = (struct Value *) &base[cscope->consts_off];
+		s->code.n_consts = cscope->n_consts;
+		s->code.n_vars = cscope->n_vars;
+		s->code.n_tmps = cscope->n_tmps;
+		s->code.n_regs = cscope->n_vars + cscope->n_tmps +
+		                 cscope->n_consts;
+		s->code.n_params = cscope->n_params;
+		s->code.n_args = cscope->n_args;
+		s->code.n_codes = h->n_scopes;
+		s->n_params = cscope->n_params;
+		s->n_args = cscope->n_args;
+		if (Code_validate(&s->code)) {
+			*cs = CS_invalid;
+			return 0;
+		}
+	}
+
+	/* calls pass their arguments as the first vars of the callee,
+	 * the global scope is never called, so it can not return,
+	 * and functions always end with one, see translate_scope_end */
+	for (i = 0; i < h->n_scopes; i++) {
+		s = mod->s[i];
+		if (i > 0 && (s->code.n_ops == 0 ||
+		              s->code.ops[s->code.n_ops - 1].code != OP_ret)) {
+			*cs = CS_invalid;
+			return 0;
+		}
+		for (v = 0; v < (uint32_t) mod->s[i]->code.n_ops; v++) {
+			op = &mod->s[i]->code.ops[v];
+			if (op->code == OP_ret && i == 0) {
+				*cs = CS_invalid;
+				return 0;
+			}
+			if (op->code == OP_call &&
+			    mod->s[op->b]->code.n_params >
+			    mod->s[i]->code.n_args) {
+				*cs = CS_invalid;
+				return 0;
+			}
+		}
+	}
+	if (Module_link(mod)) {
+		return 1;
+	}
+
+	mod->src = *src;
+	mod->cur = mod->s[0];
+	return 0;
+}
+
+int
+Module_to_cache(
+	const struct Module *mod,
+	FILE                *f,
+	int                  opt_level)
+{
+	int i;
+	int p;
+	uint64_t off;
+	struct CacheHeader h;
+	struct CacheSym sym;
+	struct CacheScope *cscopes;
+	const struct Code *c;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+	h.version = CACHE_VERSION;
+	h.endian = CACHE_ENDIAN;
+	h.value_size = sizeof(struct Value);
+	h.op_size = sizeof(struct Op);
+	h.opt_level = opt_level;
+	h.n_scopes = mod->slen;
+	h.n_syms = mod->names.syms_len;
+	h.src_hash = Source_hash(&mod->src);
+	h.src_len = mod->src.len;
+
+	cscopes = calloc(mod->slen > 0 ? mod->slen : 1,
+	                 sizeof(struct CacheScope));
+	if (cscopes == NULL) {
+		return 1;
+	}
+
+	/* offsets are laid out first, then everything is written in order */
+	off = CACHE_ALIGN_UP(sizeof(struct CacheHeader));
+	h.syms_off = off;
+	off += CACHE_ALIGN_UP(sizeof(struct CacheSym) * h.n_syms);
+	h.names_off = off;
+	h.names_len = mod->names.bytes_len;
+	off += CACHE_ALIGN_UP(h.names_len);
+	h.scopes_off = off;
+	off += CACHE_ALIGN_UP(sizeof(struct CacheScope) * h.n_scopes);
+
+	for (i = 0; i < mod->slen; i++) {
+		c = &mod->s[i]->code;
+
+		cscopes[i].parent = -1;
+		for (p = 0; p < i; p++) {
+			if (mod->s[p] == mod->s[i]->parent) {
+				cscopes[i].parent = p;
+			}
+		}
+		cscopes[i].n_vars = c->n_vars;
+		cscopes[i].n_tmps = c->n_tmps;
+		cscopes[i].n_consts = c->n_consts;
+		cscopes[i].n_ops = c->n_ops;
+		cscopes[i].n_params = c->n_params;
+		cscopes[i].n_args = c->n_args;
+
+		cscopes[i].ops_off = off;
+		off += CACHE_ALIGN_UP(sizeof(struct Op) * (c->n_ops + 1));
+		cscopes[i].rows_off = off;
+		off += CACHE_ALIGN_UP(sizeof(int) * (c->n_ops + 1));
+		cscopes[i].consts_off = off;
+		off += CACHE_ALIGN_UP(sizeof(struct Value) * c->n_consts);
+		cscopes[i].vars_off = off;
+		off += CACHE_ALIGN_UP(sizeof(int) * c->n_vars);
+	}
+	h.size = off;
+
+	if (Cache_write(f, &h, sizeof(h))) {
+		goto write_failed;
+	}
+
+	for (i = 0; i < mod->names.syms_len; i++) {
+		sym.off = mod->names.syms[i].off;
+		sym.len = mod->names.syms[i].len;
+		if (fwrite(&sym, sizeof(sym), 1, f) != 1) {
+			goto write_failed;
+		}
+	}
+	/* a CacheSym is aligned already, so no padding after syms */
+	if (Cache_write(f, mod->names.bytes, h.names_len) ||
+	    Cache_write(f, cscopes, sizeof(struct CacheScope) * h.n_scopes)) {
+		goto write_failed;
+	}
+
+	for (i = 0; i < mod->slen; i++) {
+		c = &mod->s[i]->code;
+
+		if (Cache_write(f, c->ops, sizeof(struct Op) * (c->n_ops + 1)) ||
+		    Cache_write(f, c->rows, sizeof(int) * (c->n_ops + 1)) ||
+		    Cache_write(f, c->consts,
+		                sizeof(struct Value) * c->n_consts) ||
+		    Cache_write(f, mod->s[i]->var_names,
+		                sizeof(int) * c->n_vars)) {
+			goto write_failed;
+		}
+	}
+
+	free(cscopes);
+	return fflush(f) != 0;
+
+write_failed:
+	free(cscopes);
+	return 1;
+}
+
+int
+Module_save_cache(
+	const struct Module *mod,
+	const char          *path,
+	int                  opt_level)
+{
+	int ret;
+	char *tmp_path;
+	FILE *f;
+
+	tmp_path = malloc(strlen(path) + 64);
+	if (tmp_path == NULL) {
+		return 1;
+	}
+	/* threads may save the same file twice, so the module tells apart */
+	sprintf(tmp_path, "%s.%ld.%p", path, (long) getpid(), (void *) mod);
+
+	f = fopen(tmp_path, "wb");
+	if (f == NULL) {
+		free(tmp_path);
+		return 1;
+	}
+
+	ret = Module_to_cache(mod, f, opt_level);
+	if (fclose(f) != 0) {
+		ret = 1;
+	}
+	if (ret == 0 && rename(tmp_path, path) != 0) {
+		ret = 1;
+	}
+	if (ret) {
+		remove(tmp_path);
+	}
+
+	free(tmp_path);
+	return ret;
+}
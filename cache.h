@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "SVM.h"
+
+#define CACHE_MAGIC   "SONC"
+#define CACHE_VERSION 5
+#define CACHE_ALIGN   8
+
+/* A .sonc file holds a lowered module without any pointers,
+ * so it can be used straight from a read-only mapping.
+ * All offsets are from the begin of the file and aligned to CACHE_ALIGN.
+ * Numbers are in host byte order, which endian tells apart.
+ */
+struct CacheHeader {
+	char     magic[4];
+	uint32_t version;
+	uint32_t endian;     /* 0x01020304 */
+	uint32_t value_size; /* sizeof(struct Value) */
+	uint32_t op_size;    /* sizeof(struct Op) */
+	uint32_t opt_level;
+	uint32_t n_scopes;
+	uint32_t n_syms;
+	uint64_t src_hash;   /* see Source_hash */
+	uint64_t src_len;
+	uint64_t size;       /* of the whole file */
+	uint64_t syms_off;   /* struct CacheSym[n_syms] */
+	uint64_t names_off;  /* name bytes, not null terminated */
+	uint64_t names_len;
+	uint64_t scopes_off; /* struct CacheScope[n_scopes] */
+};
+
+/* A name, in the order of symbols.
+ */
+struct CacheSym {
+	uint32_t off; /* in names */
+	uint32_t len;
+};
+
+struct CacheScope {
+	int32_t  parent;     /* index, -1 for the global scope */
+	uint32_t n_vars;
+	uint32_t n_tmps;
+	uint32_t n_consts;
+	uint32_t n_ops;
+	uint32_t n_params;   /* the first vars */
+	uint32_t n_args;     /* of calls, behind the consts */
+	uint32_t unused;
+	uint64_t ops_off;    /* struct Op[n_ops + 1], ends with halt */
+	uint64_t rows_off;   /* int[n_ops + 1] */
+	uint64_t consts_off; /* struct Value[n_consts] */
+	uint64_t vars_off;   /* int[n_vars], symbols of the var names */
+};
+
+enum CacheStatus {
+	CS_ok,
+	CS_read_failed,
+	CS_invalid, /* not a cache file of this build */
+	CS_stale    /* written for a different source or opt level */
+};
+
+/* Returns a 64 bit FNV-1a hash of the source text.
+ */
+uint64_t
+Source_hash(
+	const struct Source *src);
+
+/* Returns the path of the cache file of a source file,
+ * "x.son" becomes "x.sonc", everything else gets ".sonc" appended.
+ * Returns NULL if malloc failed.
+ */
+char
+*Cache_path_of(
+	const char *src_path);
+
+/* If the cache file cf fits src, loads the lowered module from cf,
+ * which stays mapped until Module_free.
+ * Only then the module takes ownership of src.
+ * Scopes loaded this way have no instructions, they can only be run.
+ * If cs is not ok, mod must be freed and src translated as usual.
+ * Returns non zero if malloc failed.
+ */
+int
+Module_from_cache(
+	struct Module    *mod,
+	struct Source    *src,
+	FILE             *cf,
+	char             *filename,
+	int               opt_level,
+	enum CacheStatus *cs);
+
+/* Writes a lowered module to f.
+ * Returns non zero if writing failed.
+ */
+int
+Module_to_cache(
+	const struct Module *mod,
+	FILE                *f,
+	int                  opt_level);
+
+/* Writes the cache to a temporary file next to path
+ * and renames it into place, so readers never see half a file.
+ * Returns non zero if writing failed.
+ */
+int
+Module_save_cache(
+	const struct Module *mod,
+	const char          *path,
+	int                  opt_level);
+
+#endif /* _CACHE_H */
@@ -0,0 +1,855 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#include "emit_c.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Which typed locals of a value are used, as bit flags.
+ * A read local also has its READS flag, others only get written.
+ */
+#define USES_INT   1
+#define USES_FLOAT 2
+#define READS_INT   4
+#define READS_FLOAT 8
+
+/* One C function per function scope and types of its parameters,
+ * as each call knows the types of its arguments.
+ */
+struct CFunc {
+	int             scope;
+	unsigned char  *params;  /* types */
+	enum ValueType  ret;
+	int             done;    /* else its instructions are still walked */
+	int             returns; /* else it always fails, by calling itself */
+};
+
+/* Everything emitted for one module.
+ */
+struct CUnit {
+	const struct Module *mod;
+	struct CFunc        *funcs;
+	int                  n_funcs;
+	int                  funcs_size;
+	int                  errors; /* some instruction may fail */
+};
+
+/* Vars, tmp values and arguments share one index space,
+ * literals and functions are -1.
+ */
+static int
+Scope_c_reg_of(
+	const struct Scope   *s,
+	const struct Operand *o)
+{
+	switch (o->type) {
+	case OT_var:
+		return o->idx;
+	case OT_tmp:
+		return s->n_vars + o->idx;
+	case OT_arg:
+		return s->n_vars + s->n_tmp_vals + o->idx;
+	case OT_literal:
+	case OT_func:
+		return -1;
+	}
+
+	return -1;
+}
+
+static int
+Scope_c_n_regs(
+	const struct Scope *s)
+{
+	return s->n_vars + s->n_tmp_vals + s->n_args;
+}
+
+static enum ValueType
+Operand_c_type(
+	const struct Scope   *s,
+	const unsigned char  *types,
+	const struct Operand *o)
+{
+	if (o->type == OT_literal) {
+		return s->literals[o->idx].type;
+	}
+	return types[Scope_c_reg_of(s, o)];
+}
+
+static void
+Reg_c_fprint(
+	const struct Scope *s,
+	int                 reg,
+	enum ValueType      vt,
+	FILE               *f)
+{
+	if (reg < s->n_vars) {
+		fprintf(f, "v%i", reg);
+	} else if (reg < s->n_vars + s->n_tmp_vals) {
+		fprintf(f, "t%i", reg - s->n_vars);
+	} else {
+		fprintf(f, "a%i", reg - s->n_vars - s->n_tmp_vals);
+	}
+	fprintf(f, vt == VT_int ? "_i" : "_f");
+}
+
+/* Prints an operand as a C expression of type as.
+ */
+static void
+Operand_c_fprint(
+	const struct Scope   *s,
+	const unsigned char  *types,
+	const struct Operand *o,
+	enum ValueType        as,
+	FILE                 *f)
+{
+	const struct Value *v;
+	enum ValueType vt = Operand_c_type(s, types, o);
+
+	if (vt != as) {
+		fprintf(f, "(float) ");
+	}
+
+	if (o->type != OT_literal) {
+		Reg_c_fprint(s, Scope_c_reg_of(s, o), vt, f);
+		return;
+	}
+
+	v = &s->literals[o->idx];
+	switch (v->type) {
+	case VT_int:
+		if (v->c.i == INT_MIN) {
+			fprintf(f, "INT_MIN");
+		} else {
+			fprintf(f, v->c.i < 0 ? "(%i)" : "%i", v->c.i);
+		}
+		break;
+	case VT_float:
+		if (isnan(v->c.f)) {
+			fprintf(f, "NAN");
+		} else if (isinf(v->c.f)) {
+			fprintf(f, v->c.f < 0 ? "(-HUGE_VALF)" : "HUGE_VALF");
+		} else {
+			/* hex floats are exact */
+			fprintf(f, "%af", v->c.f);
+		}
+		break;
+	}
+}
+
+/* Prints str as C string literal.
+ */
+static void
+String_c_fprint(
+	const char *str,
+	FILE       *f)
+{
+	fprintf(f, "\"");
+	for (; *str != '\0'; str++) {
+		if (*str == '"' || *str == '\\') {
+			fprintf(f, "\\%c", *str);
+		} else if ((unsigned char) *str < ' ') {
+			fprintf(f, "\\%03o", (unsigned char) *str);
+		} else {
+			fprintf(f, "%c", *str);
+		}
+	}
+	fprintf(f, "\"");
+}
+
+static void
+CFunc_c_fprint_name(
+	const struct CUnit *u,
+	int                 k,
+	FILE               *f)
+{
+	int i;
+	const struct CFunc *cf = &u->funcs[k];
+	const struct Scope *s = u->mod->s[cf->scope];
+
+	fprintf(f, "f%i_%.*s", s->idx,
+	        Interner_name_len(s->names, s->sym),
+	        Interner_name(s->names, s->sym));
+	if (s->n_params > 0) {
+		fprintf(f, "_");
+	}
+	for (i = 0; i < s->n_params; i++) {
+		fprintf(f, cf->params[i] == VT_int ? "i" : "f");
+	}
+}
+
+static int
+Scope_c_uses(
+	struct CUnit       *u,
+	const struct Scope *s,
+	unsigned char      *types,
+	unsigned char      *uses);
+
+/* Walks function s for the given types of its parameters.
+ * Returns index of the new function in u->funcs, or -1 if malloc failed.
+ */
+static int
+CUnit_add_func(
+	struct CUnit        *u,
+	const struct Scope  *s,
+	const unsigned char *params)
+{
+	int i;
+	int k;
+	int n;
+	int n_regs = Scope_c_n_regs(s);
+	struct CFunc *grown;
+	unsigned char *types;
+	unsigned char *uses;
+	const struct Instruction *last;
+
+	if (u->n_funcs >= u->funcs_size) {
+		grown = realloc(u->funcs, sizeof(struct CFunc) *
+		                          (u->funcs_size + 8) * 2);
+		if (grown == NULL) {
+			return -1;
+		}
+		u->funcs = grown;
+		u->funcs_size = (u->funcs_size + 8) * 2;
+	}
+
+	k = u->n_funcs;
+	u->funcs[k].scope = s->idx;
+	u->funcs[k].params = malloc(s->n_params + 1);
+	u->funcs[k].ret = VT_int;
+	u->funcs[k].done = 0;
+	u->funcs[k].returns = 0;
+	if (u->funcs[k].params == NULL) {
+		return -1;
+	}
+	memcpy(u->funcs[k].params, params, s->n_params);
+	u->n_funcs++;
+
+	types = malloc(n_regs + 1);
+	uses = calloc(n_regs + 1, 1);
+	if (types == NULL || uses == NULL) {
+		free(types);
+		free(uses);
+		return -1;
+	}
+	for (i = 0; i < n_regs; i++) {
+		types[i] = i < s->n_params ? params[i] : VT_int;
+	}
+
+	/* u->funcs may have moved while walking */
+	n = Scope_c_uses(u, s, types, uses);
+	if (n > 0 && s->instrs[n - 1].type == IT_return) {
+		last = &s->instrs[n - 1];
+		u->funcs[k].ret = Operand_c_type(s, types, &last->vals[0]);
+		u->funcs[k].returns = 1;
+	}
+	u->funcs[k].done = 1;
+
+	free(types);
+	free(uses);
+	return n == -1 ? -1 : k;
+}
+
+/* Returns index of the function, that a call with the current types
+ * of the arguments calls, or -1 if malloc failed.
+ */
+static int
+CUnit_func_of_call(
+	struct CUnit             *u,
+	const struct Scope       *s,
+	const unsigned char      *types,
+	const struct Instruction *instr)
+{
+	int k;
+	const unsigned char *args = &types[s->n_vars + s->n_tmp_vals];
+	const struct Scope *callee = u->mod->s[instr->vals[1].idx];
+
+	for (k = 0; k < u->n_funcs; k++) {
+		if (u->funcs[k].scope == callee->idx &&
+		    memcmp(u->funcs[k].params, args, callee->n_params) == 0) {
+			return k;
+		}
+	}
+
+	return CUnit_add_func(u, callee, args);
+}
+
+/* Walks the instructions as emitting does, but only records
+ * which typed locals are used, and which functions are called.
+ * Walking stops after a return, or after a call that never returns,
+ * as that calls itself with the same types over and over.
+ * Returns amount of walked instructions, or -1 if malloc failed.
+ */
+static int
+Scope_c_uses(
+	struct CUnit       *u,
+	const struct Scope *s,
+	unsigned char      *types,
+	unsigned char      *uses)
+{
+	int i;
+	int k;
+	int v;
+	int reg;
+	int zero_div;
+	const struct Instruction *instr;
+	const struct CFunc *cf = NULL;
+	enum ValueType vt;
+
+	for (i = 0; i < s->n_instrs; i++) {
+		instr = &s->instrs[i];
+		/* int division by a zero literal only prints the error */
+		zero_div = (instr->type == IT_div ||
+		            instr->type == IT_modulus) &&
+		           instr->vals[2].type == OT_literal &&
+		           s->literals[instr->vals[2].idx].c.i == 0 &&
+		           Operand_c_type(s, types, &instr->vals[1]) ==
+		           VT_int &&
+		           Operand_c_type(s, types, &instr->vals[2]) ==
+		           VT_int;
+
+		for (v = instr->type == IT_return ? 0 : 1;
+		     v < instr->n_vals && !zero_div;
+		     v++) {
+			reg = Scope_c_reg_of(s, &instr->vals[v]);
+			if (reg != -1) {
+				uses[reg] |= types[reg] == VT_int ?
+				             USES_INT | READS_INT :
+				             USES_FLOAT | READS_FLOAT;
+			}
+		}
+
+		if (instr->type == IT_return) {
+			return i + 1;
+		}
+
+		if (instr->type == IT_call) {
+			u->errors = 1;
+			k = CUnit_func_of_call(u, s, types, instr);
+			if (k == -1) {
+				return -1;
+			}
+			cf = &u->funcs[k];
+			for (v = 0; v < u->mod->s[cf->scope]->n_params; v++) {
+				reg = s->n_vars + s->n_tmp_vals + v;
+				uses[reg] |= types[reg] == VT_int ?
+				             USES_INT | READS_INT :
+				             USES_FLOAT | READS_FLOAT;
+			}
+			vt = cf->done && cf->returns ? cf->ret : VT_int;
+		} else if (instr->type == IT_mov) {
+			vt = Operand_c_type(s, types, &instr->vals[1]);
+		} else if (Operand_c_type(s, types, &instr->vals[1]) ==
+		           VT_int &&
+		           Operand_c_type(s, types, &instr->vals[2]) ==
+		           VT_int) {
+			vt = VT_int;
+		} else {
+			vt = VT_float;
+		}
+		if (vt == VT_int &&
+		    (instr->type == IT_div || instr->type == IT_modulus) &&
+		    (instr->vals[2].type != OT_literal || zero_div)) {
+			u->errors = 1;
+		}
+
+		/* destinations are never literals */
+		reg = Scope_c_reg_of(s, &instr->vals[0]);
+		types[reg] = vt;
+		if (!zero_div) {
+			uses[reg] |= vt == VT_int ? USES_INT : USES_FLOAT;
+		}
+
+		if (instr->type == IT_call && !(cf->done && cf->returns)) {
+			return i + 1;
+		}
+	}
+
+	return s->n_instrs;
+}
+
+/* Prints a statement, that fails with status at row.
+ * The global scope reports the failure, functions pass it on.
+ */
+static void
+Error_c_fprint(
+	const struct Scope *s,
+	const char         *status,
+	int                 row,
+	FILE               *f)
+{
+	if (s->parent == NULL) {
+		fprintf(f, "return sonne_error(%s, %i);\n", status, row);
+	} else {
+		fprintf(f, "return %s;\n", status);
+	}
+}
+
+static void
+Call_c_fprint(
+	const struct CUnit       *u,
+	const struct Scope       *s,
+	unsigned char            *types,
+	const struct Instruction *instr,
+	FILE                     *f)
+{
+	int i;
+	int k;
+	int dest = Scope_c_reg_of(s, &instr->vals[0]);
+	const unsigned char *args = &types[s->n_vars + s->n_tmp_vals];
+	const struct Scope *callee = u->mod->s[instr->vals[1].idx];
+	const struct CFunc *cf = NULL;
+	enum ValueType ret;
+
+	/* walking found every function already */
+	for (k = 0; k < u->n_funcs; k++) {
+		cf = &u->funcs[k];
+		if (cf->scope == callee->idx &&
+		    memcmp(cf->params, args, callee->n_params) == 0) {
+			break;
+		}
+	}
+
+	/* dest may be an argument of this call too */
+	ret = cf->returns ? cf->ret : VT_int;
+	fprintf(f, "\tif ((err = ");
+	CFunc_c_fprint_name(u, k, f);
+	fprintf(f, "(&");
+	Reg_c_fprint(s, dest, ret, f);
+	for (i = 0; i < callee->n_params; i++) {
+		fprintf(f, ", ");
+		Reg_c_fprint(s, s->n_vars + s->n_tmp_vals + i, args[i], f);
+	}
+	types[dest] = ret;
+	fprintf(f, ", %s)) != 0) {\n"
+	           "\t\t",
+	        s->parent == NULL ? "0" : "depth + 1");
+	Error_c_fprint(s, "err", instr->row, f);
+	fprintf(f, "\t}\n");
+}
+
+static void
+Instruction_c_fprint(
+	const struct CUnit       *u,
+	const struct Scope       *s,
+	unsigned char            *types,
+	const struct Instruction *instr,
+	FILE                     *f)
+{
+	static const char *const ops[] = {
+		[IT_add] = "+",
+		[IT_sub] = "-",
+		[IT_mul] = "*",
+		[IT_div] = "/",
+		[IT_modulus] = "%",
+	};
+	const struct Operand *left = &instr->vals[1];
+	const struct Operand *right = &instr->vals[2];
+	int dest = Scope_c_reg_of(s, &instr->vals[0]);
+	enum ValueType vt;
+
+	if (instr->type == IT_call) {
+		Call_c_fprint(u, s, types, instr, f);
+		return;
+	}
+
+	if (instr->type == IT_return) {
+		vt = Operand_c_type(s, types, &instr->vals[0]);
+		fprintf(f, "\t*ret = ");
+		Operand_c_fprint(s, types, &instr->vals[0], vt, f);
+		fprintf(f, ";\n"
+		           "\treturn 0;\n");
+		return;
+	}
+
+	if (instr->type == IT_mov) {
+		vt = Operand_c_type(s, types, left);
+		fprintf(f, "\t");
+		Reg_c_fprint(s, dest, vt, f);
+		fprintf(f, " = ");
+		Operand_c_fprint(s, types, left, vt, f);
+		fprintf(f, ";\n");
+		types[dest] = vt;
+		return;
+	}
+
+	vt = Operand_c_type(s, types, left) == VT_int &&
+	     Operand_c_type(s, types, right) == VT_int ?
+	     VT_int : VT_float;
+
+	if (vt == VT_int &&
+	    (instr->type == IT_div || instr->type == IT_modulus)) {
+		if (right->type != OT_literal) {
+			fprintf(f, "\tif (");
+			Operand_c_fprint(s, types, right, vt, f);
+			fprintf(f, " == 0) {\n"
+			           "\t\t");
+			Error_c_fprint(s, "SONNE_DIVISION_BY_ZERO", instr->row, f);
+			fprintf(f, "\t}\n");
+		} else if (s->literals[right->idx].c.i == 0) {
+			fprintf(f, "\t");
+			Error_c_fprint(s, "SONNE_DIVISION_BY_ZERO", instr->row, f);
+			types[dest] = vt;
+			return;
+		}
+	}
+
+	fprintf(f, "\t");
+	Reg_c_fprint(s, dest, vt, f);
+	fprintf(f, " = ");
+
+	switch (instr->type) {
+	case IT_add:
+	case IT_sub:
+	case IT_mul:
+		if (vt == VT_int) {
+			/* wraps around, like Code_run */
+			fprintf(f, "(int) ((unsigned) ");
+			Operand_c_fprint(s, types, left, vt, f);
+			fprintf(f, " %s (unsigned) ", ops[instr->type]);
+			Operand_c_fprint(s, types, right, vt, f);
+			fprintf(f, ")");
+			break;
+		}
+		Operand_c_fprint(s, types, left, vt, f);
+		fprintf(f, " %s ", ops[instr->type]);
+		Operand_c_fprint(s, types, right, vt, f);
+		break;
+
+	case IT_div:
+	case IT_modulus:
+		if (vt == VT_int) {
+			if (right->type != OT_literal ||
+			    s->literals[right->idx].c.i == -1) {
+				Operand_c_fprint(s, types, left, vt, f);
+				fprintf(f, " == INT_MIN && ");
+				Operand_c_fprint(s, types, right, vt, f);
+				fprintf(f, " == -1 ? %s : ",
+				        instr->type == IT_div ? "INT_MIN" : "0");
+			}
+			Operand_c_fprint(s, types, left, vt, f);
+			fprintf(f, " %s ", ops[instr->type]);
+			Operand_c_fprint(s, types, right, vt, f);
+		} else if (instr->type == IT_div) {
+			Operand_c_fprint(s, types, left, vt, f);
+			fprintf(f, " / ");
+			Operand_c_fprint(s, types, right, vt, f);
+		} else {
+			fprintf(f, "fmodf(");
+			Operand_c_fprint(s, types, left, vt, f);
+			fprintf(f, ", ");
+			Operand_c_fprint(s, types, right, vt, f);
+			fprintf(f, ")");
+		}
+		break;
+
+	case IT_mov:
+	case IT_call:
+	case IT_return:
+		break;
+	}
+
+	fprintf(f, ";\n");
+	types[dest] = vt;
+}
+
+/* Prints the signature of function k, without a line break after it.
+ */
+static void
+CFunc_c_fprint_head(
+	const struct CUnit *u,
+	int                 k,
+	FILE               *f)
+{
+	int i;
+	const struct CFunc *cf = &u->funcs[k];
+	const struct Scope *s = u->mod->s[cf->scope];
+
+	fprintf(f, "static int\n");
+	CFunc_c_fprint_name(u, k, f);
+	fprintf(f, "(\n"
+	           "\t%s *ret,\n",
+	        cf->ret == VT_int ? "int" : "float");
+	for (i = 0; i < s->n_params; i++) {
+		fprintf(f, "\t%s ", cf->params[i] == VT_int ? "int" : "float");
+		Reg_c_fprint(s, i, cf->params[i], f);
+		fprintf(f, ",\n");
+	}
+	fprintf(f, "\tint depth)");
+}
+
+/* Prints the locals and statements of scope s, whose parameters have
+ * the given types.
+ * Returns non zero if malloc failed.
+ */
+static int
+Scope_c_fprint_body(
+	struct CUnit        *u,
+	const struct Scope  *s,
+	const unsigned char *params,
+	unsigned char       *types,
+	FILE                *f)
+{
+	int i;
+	int n;
+	int decl;
+	int n_decls = 0;
+	int n_calls = 0;
+	int n_regs = Scope_c_n_regs(s);
+	unsigned char *uses;
+
+	uses = calloc(n_regs + 1, 1);
+	if (uses == NULL) {
+		return 1;
+	}
+
+	/* frames start with int zeros */
+	for (i = 0; i < n_regs; i++) {
+		types[i] = i < s->n_params ? params[i] : VT_int;
+	}
+	n = Scope_c_uses(u, s, types, uses);
+	if (n == -1) {
+		free(uses);
+		return 1;
+	}
+	/* global vars get printed in their final type */
+	for (i = 0; i < s->n_vars && s->parent == NULL; i++) {
+		uses[i] |= types[i] == VT_int ?
+		           USES_INT | READS_INT : USES_FLOAT | READS_FLOAT;
+	}
+	for (i = 0; i < n; i++) {
+		if (s->instrs[i].type == IT_call) {
+			n_calls++;
+		}
+	}
+
+	for (i = 0; i < n_regs; i++) {
+		decl = uses[i];
+		if (i < s->n_params) {
+			decl &= params[i] == VT_int ? USES_FLOAT : USES_INT;
+		}
+		if (decl & USES_INT) {
+			fprintf(f, "\tint ");
+			Reg_c_fprint(s, i, VT_int, f);
+			fprintf(f, " = 0;\n");
+			n_decls++;
+		}
+		if (decl & USES_FLOAT) {
+			fprintf(f, "\tfloat ");
+			Reg_c_fprint(s, i, VT_float, f);
+			fprintf(f, " = 0;\n");
+			n_decls++;
+		}
+	}
+	if (n_calls > 0) {
+		fprintf(f, "\tint err;\n");
+		n_decls++;
+	}
+	if (n_decls > 0) {
+		fprintf(f, "\n");
+	}
+
+	/* silence locals, that only get written */
+	for (i = 0; i < n_regs; i++) {
+		decl = uses[i];
+		if (i < s->n_params) {
+			decl &= params[i] == VT_int ? USES_FLOAT : USES_INT;
+		}
+		if ((decl & USES_INT) && !(decl & READS_INT)) {
+			fprintf(f, "\t(void) ");
+			Reg_c_fprint(s, i, VT_int, f);
+			fprintf(f, ";\n");
+		}
+		if ((decl & USES_FLOAT) && !(decl & READS_FLOAT)) {
+			fprintf(f, "\t(void) ");
+			Reg_c_fprint(s, i, VT_float, f);
+			fprintf(f, ";\n");
+		}
+	}
+	if (s->parent != NULL) {
+		for (i = 0; i < s->n_params; i++) {
+			fprintf(f, "\t(void) ");
+			Reg_c_fprint(s, i, params[i], f);
+			fprintf(f, ";\n");
+		}
+		fprintf(f, "\tif (depth >= SONNE_MAX_CALLS) {\n"
+		           "\t\treturn SONNE_STACK_OVERFLOW;\n"
+		           "\t}\n");
+	}
+
+	for (i = 0; i < n_regs; i++) {
+		types[i] = i < s->n_params ? params[i] : VT_int;
+	}
+	for (i = 0; i < n; i++) {
+		Instruction_c_fprint(u, s, types, &s->instrs[i], f);
+	}
+	/* a function that never returns fails at its last call */
+	if (s->parent != NULL && s->instrs[n - 1].type != IT_return) {
+		fprintf(f, "\t(void) ret;\n"
+		           "\treturn SONNE_STACK_OVERFLOW;\n");
+	}
+
+	free(uses);
+	return 0;
+}
+
+static int
+CUnit_c_fprint(
+	struct CUnit *u,
+	FILE         *f)
+{
+	int i;
+	int k;
+	const struct Scope *s = u->mod->s[0];
+	unsigned char *types;
+	unsigned char *uses;
+	const struct Scope *fs;
+
+	types = malloc(Scope_c_n_regs(s) + 1);
+	uses = calloc(Scope_c_n_regs(s) + 1, 1);
+	if (types == NULL || uses == NULL) {
+		free(types);
+		free(uses);
+		return 1;
+	}
+	for (i = 0; i < Scope_c_n_regs(s); i++) {
+		types[i] = VT_int;
+	}
+	/* finds every function, that is called */
+	if (Scope_c_uses(u, s, types, uses) == -1) {
+		free(types);
+		free(uses);
+		return 1;
+	}
+	free(uses);
+	free(types);
+
+	fprintf(f, "/* Generated by %s %s, do not edit. */\n"
+	           "\n"
+	           "#include <limits.h>\n"
+	           "#include <math.h>\n"
+	           "#include <stdio.h>\n"
+	           "\n",
+	        APP_NAME, APP_VERSION);
+
+	if (u->errors) {
+		fprintf(f, "#define SONNE_DIVISION_BY_ZERO 1\n"
+		           "#define SONNE_STACK_OVERFLOW   2\n"
+		           "#define SONNE_MAX_CALLS        %i\n"
+		           "\n"
+		           "static int\n"
+		           "sonne_error(\n"
+		           "\tint status,\n"
+		           "\tint row)\n"
+		           "{\n"
+		           "\tprintf(\"%%s:%%i: %%s\\n\", ",
+		        CODE_MAX_CALLS);
+		String_c_fprint(u->mod->name, f);
+		fprintf(f, ", row,\n"
+		           "\t       status == SONNE_DIVISION_BY_ZERO ?\n"
+		           "\t       \"Division by zero\" : "
+		           "\"Calls nest too deep\");\n"
+		           "\treturn 1;\n"
+		           "}\n"
+		           "\n");
+	}
+
+	for (k = 0; k < u->n_funcs; k++) {
+		CFunc_c_fprint_head(u, k, f);
+		fprintf(f, ";\n");
+	}
+	if (u->n_funcs > 0) {
+		fprintf(f, "\n");
+	}
+	for (k = 0; k < u->n_funcs; k++) {
+		fs = u->mod->s[u->funcs[k].scope];
+		types = malloc(Scope_c_n_regs(fs) + 1);
+		if (types == NULL) {
+			return 1;
+		}
+		CFunc_c_fprint_head(u, k, f);
+		fprintf(f, "\n"
+		           "{\n");
+		if (Scope_c_fprint_body(u, fs, u->funcs[k].params, types, f)) {
+			free(types);
+			return 1;
+		}
+		fprintf(f, "}\n"
+		           "\n");
+		free(types);
+	}
+
+	types = malloc(Scope_c_n_regs(s) + 1);
+	if (types == NULL) {
+		return 1;
+	}
+	fprintf(f, "int\n"
+	           "sonne_main(void)\n"
+	           "{\n");
+	if (Scope_c_fprint_body(u, s, NULL, types, f)) {
+		free(types);
+		return 1;
+	}
+	fprintf(f, "\n");
+
+	for (i = 0; i < s->n_vars; i++) {
+		fprintf(f, "\tprintf(\"var %.*s = %s(%s)\\n\", ",
+		        Interner_name_len(s->names, s->var_names[i]),
+		        Interner_name(s->names, s->var_names[i]),
+		        types[i] == VT_int ? "int" : "float",
+		        types[i] == VT_int ? "%i" : "%f");
+		if (types[i] == VT_float) {
+			fprintf(f, "(double) ");
+		}
+		Reg_c_fprint(s, i, types[i], f);
+		fprintf(f, ");\n");
+	}
+
+	fprintf(f, "\treturn 0;\n"
+	           "}\n"
+	           "\n"
+	           "#ifndef SONNE_NO_MAIN\n"
+	           "int\n"
+	           "main(void)\n"
+	           "{\n"
+	           "\treturn sonne_main();\n"
+	           "}\n"
+	           "#endif\n");
+
+	free(types);
+	return 0;
+}
+
+int
+Module_emit_c(
+	const struct Module *mod,
+	FILE                *f)
+{
+	int k;
+	int ret;
+	struct CUnit u = {
+		.mod = mod,
+		.funcs = NULL,
+		.n_funcs = 0,
+		.funcs_size = 0,
+		.errors = 0,
+	};
+
+	if (mod->slen == 0) {
+		return 1;
+	}
+	if (mod->s[0]->n_instrs == 0 && mod->s[0]->code.n_ops > 0) {
+		return 1;
+	}
+
+	ret = CUnit_c_fprint(&u, f);
+
+	for (k = 0; k < u.n_funcs; k++) {
+		free(u.funcs[k].params);
+	}
+	free(u.funcs);
+	return ret || ferror(f);
+}
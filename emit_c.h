@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#ifndef _EMIT_C_H
+#define _EMIT_C_H
+
+#include <stdio.h>
+
+#include "SVM.h"
+
+/* Writes a translated module as a standalone C99 translation unit.
+ * Variables and tmp values become typed locals, since the type of every
+ * value is known at every instruction, and each instruction becomes
+ * one C statement with the same results as Code_run.
+ * Each function becomes a static C function per types of arguments it is
+ * called with, which returns non zero on runtime errors.
+ * The unit defines sonne_main(), which runs the global scope, prints the
+ * variables like Scope_fprint and returns non zero on runtime errors.
+ * Unless SONNE_NO_MAIN is defined, it also defines main(),
+ * so it can be compiled into a program or a shared object.
+ * Returns non zero if malloc failed,
+ * or the module has no instructions, like when loaded from a cache.
+ */
+int
+Module_emit_c(
+	const struct Module *mod,
+	FILE                *f);
+
+#endif /* _EMIT_C_H */
@@ -0,0 +1,201 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#include "intern.h"
+
+#include <string.h>
+
+#define INTERNER_MIN_TABLE_SIZE 64
+
+unsigned
+hash_name(
+	const char *name,
+	int         len);
+
+/* Returns non zero if malloc failed.
+ */
+int
+Interner_grow_table(
+	struct Interner *in);
+
+/* FNV-1a */
+unsigned
+hash_name(
+	const char *name,
+	int         len)
+{
+	int i;
+	unsigned h = 2166136261u;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char) name[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+struct Interner
+Interner_new(
+	struct Arena *arena)
+{
+	struct Interner ret = {
+		.arena = arena,
+		.bytes = NULL,
+		.bytes_size = 0,
+		.bytes_len = 0,
+		.syms = NULL,
+		.hashes = NULL,
+		.syms_size = 0,
+		.syms_len = 0,
+		.table = NULL,
+		.table_size = 0
+	};
+	return ret;
+}
+
+int
+Interner_grow_table(
+	struct Interner *in)
+{
+	int i;
+	int slot;
+	int mask;
+	int *table;
+	int size;
+
+	size = in->table_size == 0 ? INTERNER_MIN_TABLE_SIZE :
+	                             in->table_size * 2;
+	table = Arena_alloc(in->arena, sizeof(int) * size);
+	if (table == NULL) {
+		return 1;
+	}
+	memset(table, 0, sizeof(int) * size);
+
+	mask = size - 1;
+	for (i = 0; i < in->syms_len; i++) {
+		slot = in->hashes[i] & mask;
+		while (table[slot] != 0) {
+			slot = (slot + 1) & mask;
+		}
+		table[slot] = i + 1;
+	}
+
+	in->table = table;
+	in->table_size = size;
+	return 0;
+}
+
+int
+Interner_find(
+	const struct Interner *in,
+	const char            *name,
+	int                    len)
+{
+	int slot;
+	int sym;
+	int mask;
+	unsigned h;
+
+	if (in->table_size == 0) {
+		return -1;
+	}
+
+	h = hash_name(name, len);
+	mask = in->table_size - 1;
+
+	for (slot = h & mask; in->table[slot] != 0; slot = (slot + 1) & mask) {
+		sym = in->table[slot] - 1;
+		if (in->hashes[sym] == h &&
+		    in->syms[sym].len == len &&
+		    memcmp(&in->bytes[in->syms[sym].off], name, len) == 0) {
+			return sym;
+		}
+	}
+
+	return -1;
+}
+
+int
+Interner_intern(
+	struct Interner *in,
+	const char      *name,
+	int              len)
+{
+	int slot;
+	int sym;
+	int mask;
+	int size;
+
+	sym = Interner_find(in, name, len);
+	if (sym >= 0) {
+		return sym;
+	}
+
+	/* keep the table at most half full */
+	if ((in->syms_len + 1) * 2 > in->table_size) {
+		if (Interner_grow_table(in)) {
+			return -1;
+		}
+	}
+
+	if (in->syms_len >= in->syms_size) {
+		size = in->syms_size == 0 ? 32 : in->syms_size * 2;
+		in->syms = Arena_grow(in->arena, in->syms,
+		                      sizeof(struct Slice) * in->syms_size,
+		                      sizeof(struct Slice) * size);
+		in->hashes = Arena_grow(in->arena, in->hashes,
+		                        sizeof(unsigned) * in->syms_size,
+		                        sizeof(unsigned) * size);
+		if (in->syms == NULL || in->hashes == NULL) {
+			return -1;
+		}
+		in->syms_size = size;
+	}
+
+	if (in->bytes_len + len > in->bytes_size) {
+		size = in->bytes_size == 0 ? 256 : in->bytes_size;
+		while (in->bytes_len + len > size) {
+			size *= 2;
+		}
+		in->bytes = Arena_grow(in->arena, in->bytes,
+		                       in->bytes_size, size);
+		if (in->bytes == NULL) {
+			return -1;
+		}
+		in->bytes_size = size;
+	}
+
+	sym = in->syms_len;
+	memcpy(&in->bytes[in->bytes_len], name, len);
+	in->syms[sym].off = in->bytes_len;
+	in->syms[sym].len = len;
+	in->hashes[sym] = hash_name(name, len);
+	in->bytes_len += len;
+	in->syms_len++;
+
+	mask = in->table_size - 1;
+	slot = in->hashes[sym] & mask;
+	while (in->table[slot] != 0) {
+		slot = (slot + 1) & mask;
+	}
+	in->table[slot] = sym + 1;
+
+	return sym;
+}
+
+const char
+*Interner_name(
+	const struct Interner *in,
+	int                    sym)
+{
+	return &in->bytes[in->syms[sym].off];
+}
+
+int
+Interner_name_len(
+	const struct Interner *in,
+	int                    sym)
+{
+	return in->syms[sym].len;
+}
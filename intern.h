@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#ifndef _INTERN_H
+#define _INTERN_H
+
+#include "arena.h"
+#include "tokenize.h"
+
+/* Holds one copy of each distinct name.
+ * Names are identified by their index, called symbol,
+ * so equal names always have the same symbol.
+ */
+struct Interner {
+	struct Arena *arena;    /* where everything is allocated from */
+	char         *bytes;    /* all names back to back */
+	int           bytes_size;
+	int           bytes_len;
+	struct Slice *syms;     /* slices into bytes, indexed by symbol */
+	unsigned     *hashes;   /* indexed by symbol */
+	int           syms_size;
+	int           syms_len;
+	int          *table;    /* symbol + 1 per slot, 0 is empty */
+	int           table_size;
+};
+
+struct Interner
+Interner_new(
+	struct Arena *arena);
+
+/* Returns the symbol of name, adding it if necessary,
+ * or -1 if malloc failed.
+ */
+int
+Interner_intern(
+	struct Interner *in,
+	const char      *name,
+	int              len);
+
+/* Returns the symbol of name, or -1 if it was never interned.
+ */
+int
+Interner_find(
+	const struct Interner *in,
+	const char            *name,
+	int                    len);
+
+/* Returns the name of sym, which is not null terminated.
+ */
+const char
+*Interner_name(
+	const struct Interner *in,
+	int                    sym);
+
+int
+Interner_name_len(
+	const struct Interner *in,
+	int                    sym);
+
+#endif /* _INTERN_H */
@@ -0,0 +1,849 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#define _DEFAULT_SOURCE
+
+#include "jit.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef SVM_JIT
+#include <sys/mman.h>
+#endif
+
+/* What native code needs to run its calls.
+ */
+struct JitCall {
+	const struct Code  *c;
+	const struct Value *end;      /* of the frame stack */
+	int                 depth;    /* calls in progress */
+	long                n_called; /* ops run by calls */
+};
+
+/* Counts a run or call of c, and compiles it once it is hot,
+ * unless c is not tiered.
+ */
+static void
+Code_count_run(
+	struct Code *c)
+{
+	if (c->hot_runs < 0) {
+		return;
+	}
+	if (c->jit == NULL && !c->jit_failed && c->n_runs >= c->hot_runs) {
+		c->jit = Jit_compile(c);
+		c->jit_failed = c->jit == NULL;
+	}
+	c->n_runs++;
+}
+
+#ifdef SVM_JIT
+
+/* Machine code is written into a growing buffer first,
+ * and only copied into executable memory once complete.
+ */
+struct Emitter {
+	unsigned char *buf;
+	size_t         size;
+	size_t         len;
+	size_t        *exits; /* rel32 jumps to the epilogue */
+	int            exits_size;
+	int            n_exits;
+	int            in_eax; /* register whose int is still in eax, or -1 */
+	int            failed;
+};
+
+/* x86-64 registers, as encoded in ModRM */
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3 /* holds regs, r12 holds rs and r13 the struct JitCall */
+#define RSI 6
+#define RDI 7
+
+/* Type of a register, that is written before it is read,
+ * like the tmp values and the variables of a function.
+ */
+#define TYPE_UNKNOWN 0xFF
+
+#define VALUE_TYPE(r) ((int32_t) ((r) * sizeof(struct Value)))
+#define VALUE_C(r)    ((int32_t) ((r) * sizeof(struct Value) + \
+                                  offsetof(struct Value, c)))
+
+static void
+Emitter_bytes(
+	struct Emitter *e,
+	const void     *bytes,
+	size_t          n)
+{
+	size_t size;
+
+	if (e->failed) {
+		return;
+	}
+
+	if (e->len + n > e->size) {
+		size = e->size == 0 ? 4096 : e->size * 2;
+		while (e->len + n > size) {
+			size *= 2;
+		}
+		e->buf = realloc(e->buf, size);
+		if (e->buf == NULL) {
+			e->failed = 1;
+			return;
+		}
+		e->size = size;
+	}
+
+	memcpy(&e->buf[e->len], bytes, n);
+	e->len += n;
+}
+
+static void
+Emitter_byte(
+	struct Emitter *e,
+	unsigned char   b)
+{
+	Emitter_bytes(e, &b, 1);
+}
+
+static void
+Emitter_i32(
+	struct Emitter *e,
+	int32_t         v)
+{
+	unsigned char b[4];
+
+	b[0] = v & 0xff;
+	b[1] = (v >> 8) & 0xff;
+	b[2] = (v >> 16) & 0xff;
+	b[3] = ((uint32_t) v >> 24) & 0xff;
+	Emitter_bytes(e, b, 4);
+}
+
+/* Emits ModRM and displacement of [rbx + disp].
+ */
+static void
+Emitter_rbx_disp(
+	struct Emitter *e,
+	int             reg,
+	int32_t         disp)
+{
+	Emitter_byte(e, 0x80 | (reg << 3) | RBX);
+	Emitter_i32(e, disp);
+}
+
+/* Emits a jump with a rel32 to be patched later.
+ * Returns the position of the rel32.
+ */
+static size_t
+Emitter_jump(
+	struct Emitter *e,
+	const unsigned char *opcode,
+	size_t               n)
+{
+	Emitter_bytes(e, opcode, n);
+	Emitter_i32(e, 0);
+	return e->len - 4;
+}
+
+/* Points the rel32 at pos to the current end of code.
+ */
+static void
+Emitter_patch(
+	struct Emitter *e,
+	size_t          pos)
+{
+	int32_t rel = (int32_t) (e->len - (pos + 4));
+
+	if (e->failed) {
+		return;
+	}
+	e->buf[pos] = rel & 0xff;
+	e->buf[pos + 1] = (rel >> 8) & 0xff;
+	e->buf[pos + 2] = (rel >> 16) & 0xff;
+	e->buf[pos + 3] = ((uint32_t) rel >> 24) & 0xff;
+}
+
+static void
+Emitter_exit(
+	struct Emitter *e)
+{
+	static const unsigned char jmp[] = {0xE9};
+	size_t pos;
+
+	pos = Emitter_jump(e, jmp, sizeof(jmp));
+	if (e->n_exits >= e->exits_size) {
+		e->exits_size = e->exits_size == 0 ? 16 : e->exits_size * 2;
+		e->exits = realloc(e->exits, sizeof(size_t) * e->exits_size);
+		if (e->exits == NULL) {
+			e->failed = 1;
+			return;
+		}
+	}
+	e->exits[e->n_exits] = pos;
+	e->n_exits++;
+}
+
+/* Stores eax or edx as int into register r.
+ * The type is only written if r may not hold an int yet.
+ */
+static void
+Emitter_store_int(
+	struct Emitter *e,
+	unsigned char  *types,
+	int             reg,
+	uint16_t        r)
+{
+	if (types[r] != VT_int) {
+		/* mov dword [rbx + type], VT_int */
+		Emitter_byte(e, 0xC7);
+		Emitter_rbx_disp(e, 0, VALUE_TYPE(r));
+		Emitter_i32(e, VT_int);
+		types[r] = VT_int;
+	}
+	/* mov [rbx + c], reg */
+	Emitter_byte(e, 0x89);
+	Emitter_rbx_disp(e, reg, VALUE_C(r));
+}
+
+/* Loads register r into xmm0 or xmm1 as float.
+ */
+static void
+Emitter_load_float(
+	struct Emitter      *e,
+	const unsigned char *types,
+	int                  xmm,
+	uint16_t             r)
+{
+	/* cvtsi2ss or movss xmm, [rbx + c] */
+	Emitter_byte(e, 0xF3);
+	Emitter_byte(e, 0x0F);
+	Emitter_byte(e, types[r] == VT_int ? 0x2A : 0x10);
+	Emitter_rbx_disp(e, xmm, VALUE_C(r));
+}
+
+/* Calls Value_apply for op, leaving on error with index i.
+ */
+static void
+Emitter_call_apply(
+	struct Emitter  *e,
+	const struct Op *op,
+	int              i)
+{
+	static const unsigned char test_eax[] = {0x85, 0xC0};
+	static const unsigned char jz[] = {0x0F, 0x84};
+	static const unsigned char store_rs[] = {0x41, 0x89, 0x04, 0x24};
+	uintptr_t fn = (uintptr_t) &Value_apply;
+	size_t ok;
+	int b;
+
+	/* lea rdi, [rbx + a] */
+	Emitter_byte(e, 0x48);
+	Emitter_byte(e, 0x8D);
+	Emitter_rbx_disp(e, RDI, VALUE_TYPE(op->a));
+	/* mov esi, code */
+	Emitter_byte(e, 0xB8 + RSI);
+	Emitter_i32(e, op->code);
+	/* lea rdx, [rbx + b] */
+	Emitter_byte(e, 0x48);
+	Emitter_byte(e, 0x8D);
+	Emitter_rbx_disp(e, RDX, VALUE_TYPE(op->b));
+	/* lea rcx, [rbx + c] */
+	Emitter_byte(e, 0x48);
+	Emitter_byte(e, 0x8D);
+	Emitter_rbx_disp(e, RCX, VALUE_TYPE(op->c));
+	/* mov rax, Value_apply; call rax */
+	Emitter_byte(e, 0x48);
+	Emitter_byte(e, 0xB8 + RAX);
+	for (b = 0; b < 8; b++) {
+		Emitter_byte(e, (fn >> (b * 8)) & 0xff);
+	}
+	Emitter_byte(e, 0xFF);
+	Emitter_byte(e, 0xD0);
+
+	/* on error: *rs = eax, return i */
+	Emitter_bytes(e, test_eax, sizeof(test_eax));
+	ok = Emitter_jump(e, jz, sizeof(jz));
+	Emitter_bytes(e, store_rs, sizeof(store_rs));
+	Emitter_byte(e, 0xB8 + RAX);
+	Emitter_i32(e, i);
+	Emitter_exit(e);
+	Emitter_patch(e, ok);
+}
+
+/* Runs the call op of c with the native code of the callee,
+ * if it has some and its parameters are ints.
+ * Returns -1 if it did not, otherwise non zero if the call failed.
+ */
+static int
+Jit_call_native(
+	const struct Code  *c,
+	const struct Op    *op,
+	struct Value       *regs,
+	const struct Value *end,
+	int                 depth,
+	long               *n_called,
+	enum RuntimeStatus *rs)
+{
+	int k;
+	int ret;
+	struct Code *callee = c->codes[op->b];
+	struct Value *frame = &regs[c->n_regs];
+	struct JitCall sub = {
+		.c = callee,
+		.end = end,
+		.depth = depth + 1,
+		.n_called = 0,
+	};
+
+	if (callee->jit == NULL) {
+		return -1;
+	}
+	/* the native code expects int parameters */
+	for (k = 0; k < callee->n_params; k++) {
+		if (frame[k].type != VT_int) {
+			return -1;
+		}
+	}
+	if (!Code_enter(callee, frame, end, depth)) {
+		*rs = RS_stack_overflow;
+		return 1;
+	}
+
+	ret = callee->jit->fn(frame, rs, &sub);
+	*n_called += sub.n_called;
+	if (ret >= 0) {
+		*n_called += ret + 1;
+		return 1;
+	}
+
+	/* functions end with ret, but would return zero otherwise */
+	if (ret == -1) {
+		*n_called += callee->n_ops + 1;
+		regs[op->a].type = VT_int;
+		regs[op->a].c.i = 0;
+	} else {
+		ret = -2 - ret;
+		*n_called += ret + 1;
+		regs[op->a] = frame[callee->ops[ret].a];
+	}
+	return 0;
+}
+
+/* Runs the call op i of call->c, for native code.
+ * Returns non zero if the call failed.
+ */
+static int
+Jit_call(
+	struct JitCall     *call,
+	struct Value       *regs,
+	int                 i,
+	enum RuntimeStatus *rs)
+{
+	int failed;
+	const struct Op *op = &call->c->ops[i];
+
+	Code_count_run(call->c->codes[op->b]);
+	failed = Jit_call_native(call->c, op, regs, call->end, call->depth,
+	                         &call->n_called, rs);
+	if (failed < 0) {
+		call->n_called += Code_call(call->c, op, regs, call->end,
+		                            call->depth, rs);
+		failed = *rs != RS_ok;
+	}
+	return failed;
+}
+
+/* Calls followed to find the type of the result of a call.
+ */
+#define RESULT_TYPE_DEPTH 4
+
+/* Returns the type, that code c returns for parameters of the given types,
+ * or TYPE_UNKNOWN.
+ */
+static int
+Code_result_type(
+	const struct Code   *c,
+	const unsigned char *params,
+	int                  depth)
+{
+	int i;
+	int ret = TYPE_UNKNOWN;
+	const struct Op *op;
+	unsigned char *types;
+
+	if (depth >= RESULT_TYPE_DEPTH) {
+		return TYPE_UNKNOWN;
+	}
+	types = malloc(c->n_regs + c->n_args + 1);
+	if (types == NULL) {
+		return TYPE_UNKNOWN;
+	}
+	for (i = 0; i < c->n_regs + c->n_args; i++) {
+		types[i] = i < c->n_params ? params[i] : TYPE_UNKNOWN;
+	}
+	for (i = 0; i < c->n_consts; i++) {
+		types[c->n_vars + c->n_tmps + i] = c->consts[i].type;
+	}
+
+	for (i = 0; i <= c->n_ops; i++) {
+		op = &c->ops[i];
+		switch (Opcode_generic(op->code)) {
+		case OP_halt:
+			/* functions end with ret, but would return zero */
+			ret = VT_int;
+			goto result_end;
+
+		case OP_ret:
+			ret = types[op->a];
+			goto result_end;
+
+		case OP_mov:
+			types[op->a] = types[op->b];
+			break;
+
+		case OP_call:
+			types[op->a] = Code_result_type(c->codes[op->b],
+			                                &types[c->n_regs],
+			                                depth + 1);
+			break;
+
+		default:
+			if (types[op->b] == TYPE_UNKNOWN ||
+			    types[op->c] == TYPE_UNKNOWN) {
+				types[op->a] = TYPE_UNKNOWN;
+			} else if (types[op->b] == VT_int &&
+			           types[op->c] == VT_int) {
+				types[op->a] = VT_int;
+			} else {
+				types[op->a] = VT_float;
+			}
+			break;
+		}
+	}
+
+result_end:
+	free(types);
+	return ret;
+}
+
+/* Calls Jit_call for the call op i, leaving on error with index i.
+ */
+static void
+Emitter_call(
+	struct Emitter *e,
+	int             i)
+{
+	/* mov rdi, r13; mov rsi, rbx */
+	static const unsigned char args[] = {
+		0x4C, 0x89, 0xEF, 0x48, 0x89, 0xDE
+	};
+	static const unsigned char mov_rcx_r12[] = {0x4C, 0x89, 0xE1};
+	static const unsigned char test_eax[] = {0x85, 0xC0};
+	static const unsigned char jz[] = {0x0F, 0x84};
+	uintptr_t fn = (uintptr_t) &Jit_call;
+	size_t ok;
+	int b;
+
+	Emitter_bytes(e, args, sizeof(args));
+	/* mov edx, i */
+	Emitter_byte(e, 0xB8 + RDX);
+	Emitter_i32(e, i);
+	Emitter_bytes(e, mov_rcx_r12, sizeof(mov_rcx_r12));
+	/* mov rax, Jit_call; call rax */
+	Emitter_byte(e, 0x48);
+	Emitter_byte(e, 0xB8 + RAX);
+	for (b = 0; b < 8; b++) {
+		Emitter_byte(e, (fn >> (b * 8)) & 0xff);
+	}
+	Emitter_byte(e, 0xFF);
+	Emitter_byte(e, 0xD0);
+
+	/* on error: return i, rs is set already */
+	Emitter_bytes(e, test_eax, sizeof(test_eax));
+	ok = Emitter_jump(e, jz, sizeof(jz));
+	Emitter_byte(e, 0xB8 + RAX);
+	Emitter_i32(e, i);
+	Emitter_exit(e);
+	Emitter_patch(e, ok);
+}
+
+/* The type of every register is known at every op,
+ * since vars are checked to be ints on entry, see Jit_run,
+ * and result types only depend on source types.
+ * Only results of calls may be unknown, math on them goes through
+ * Value_apply.
+ */
+static void
+Emitter_op(
+	struct Emitter    *e,
+	const struct Code *c,
+	unsigned char     *types,
+	const struct Op   *op,
+	int                i)
+{
+	static const unsigned char jmp[] = {0xE9};
+	static const unsigned char je[] = {0x0F, 0x84};
+	static const unsigned char test_ecx[] = {0x85, 0xC9};
+	static const unsigned char cmp_ecx_m1[] = {0x83, 0xF9, 0xFF};
+	static const unsigned char cdq_idiv_ecx[] = {0x99, 0xF7, 0xF9};
+	static const unsigned char float_op[] = {
+		[OP_add] = 0x58,
+		[OP_sub] = 0x5C,
+		[OP_mul] = 0x59,
+		[OP_div] = 0x5E,
+	};
+	/* the types here already tell what a specialized op would */
+	enum Opcode oc = Opcode_generic(op->code);
+	/* the sources of call ops are no registers */
+	int math = oc >= OP_add && oc <= OP_modulus;
+	int ints = math &&
+	           types[op->b] == VT_int && types[op->c] == VT_int;
+	int in_eax = e->in_eax;
+	uint16_t left = op->b;
+	uint16_t right = op->c;
+	size_t slow[2];
+	size_t done;
+
+	e->in_eax = -1;
+
+	if (math &&
+	    (types[op->b] == TYPE_UNKNOWN || types[op->c] == TYPE_UNKNOWN)) {
+		Emitter_call_apply(e, op, i);
+		types[op->a] = TYPE_UNKNOWN;
+		return;
+	}
+
+	switch (oc) {
+	case OP_halt:
+		/* mov eax, -1 */
+		Emitter_byte(e, 0xB8 + RAX);
+		Emitter_i32(e, -1);
+		Emitter_exit(e);
+		return;
+
+	case OP_mov:
+		/* mov rax, [rbx + b]; mov [rbx + a], rax */
+		Emitter_byte(e, 0x48);
+		Emitter_byte(e, 0x8B);
+		Emitter_rbx_disp(e, RAX, VALUE_TYPE(op->b));
+		Emitter_byte(e, 0x48);
+		Emitter_byte(e, 0x89);
+		Emitter_rbx_disp(e, RAX, VALUE_TYPE(op->a));
+		types[op->a] = types[op->b];
+		return;
+
+	case OP_call:
+		Emitter_call(e, i);
+		types[op->a] = Code_result_type(c->codes[op->b],
+		                                &types[c->n_regs], 0);
+		return;
+
+	case OP_ret:
+		/* mov eax, -2 - i */
+		Emitter_byte(e, 0xB8 + RAX);
+		Emitter_i32(e, -2 - i);
+		Emitter_exit(e);
+		return;
+
+	case OP_add:
+	case OP_sub:
+	case OP_mul:
+		if (!ints) {
+			break;
+		}
+		/* chained math skips reloading what it just stored */
+		if (oc != OP_sub && in_eax == right) {
+			right = op->b;
+			left = op->c;
+		}
+		if (in_eax != left) {
+			/* mov eax, [rbx + b] */
+			Emitter_byte(e, 0x8B);
+			Emitter_rbx_disp(e, RAX, VALUE_C(left));
+		}
+		/* add, sub or imul eax, [rbx + c] */
+		if (oc == OP_add) {
+			Emitter_byte(e, 0x03);
+		} else if (oc == OP_sub) {
+			Emitter_byte(e, 0x2B);
+		} else {
+			Emitter_byte(e, 0x0F);
+			Emitter_byte(e, 0xAF);
+		}
+		Emitter_rbx_disp(e, RAX, VALUE_C(right));
+		Emitter_store_int(e, types, RAX, op->a);
+		e->in_eax = op->a;
+		return;
+
+	case OP_div:
+	case OP_modulus:
+		if (!ints) {
+			break;
+		}
+		/* mov ecx, [rbx + c], zero and -1 are left to Value_apply */
+		Emitter_byte(e, 0x8B);
+		Emitter_rbx_disp(e, RCX, VALUE_C(op->c));
+		Emitter_bytes(e, test_ecx, sizeof(test_ecx));
+		slow[0] = Emitter_jump(e, je, sizeof(je));
+		Emitter_bytes(e, cmp_ecx_m1, sizeof(cmp_ecx_m1));
+		slow[1] = Emitter_jump(e, je, sizeof(je));
+		/* mov eax, [rbx + b]; cdq; idiv ecx */
+		Emitter_byte(e, 0x8B);
+		Emitter_rbx_disp(e, RAX, VALUE_C(op->b));
+		Emitter_bytes(e, cdq_idiv_ecx, sizeof(cdq_idiv_ecx));
+		/* both paths leave an int, so the type is written once */
+		if (types[op->a] != VT_int) {
+			Emitter_byte(e, 0xC7);
+			Emitter_rbx_disp(e, 0, VALUE_TYPE(op->a));
+			Emitter_i32(e, VT_int);
+		}
+		Emitter_byte(e, 0x89);
+		Emitter_rbx_disp(e, oc == OP_div ? RAX : RDX,
+		                 VALUE_C(op->a));
+		done = Emitter_jump(e, jmp, sizeof(jmp));
+		Emitter_patch(e, slow[0]);
+		Emitter_patch(e, slow[1]);
+		Emitter_call_apply(e, op, i);
+		Emitter_patch(e, done);
+		types[op->a] = VT_int;
+		return;
+
+	default:
+		e->failed = 1;
+		return;
+	}
+
+	/* at least one float */
+	if (oc == OP_modulus) {
+		Emitter_call_apply(e, op, i);
+	} else {
+		Emitter_load_float(e, types, 0, op->b);
+		Emitter_load_float(e, types, 1, op->c);
+		/* addss, subss, mulss or divss xmm0, xmm1 */
+		Emitter_byte(e, 0xF3);
+		Emitter_byte(e, 0x0F);
+		Emitter_byte(e, float_op[oc]);
+		Emitter_byte(e, 0xC1);
+		/* movss [rbx + c], xmm0 */
+		Emitter_byte(e, 0xF3);
+		Emitter_byte(e, 0x0F);
+		Emitter_byte(e, 0x11);
+		Emitter_rbx_disp(e, 0, VALUE_C(op->a));
+		/* mov dword [rbx + type], VT_float */
+		Emitter_byte(e, 0xC7);
+		Emitter_rbx_disp(e, 0, VALUE_TYPE(op->a));
+		Emitter_i32(e, VT_float);
+	}
+	types[op->a] = VT_float;
+}
+
+struct JitCode
+*Jit_compile(
+	const struct Code *c)
+{
+	/* push rbx; push r12; push r13;
+	 * mov rbx, rdi; mov r12, rsi; mov r13, rdx */
+	static const unsigned char prologue[] = {
+		0x53, 0x41, 0x54, 0x41, 0x55,
+		0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4, 0x49, 0x89, 0xD5
+	};
+	/* pop r13; pop r12; pop rbx; ret */
+	static const unsigned char epilogue[] = {
+		0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3
+	};
+	int i;
+	struct Emitter e = {
+		.buf = NULL,
+		.size = 0,
+		.len = 0,
+		.exits = NULL,
+		.exits_size = 0,
+		.n_exits = 0,
+		.in_eax = -1,
+		.failed = 0
+	};
+	struct JitCode *ret = NULL;
+	unsigned char *types;
+	void *mem;
+
+	if (sizeof(struct Value) != 8 ||
+	    sizeof(enum ValueType) != 4 ||
+	    offsetof(struct Value, c) != 4) {
+		return NULL;
+	}
+
+	types = malloc(c->n_regs + c->n_args + 1);
+	if (types == NULL) {
+		return NULL;
+	}
+	/* parameters are checked to be ints by Jit_call,
+	 * anything else but constants is written before it is read */
+	for (i = 0; i < c->n_regs + c->n_args; i++) {
+		types[i] = i < c->n_params ? VT_int : TYPE_UNKNOWN;
+	}
+	for (i = 0; i < c->n_consts; i++) {
+		types[c->n_vars + c->n_tmps + i] = c->consts[i].type;
+	}
+
+	Emitter_bytes(&e, prologue, sizeof(prologue));
+	for (i = 0; i <= c->n_ops; i++) {
+		Emitter_op(&e, c, types, &c->ops[i], i);
+	}
+	for (i = 0; i < e.n_exits; i++) {
+		Emitter_patch(&e, e.exits[i]);
+	}
+	Emitter_bytes(&e, epilogue, sizeof(epilogue));
+	if (e.failed) {
+		goto compile_end;
+	}
+
+	ret = malloc(sizeof(struct JitCode));
+	if (ret == NULL) {
+		goto compile_end;
+	}
+
+	/* never writable and executable at once */
+	mem = mmap(NULL, e.len, PROT_READ | PROT_WRITE,
+	           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		free(ret);
+		ret = NULL;
+		goto compile_end;
+	}
+	memcpy(mem, e.buf, e.len);
+	if (mprotect(mem, e.len, PROT_READ | PROT_EXEC) != 0) {
+		munmap(mem, e.len);
+		free(ret);
+		ret = NULL;
+		goto compile_end;
+	}
+
+	ret->mem = mem;
+	ret->size = e.len;
+	/* ISO C has no cast from object to function pointers */
+	memcpy(&ret->fn, &mem, sizeof(ret->fn));
+
+compile_end:
+	free(types);
+	free(e.buf);
+	free(e.exits);
+	return ret;
+}
+
+void
+Jit_free(
+	struct JitCode *j)
+{
+	if (j == NULL) {
+		return;
+	}
+	munmap(j->mem, j->size);
+	free(j);
+}
+
+#else /* SVM_JIT */
+
+struct JitCode
+*Jit_compile(
+	const struct Code *c)
+{
+	(void) c;
+	return NULL;
+}
+
+void
+Jit_free(
+	struct JitCode *j)
+{
+	(void) j;
+}
+
+static int
+Jit_call_native(
+	const struct Code  *c,
+	const struct Op    *op,
+	struct Value       *regs,
+	const struct Value *end,
+	int                 depth,
+	long               *n_called,
+	enum RuntimeStatus *rs)
+{
+	(void) c;
+	(void) op;
+	(void) regs;
+	(void) end;
+	(void) depth;
+	(void) n_called;
+	(void) rs;
+	return -1;
+}
+
+#endif /* SVM_JIT */
+
+long
+Jit_run(
+	const struct JitCode *j,
+	const struct Code    *c,
+	struct Value         *regs,
+	int                  *ic,
+	enum RuntimeStatus   *rs)
+{
+	int i;
+	int failed_at;
+	struct JitCall call = {
+		.c = c,
+		.end = &regs[c->stack_size],
+		.depth = 0,
+		.n_called = 0,
+	};
+
+	/* the native code assumes vars to start as ints, like new frames */
+	for (i = 0; i < c->n_vars; i++) {
+		if (regs[i].type != VT_int) {
+			return Code_run(c, regs, ic, rs);
+		}
+	}
+
+	*rs = RS_ok;
+	failed_at = j->fn(regs, rs, &call);
+	if (failed_at >= 0) {
+		*ic = failed_at;
+		return call.n_called + failed_at + 1;
+	}
+
+	*ic = c->n_ops - 1;
+	return call.n_called + c->n_ops;
+}
+
+long
+Code_run_tiered(
+	struct Code        *c,
+	struct Value       *regs,
+	int                *ic,
+	enum RuntimeStatus *rs)
+{
+	Code_count_run(c);
+
+	if (c->jit != NULL) {
+		return Jit_run(c->jit, c, regs, ic, rs);
+	}
+	return Code_run(c, regs, ic, rs);
+}
+
+int
+Code_call_tiered(
+	const struct Code  *c,
+	const struct Op    *op,
+	struct Value       *regs,
+	const struct Value *end,
+	int                 depth,
+	long               *n_called,
+	enum RuntimeStatus *rs)
+{
+	Code_count_run(c->codes[op->b]);
+	return Jit_call_native(c, op, regs, end, depth, n_called, rs);
+}
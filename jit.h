@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#ifndef _JIT_H
+#define _JIT_H
+
+#include <stddef.h>
+
+#include "bytecode.h"
+
+/* Native code is only emitted for x86-64 with mmap.
+ * Define SVM_NO_JIT to always interpret.
+ */
+#if defined(__x86_64__) && defined(__unix__) && !defined(SVM_NO_JIT)
+#define SVM_JIT
+#endif
+
+/* Runs or calls after which code is compiled to native code.
+ * 0 compiles before the first run, -1 never compiles.
+ * Never by default, as the interpreter still beats the jit on the
+ * bench corpora, see -jit.
+ */
+#define JIT_HOT_RUNS -1
+
+struct JitCall;
+
+/* Native version of one struct Code, see Jit_compile.
+ * fn returns the index of the op that failed, -1 after halt,
+ * or -2 minus the index of the ret op that returned.
+ */
+struct JitCode {
+	unsigned char *mem;
+	size_t         size;
+	int          (*fn)(struct Value *regs, enum RuntimeStatus *rs,
+	                   struct JitCall *call);
+};
+
+/* Compiles code into native code, which gives the same results as Code_run.
+ * Int and float math is done inline, the rest calls Value_apply.
+ * Calls run the native code of the callee, if it has some and its
+ * parameters are ints, otherwise they go through Code_call.
+ * A function is compiled for int parameters.
+ * Returns NULL if the jit is not supported here or a malloc failed.
+ */
+struct JitCode
+*Jit_compile(
+	const struct Code *c);
+
+/* Same as Code_run, but runs native code.
+ * Falls back to Code_run if a variable does not start as int.
+ * Only tiered callees are counted and compiled, see Code_run_tiered,
+ * so code that is not tiered can be run by several threads.
+ */
+long
+Jit_run(
+	const struct JitCode *j,
+	const struct Code    *c,
+	struct Value         *regs,
+	int                  *ic,
+	enum RuntimeStatus   *rs);
+
+void
+Jit_free(
+	struct JitCode *j);
+
+/* Counts the run and compiles code once it ran more than c->hot_runs
+ * times, unless that is -1, then runs it with whichever tier it has.
+ * Callees are counted and compiled the same way on each call,
+ * by native code and by Code_run.
+ * If compiling fails, the code stays interpreted.
+ * Same returns as Code_run.
+ */
+long
+Code_run_tiered(
+	struct Code        *c,
+	struct Value       *regs,
+	int                *ic,
+	enum RuntimeStatus *rs);
+
+/* Used by Code_run for a call op of c, whose callee is tiered.
+ * Counts the call, and runs the native code of the callee,
+ * if it has some and its parameters are ints.
+ * Ops run are added to n_called.
+ * Returns -1 if the call is left to the caller,
+ * otherwise non zero if the call failed.
+ */
+int
+Code_call_tiered(
+	const struct Code  *c,
+	const struct Op    *op,
+	struct Value       *regs,
+	const struct Value *end,
+	int                 depth,
+	long               *n_called,
+	enum RuntimeStatus *rs);
+
+#endif /* _JIT_H */
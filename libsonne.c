@@ -0,0 +1,328 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#include "libsonne.h"
+#include "SVM.h"
+#include "jit.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char PROGRAM_NAME[] = "program";
+
+/* Everything in here is only read after compiling.
+ * Unlike Module_run, runs never tier up into native code on their own,
+ * as that would change the code under other threads.
+ */
+struct SonneProgram {
+	struct Module   mod;
+	struct Code    *code;  /* of the global scope */
+	struct JitCode *jit;   /* of code, NULL if not wanted or supported */
+	struct Value   *frame; /* new frame, copied into each run */
+};
+
+struct SonneRun {
+	const struct SonneProgram *prog;
+	struct Value              *frame;
+};
+
+const char
+*SonneStatus_str(
+	enum SonneStatus status)
+{
+	switch (status) {
+	case SS_ok:
+		return "Ok";
+
+	case SS_malloc_failed:
+		return "Memory allocation failed";
+
+	case SS_read_failed:
+		return "File could not be read";
+
+	case SS_tokenize_failed:
+		return "Tokenizing failed";
+
+	case SS_translate_failed:
+		return "Translating failed";
+
+	case SS_lower_failed:
+		return "Scope has too many registers";
+
+	case SS_division_by_zero:
+		return "Division by zero";
+
+	case SS_unknown_variable:
+		return "Unknown variable";
+
+	case SS_stack_overflow:
+		return "Calls nest too deep";
+	}
+
+	return "Unknown status";
+}
+
+/* Takes ownership of src, even on failure.
+ */
+static struct SonneProgram
+*SonneProgram_from_source(
+	struct Source     *src,
+	int                opt_level,
+	int                jit,
+	struct SonneError *err)
+{
+	int i;
+	struct SonneProgram *p;
+	enum TokenizerError te;
+	enum TranslateStatus ts;
+
+	err->status = SS_ok;
+	err->row = 0;
+	err->col = 0;
+
+	p = malloc(sizeof(struct SonneProgram));
+	if (p == NULL) {
+		Source_free(src);
+		err->status = SS_malloc_failed;
+		return NULL;
+	}
+	p->mod = Module_new(PROGRAM_NAME);
+	p->code = NULL;
+	p->jit = NULL;
+	p->frame = NULL;
+
+	if (Module_from_source(&p->mod, src, PROGRAM_NAME, &te, &ts)) {
+		err->status = SS_malloc_failed;
+		goto failed;
+	}
+	if (te) {
+		err->status = SS_tokenize_failed;
+		goto failed;
+	}
+	if (ts) {
+		err->status = SS_translate_failed;
+		err->row = p->mod.t[p->mod.tc].row;
+		err->col = p->mod.t[p->mod.tc].col;
+		goto failed;
+	}
+
+	if (Module_optimize(&p->mod, opt_level)) {
+		err->status = SS_malloc_failed;
+		goto failed;
+	}
+	if (Module_lower(&p->mod)) {
+		err->status = SS_lower_failed;
+		goto failed;
+	}
+
+	p->code = &p->mod.s[0]->code;
+	p->frame = Code_new_frame(p->code);
+	if (p->frame == NULL) {
+		err->status = SS_malloc_failed;
+		goto failed;
+	}
+	/* functions too, as runs never compile them */
+	for (i = 0; jit && i < p->mod.slen; i++) {
+		p->mod.s[i]->code.jit = Jit_compile(&p->mod.s[i]->code);
+	}
+	p->jit = p->code->jit;
+
+	return p;
+
+failed:
+	SonneProgram_free(p);
+	return NULL;
+}
+
+struct SonneProgram
+*SonneProgram_compile(
+	const char        *text,
+	size_t             len,
+	int                opt_level,
+	int                jit,
+	struct SonneError *err)
+{
+	struct Source src = {
+		.buf = NULL,
+		.len = 0,
+		.mapped = 0,
+	};
+
+	if (len > INT_MAX) {
+		err->status = SS_read_failed;
+		err->row = 0;
+		err->col = 0;
+		return NULL;
+	}
+
+	src.buf = malloc(len > 0 ? len : 1);
+	if (src.buf == NULL) {
+		err->status = SS_malloc_failed;
+		err->row = 0;
+		err->col = 0;
+		return NULL;
+	}
+	memcpy(src.buf, text, len);
+	src.len = len;
+
+	return SonneProgram_from_source(&src, opt_level, jit, err);
+}
+
+struct SonneProgram
+*SonneProgram_from_file(
+	const char        *path,
+	int                opt_level,
+	int                jit,
+	struct SonneError *err)
+{
+	FILE *f;
+	struct Source src;
+
+	f = fopen(path, "r");
+	if (f == NULL || Source_from_file(&src, f)) {
+		if (f != NULL) {
+			fclose(f);
+			Source_free(&src);
+		}
+		err->status = SS_read_failed;
+		err->row = 0;
+		err->col = 0;
+		return NULL;
+	}
+	fclose(f);
+
+	return SonneProgram_from_source(&src, opt_level, jit, err);
+}
+
+void
+SonneProgram_free(
+	struct SonneProgram *p)
+{
+	if (p == NULL) {
+		return;
+	}
+
+	free(p->frame);
+	Module_free(&p->mod);
+	free(p);
+}
+
+struct SonneRun
+*SonneRun_new(
+	const struct SonneProgram *p)
+{
+	struct SonneRun *r;
+
+	r = malloc(sizeof(struct SonneRun));
+	if (r == NULL) {
+		return NULL;
+	}
+
+	r->prog = p;
+	r->frame = Code_new_frame(p->code);
+	if (r->frame == NULL) {
+		free(r);
+		return NULL;
+	}
+
+	return r;
+}
+
+int
+SonneRun_exec(
+	struct SonneRun   *r,
+	struct SonneError *err)
+{
+	int ic;
+	enum RuntimeStatus rs;
+	const struct SonneProgram *p = r->prog;
+
+	memcpy(r->frame, p->frame, sizeof(struct Value) * p->code->n_regs);
+
+	if (p->jit != NULL) {
+		Jit_run(p->jit, p->code, r->frame, &ic, &rs);
+	} else {
+		Code_run(p->code, r->frame, &ic, &rs);
+	}
+
+	err->status = SS_ok;
+	err->row = 0;
+	err->col = 0;
+	if (rs != RS_ok) {
+		err->status = rs == RS_division_by_zero ?
+		              SS_division_by_zero : SS_stack_overflow;
+		err->row = p->code->rows[ic];
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Returns the variable's value in r, or NULL if there is none.
+ */
+static const struct Value
+*SonneRun_find_var(
+	const struct SonneRun *r,
+	const char            *name)
+{
+	int sym;
+	int var;
+	const struct Module *mod = &r->prog->mod;
+
+	sym = Interner_find(&mod->names, name, strlen(name));
+	if (sym == -1) {
+		return NULL;
+	}
+	var = Scope_find_var(mod->s[0], sym);
+	if (var == -1) {
+		return NULL;
+	}
+
+	return &r->frame[var];
+}
+
+enum SonneStatus
+SonneRun_get_int(
+	const struct SonneRun *r,
+	const char            *name,
+	int                   *v)
+{
+	const struct Value *val = SonneRun_find_var(r, name);
+
+	if (val == NULL) {
+		return SS_unknown_variable;
+	}
+
+	*v = val->type == VT_float ? (int) val->c.f : val->c.i;
+	return SS_ok;
+}
+
+enum SonneStatus
+SonneRun_get_float(
+	const struct SonneRun *r,
+	const char            *name,
+	float                 *v)
+{
+	const struct Value *val = SonneRun_find_var(r, name);
+
+	if (val == NULL) {
+		return SS_unknown_variable;
+	}
+
+	*v = val->type == VT_float ? val->c.f : (float) val->c.i;
+	return SS_ok;
+}
+
+void
+SonneRun_free(
+	struct SonneRun *r)
+{
+	if (r == NULL) {
+		return;
+	}
+
+	free(r->frame);
+	free(r);
+}
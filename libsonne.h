@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+/* Embedding API, built as libsonne.a and libsonne.so.
+ * A program is compiled once and never changed by running it,
+ * so any number of threads may run the same program at once,
+ * each with its own run, without locking.
+ * A run must only be used by one thread at a time.
+ */
+
+#ifndef _LIBSONNE_H
+#define _LIBSONNE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum SonneStatus {
+	SS_ok,
+	SS_malloc_failed,
+	SS_read_failed,
+	SS_tokenize_failed,
+	SS_translate_failed,
+	SS_lower_failed,
+	SS_division_by_zero,
+	SS_unknown_variable,
+	SS_stack_overflow
+};
+
+/* Why and where compiling or running failed.
+ */
+struct SonneError {
+	enum SonneStatus status;
+	int              row; /* starting at 1, or 0 if unknown */
+	int              col;
+};
+
+struct SonneProgram;
+struct SonneRun;
+
+/* Returns a static description of status.
+ */
+const char
+*SonneStatus_str(
+	enum SonneStatus status);
+
+/* Compiles text of len bytes, which is copied.
+ * opt_level: see -O0 and -O1 of sonne
+ * jit:       if non zero, compiles to native code right away,
+ *            falling back to the interpreter where not supported
+ * Returns the program, or NULL with the reason in err.
+ */
+struct SonneProgram
+*SonneProgram_compile(
+	const char        *text,
+	size_t             len,
+	int                opt_level,
+	int                jit,
+	struct SonneError *err);
+
+/* Same as SonneProgram_compile, but reads the text from path.
+ */
+struct SonneProgram
+*SonneProgram_from_file(
+	const char        *path,
+	int                opt_level,
+	int                jit,
+	struct SonneError *err);
+
+/* All runs of p must be freed beforehand.
+ */
+void
+SonneProgram_free(
+	struct SonneProgram *p);
+
+/* Returns a new run of p, or NULL if malloc failed.
+ */
+struct SonneRun
+*SonneRun_new(
+	const struct SonneProgram *p);
+
+/* Runs the program from the start, forgetting values of the previous run.
+ * Returns non zero if the run failed, with the reason in err.
+ */
+int
+SonneRun_exec(
+	struct SonneRun   *r,
+	struct SonneError *err);
+
+/* Writes the value of variable name, after the last run, into v.
+ * Floats are truncated.
+ * Returns SS_unknown_variable if there is no such variable.
+ */
+enum SonneStatus
+SonneRun_get_int(
+	const struct SonneRun *r,
+	const char            *name,
+	int                   *v);
+
+/* Same as SonneRun_get_int, but ints are converted to float.
+ */
+enum SonneStatus
+SonneRun_get_float(
+	const struct SonneRun *r,
+	const char            *name,
+	float                 *v);
+
+void
+SonneRun_free(
+	struct SonneRun *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LIBSONNE_H */
@@ -0,0 +1,933 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#include "optimize.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define FOLD_TMP_RESERVE 4096 /* registers not used for folded constants */
+
+/* A register that currently holds the same value as src.
+ * Only valid while src has not been written since, see version.
+ */
+struct Alias {
+	int            valid;
+	struct Operand src;
+	int            version; /* of src, when the alias was made */
+};
+
+/* Vars and tmp values share one index space,
+ * literals, arguments and functions are -1.
+ */
+static inline int
+Scope_reg_of(
+	const struct Scope   *s,
+	const struct Operand *o)
+{
+	switch (o->type) {
+	case OT_var:
+		return o->idx;
+	case OT_tmp:
+		return s->n_vars + o->idx;
+	case OT_literal:
+	case OT_arg:
+	case OT_func:
+		return -1;
+	}
+
+	return -1;
+}
+
+/* Returns index of the first value, that the instruction reads,
+ * the one before it is written.
+ */
+static inline int
+Instruction_first_source(
+	const struct Instruction *instr)
+{
+	return instr->type == IT_return ? 0 : 1;
+}
+
+static inline int
+Operand_equal(
+	const struct Operand *a,
+	const struct Operand *b)
+{
+	return a->type == b->type && a->idx == b->idx;
+}
+
+static enum Opcode
+InstructionType_to_opcode(
+	enum InstructionType it)
+{
+	switch (it) {
+	case IT_mov:
+		return OP_mov;
+	case IT_add:
+		return OP_add;
+	case IT_sub:
+		return OP_sub;
+	case IT_mul:
+		return OP_mul;
+	case IT_div:
+		return OP_div;
+	case IT_modulus:
+		return OP_modulus;
+	case IT_call:
+		return OP_call;
+	case IT_return:
+		return OP_ret;
+	}
+
+	return OP_halt;
+}
+
+/* Only integer division by zero and calls, that may divide or nest
+ * too deep, stop a run.
+ */
+static int
+Instruction_may_fail(
+	const struct Scope       *s,
+	const struct Instruction *instr)
+{
+	const struct Value *right;
+
+	if (instr->type == IT_call) {
+		return 1;
+	}
+	if (instr->type != IT_div && instr->type != IT_modulus) {
+		return 0;
+	}
+	if (instr->vals[2].type != OT_literal) {
+		return 1;
+	}
+
+	right = &s->literals[instr->vals[2].idx];
+	return right->type == VT_int && right->c.i == 0;
+}
+
+/* Drops all instructions marked as dead.
+ * Returns amount of removed instructions.
+ */
+static int
+Scope_drop_instructions(
+	struct Scope *s,
+	const char   *dead)
+{
+	int i;
+	int n = 0;
+	int removed;
+
+	for (i = 0; i < s->n_instrs; i++) {
+		if (!dead[i]) {
+			s->instrs[n] = s->instrs[i];
+			n++;
+		}
+	}
+
+	removed = s->n_instrs - n;
+	s->n_instrs = n;
+	return removed;
+}
+
+int
+Scope_coalesce_movs(
+	struct Scope *s)
+{
+	int i;
+	int v;
+	int n = 0;
+	int removed;
+	int *reads;
+	struct Instruction *instr;
+	struct Instruction *prev;
+
+	/* The translator reads every tmp value exactly once,
+	 * but inlined parameters and locals are read as often as they were.
+	 */
+	reads = calloc(s->n_tmp_vals + 1, sizeof(int));
+	if (reads == NULL) {
+		return -1;
+	}
+	for (i = 0; i < s->n_instrs; i++) {
+		instr = &s->instrs[i];
+		for (v = Instruction_first_source(instr); v < instr->n_vals; v++) {
+			if (instr->vals[v].type == OT_tmp) {
+				reads[instr->vals[v].idx]++;
+			}
+		}
+	}
+
+	/* a mov right after the definition, that is the only reader */
+	for (i = 0; i < s->n_instrs; i++) {
+		instr = &s->instrs[i];
+		prev = n > 0 ? &s->instrs[n - 1] : NULL;
+
+		if (prev != NULL &&
+		    prev->type != IT_return &&
+		    instr->type == IT_mov &&
+		    instr->vals[1].type == OT_tmp &&
+		    reads[instr->vals[1].idx] == 1 &&
+		    Operand_equal(&prev->vals[0], &instr->vals[1])) {
+			prev->vals[0] = instr->vals[0];
+			continue;
+		}
+
+		s->instrs[n] = *instr;
+		n++;
+	}
+
+	free(reads);
+	removed = s->n_instrs - n;
+	s->n_instrs = n;
+	return removed;
+}
+
+int
+Scope_fold_constants(
+	struct Scope *s)
+{
+	int i;
+	int v;
+	int reg;
+	int lit;
+	int n_regs = s->n_vars + s->n_tmp_vals;
+	int *version;
+	char *dead;
+	struct Alias *alias;
+	struct Alias *a;
+	struct Instruction *instr;
+	struct Value result;
+
+	version = calloc(n_regs + 1, sizeof(int));
+	alias = calloc(n_regs + 1, sizeof(struct Alias));
+	dead = calloc(s->n_instrs + 1, sizeof(char));
+	if (version == NULL || alias == NULL || dead == NULL) {
+		free(version);
+		free(alias);
+		free(dead);
+		return 1;
+	}
+
+	for (i = 0; i < s->n_instrs; i++) {
+		instr = &s->instrs[i];
+
+		for (v = Instruction_first_source(instr); v < instr->n_vals; v++) {
+			reg = Scope_reg_of(s, &instr->vals[v]);
+			if (reg == -1) {
+				continue;
+			}
+			a = &alias[reg];
+			if (a->valid &&
+			    (a->src.type == OT_literal ||
+			     version[Scope_reg_of(s, &a->src)] == a->version)) {
+				instr->vals[v] = a->src;
+			}
+		}
+		if (instr->type == IT_return) {
+			continue;
+		}
+
+		/* every folded result may be a new constant register,
+		 * leave some room for the tmp values */
+		if (instr->n_vals == 3 &&
+		    s->n_vars + s->n_literals <
+		    CODE_MAX_REGISTERS - FOLD_TMP_RESERVE &&
+		    instr->vals[1].type == OT_literal &&
+		    instr->vals[2].type == OT_literal &&
+		    RS_ok == Value_apply(&result,
+		                         InstructionType_to_opcode(instr->type),
+		                         &s->literals[instr->vals[1].idx],
+		                         &s->literals[instr->vals[2].idx])) {
+			lit = Scope_add_literal(s, result);
+			if (lit == -1) {
+				free(version);
+				free(alias);
+				free(dead);
+				return 1;
+			}
+			instr->type = IT_mov;
+			instr->n_vals = 2;
+			instr->vals[1].type = OT_literal;
+			instr->vals[1].idx = lit;
+		}
+
+		if (instr->type == IT_mov &&
+		    Operand_equal(&instr->vals[0], &instr->vals[1])) {
+			dead[i] = 1;
+			continue;
+		}
+
+		/* arguments are only read by the call */
+		reg = Scope_reg_of(s, &instr->vals[0]);
+		if (reg == -1) {
+			continue;
+		}
+		version[reg]++;
+		alias[reg].valid = 0;
+		if (instr->type == IT_mov) {
+			alias[reg].valid = 1;
+			alias[reg].src = instr->vals[1];
+			if (instr->vals[1].type != OT_literal) {
+				alias[reg].version =
+					version[Scope_reg_of(s, &instr->vals[1])];
+			}
+		}
+	}
+
+	Scope_drop_instructions(s, dead);
+
+	free(version);
+	free(alias);
+	free(dead);
+	return 0;
+}
+
+int
+Scope_remove_dead_stores(
+	struct Scope *s)
+{
+	int i;
+	int v;
+	int reg;
+	int removed;
+	char *live;
+	char *dead;
+	struct Instruction *instr;
+
+	live = malloc(s->n_vars + s->n_tmp_vals + 1);
+	dead = calloc(s->n_instrs + 1, sizeof(char));
+	if (live == NULL || dead == NULL) {
+		free(live);
+		free(dead);
+		return -1;
+	}
+
+	/* only the variables of the global scope are seen after a run */
+	for (i = 0; i < s->n_vars; i++) {
+		live[i] = s->parent == NULL;
+	}
+	for (i = 0; i < s->n_tmp_vals; i++) {
+		live[s->n_vars + i] = 0;
+	}
+
+	for (i = s->n_instrs - 1; i >= 0; i--) {
+		instr = &s->instrs[i];
+
+		/* arguments are always read by the call after them */
+		reg = instr->type == IT_return ?
+		      -1 : Scope_reg_of(s, &instr->vals[0]);
+		if (reg != -1 &&
+		    !live[reg] &&
+		    !Instruction_may_fail(s, instr)) {
+			dead[i] = 1;
+			continue;
+		}
+
+		if (reg != -1) {
+			live[reg] = 0;
+		}
+		for (v = Instruction_first_source(instr); v < instr->n_vals; v++) {
+			reg = Scope_reg_of(s, &instr->vals[v]);
+			if (reg != -1) {
+				live[reg] = 1;
+			}
+		}
+	}
+
+	removed = Scope_drop_instructions(s, dead);
+
+	free(live);
+	free(dead);
+	return removed;
+}
+
+int
+Scope_compact_literals(
+	struct Scope *s)
+{
+	int i;
+	int v;
+	int n = 0;
+	int removed;
+	int *map;
+	struct Value *kept;
+	struct Operand *o;
+
+	if (s->n_literals == 0) {
+		return 0;
+	}
+	map = malloc(sizeof(int) * s->n_literals);
+	kept = malloc(sizeof(struct Value) * s->n_literals);
+	if (map == NULL || kept == NULL) {
+		free(map);
+		free(kept);
+		return -1;
+	}
+
+	for (i = 0; i < s->n_literals; i++) {
+		map[i] = -1;
+	}
+	for (i = 0; i < s->n_instrs; i++) {
+		for (v = 0; v < s->instrs[i].n_vals; v++) {
+			if (s->instrs[i].vals[v].type == OT_literal) {
+				map[s->instrs[i].vals[v].idx] = 0;
+			}
+		}
+	}
+	/* kept literals keep their order, so they stay unique */
+	for (i = 0; i < s->n_literals; i++) {
+		if (map[i] != -1) {
+			kept[n] = s->literals[i];
+			map[i] = n;
+			n++;
+		}
+	}
+	removed = s->n_literals - n;
+	if (removed == 0) {
+		free(map);
+		free(kept);
+		return 0;
+	}
+
+	Scope_truncate(s, s->n_instrs, s->n_vars, 0, s->n_tmp_vals);
+	for (i = 0; i < n; i++) {
+		if (Scope_add_literal(s, kept[i]) == -1) {
+			free(map);
+			free(kept);
+			return -1;
+		}
+	}
+	for (i = 0; i < s->n_instrs; i++) {
+		for (v = 0; v < s->instrs[i].n_vals; v++) {
+			o = &s->instrs[i].vals[v];
+			if (o->type == OT_literal) {
+				o->idx = map[o->idx];
+			}
+		}
+	}
+
+	free(map);
+	free(kept);
+	return removed;
+}
+
+int
+Scope_allocate_tmps(
+	struct Scope *s)
+{
+	return Scope_allocate_tmps_from(s, 0);
+}
+
+int
+Scope_allocate_tmps_from(
+	struct Scope *s,
+	int           first)
+{
+	int i;
+	int v;
+	int t;
+	int n_slots = 0;
+	int n_free = 0;
+	int read[3];
+	int *last;
+	int *slot;
+	int *free_slots;
+	struct Instruction *instr;
+
+	if (s->n_tmp_vals == 0) {
+		return 0;
+	}
+
+	last = malloc(sizeof(int) * s->n_tmp_vals);
+	slot = malloc(sizeof(int) * s->n_tmp_vals);
+	free_slots = malloc(sizeof(int) * s->n_tmp_vals);
+	if (last == NULL || slot == NULL || free_slots == NULL) {
+		free(last);
+		free(slot);
+		free(free_slots);
+		return 1;
+	}
+
+	for (t = 0; t < s->n_tmp_vals; t++) {
+		last[t] = -1;
+		slot[t] = -1;
+	}
+	for (i = first; i < s->n_instrs; i++) {
+		for (v = 0; v < s->instrs[i].n_vals; v++) {
+			if (s->instrs[i].vals[v].type == OT_tmp) {
+				last[s->instrs[i].vals[v].idx] = i;
+			}
+		}
+	}
+
+	/* Sources are read before the destination is written,
+	 * so an instruction may reuse the slot of its last read source.
+	 * Inlined code may read one tmp value twice in an instruction,
+	 * so all sources are mapped before any slot is freed.
+	 */
+	for (i = first; i < s->n_instrs; i++) {
+		instr = &s->instrs[i];
+
+		for (v = 0; v < instr->n_vals; v++) {
+			read[v] = -1;
+		}
+		for (v = Instruction_first_source(instr); v < instr->n_vals; v++) {
+			if (instr->vals[v].type != OT_tmp) {
+				continue;
+			}
+			read[v] = instr->vals[v].idx;
+			instr->vals[v].idx = slot[read[v]];
+		}
+		for (v = Instruction_first_source(instr); v < instr->n_vals; v++) {
+			t = read[v];
+			if (t != -1 && last[t] == i && slot[t] != -1) {
+				free_slots[n_free] = slot[t];
+				n_free++;
+				slot[t] = -1;
+			}
+		}
+
+		if (instr->type == IT_return || instr->vals[0].type != OT_tmp) {
+			continue;
+		}
+		t = instr->vals[0].idx;
+		if (slot[t] == -1) {
+			if (n_free > 0) {
+				n_free--;
+				slot[t] = free_slots[n_free];
+			} else {
+				slot[t] = n_slots;
+				n_slots++;
+			}
+		}
+		instr->vals[0].idx = slot[t];
+		if (last[t] == i) {
+			free_slots[n_free] = slot[t];
+			n_free++;
+			slot[t] = -1;
+		}
+	}
+
+	s->n_tmp_vals = n_slots;
+
+	free(last);
+	free(slot);
+	free(free_slots);
+	return 0;
+}
+
+int
+Scope_optimize(
+	struct Scope *s,
+	int level)
+{
+	if (level >= 1) {
+		if (Scope_coalesce_movs(s) == -1) {
+			return 1;
+		}
+
+		if (Scope_fold_constants(s)) {
+			return 1;
+		}
+
+		if (Scope_remove_dead_stores(s) == -1) {
+			return 1;
+		}
+
+		if (Scope_compact_literals(s) == -1) {
+			return 1;
+		}
+	}
+
+	/* not optional, tmp values only fit into registers once reused */
+	if (Scope_allocate_tmps(s)) {
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Per scope, for walking the calls between scopes.
+ */
+struct CallGraph {
+	int  *index;     /* in search order, -1 if not searched yet */
+	int  *low;       /* lowest index, that a call reaches on the stack */
+	int  *stack;     /* of the search */
+	int   n_stack;
+	int   n_searched;
+	char *on_stack;
+	char *recursive; /* calls itself, also through other scopes */
+	char *state;     /* 0 if not inlined yet, 1 while being inlined, 2 if done */
+};
+
+/* Marks the scopes, that call themselves, reachable from scope k,
+ * by finding the strongly connected components of the calls, see Tarjan.
+ */
+static void
+Module_find_recursion(
+	const struct Module *mod,
+	struct CallGraph    *g,
+	int                  k)
+{
+	int i;
+	int f;
+	int top;
+	const struct Scope *s = mod->s[k];
+
+	g->index[k] = g->n_searched;
+	g->low[k] = g->n_searched;
+	g->n_searched++;
+	g->stack[g->n_stack] = k;
+	g->n_stack++;
+	g->on_stack[k] = 1;
+
+	for (i = 0; i < s->n_instrs; i++) {
+		if (s->instrs[i].type != IT_call) {
+			continue;
+		}
+		f = s->instrs[i].vals[1].idx;
+
+		if (f == k) {
+			g->recursive[k] = 1;
+		} else if (g->index[f] == -1) {
+			Module_find_recursion(mod, g, f);
+			if (g->low[f] < g->low[k]) {
+				g->low[k] = g->low[f];
+			}
+		} else if (g->on_stack[f] && g->index[f] < g->low[k]) {
+			g->low[k] = g->index[f];
+		}
+	}
+
+	if (g->low[k] != g->index[k]) {
+		return;
+	}
+	/* components of more than one scope call around in circles */
+	top = g->stack[g->n_stack - 1];
+	do {
+		g->n_stack--;
+		f = g->stack[g->n_stack];
+		g->on_stack[f] = 0;
+		if (top != k) {
+			g->recursive[f] = 1;
+		}
+	} while (f != k);
+}
+
+/* Returns amount of instructions of f before its first return,
+ * or -1 if it has none.
+ */
+static int
+Scope_body_len(
+	const struct Scope *f)
+{
+	int i;
+
+	for (i = 0; i < f->n_instrs; i++) {
+		if (f->instrs[i].type == IT_return) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/* Returns non zero if the n instructions at instrs move tmp values
+ * into the arguments of a call, in order, as translated.
+ */
+static int
+Instructions_pass_args(
+	const struct Instruction *instrs,
+	int                       n)
+{
+	int j;
+
+	for (j = 0; j < n; j++) {
+		if (instrs[j].type != IT_mov ||
+		    instrs[j].vals[0].type != OT_arg ||
+		    instrs[j].vals[0].idx != j ||
+		    instrs[j].vals[1].type != OT_tmp) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Maps an operand of f onto the scope s, that f is inlined into.
+ * args: movs of the arguments, see Instructions_pass_args
+ * base: first new tmp value of s, the variables of f come first
+ * Returns non zero if malloc failed.
+ */
+static int
+Scope_inline_operand(
+	struct Scope             *s,
+	const struct Scope       *f,
+	const struct Instruction *args,
+	int                       base,
+	struct Operand           *o)
+{
+	switch (o->type) {
+	case OT_var:
+		if (o->idx < f->n_params) {
+			*o = args[o->idx].vals[1];
+		} else {
+			o->type = OT_tmp;
+			o->idx = base + o->idx - f->n_params;
+		}
+		break;
+
+	case OT_tmp:
+		o->idx += base + f->n_vars - f->n_params;
+		break;
+
+	case OT_literal:
+		o->idx = Scope_add_literal(s, f->literals[o->idx]);
+		return o->idx == -1;
+
+	case OT_arg:
+	case OT_func:
+		break;
+	}
+
+	return 0;
+}
+
+/* Appends the call to mod->inlined.
+ * Returns non zero if malloc failed.
+ */
+static int
+Module_add_inlined(
+	struct Module            *mod,
+	const struct Scope       *s,
+	const struct Instruction *call)
+{
+	if (mod->n_inlined >= mod->inlined_size) {
+		mod->inlined = Arena_grow(&mod->arena, mod->inlined,
+		                          sizeof(struct InlinedCall) *
+		                          mod->inlined_size,
+		                          sizeof(struct InlinedCall) *
+		                          (mod->inlined_size + 16) * 2);
+		if (mod->inlined == NULL) {
+			return 1;
+		}
+		mod->inlined_size = (mod->inlined_size + 16) * 2;
+	}
+
+	mod->inlined[mod->n_inlined].caller = s->idx;
+	mod->inlined[mod->n_inlined].callee = call->vals[1].idx;
+	mod->inlined[mod->n_inlined].row = call->row;
+	mod->n_inlined++;
+	return 0;
+}
+
+/* Inlines the calls of scope k, after those of its callees.
+ * Returns amount of inlined calls, or -1 if malloc failed.
+ */
+static int
+Module_inline_scope(
+	struct Module    *mod,
+	struct CallGraph *g,
+	int               k)
+{
+	int i;
+	int j;
+	int v;
+	int n;
+	int len;
+	int base;
+	int n_out = 0;
+	int out_size;
+	int ret = 0;
+	struct Scope *s = mod->s[k];
+	const struct Scope *f;
+	const struct Instruction *call;
+	struct Instruction *instr;
+	struct Instruction *out;
+	void *grown;
+
+	g->state[k] = 1;
+	out_size = s->n_instrs + 1;
+	out = malloc(sizeof(struct Instruction) * out_size);
+	if (out == NULL) {
+		return -1;
+	}
+
+	for (i = 0; i < s->n_instrs; i++) {
+		call = &s->instrs[i];
+		f = call->type == IT_call ? mod->s[call->vals[1].idx] : NULL;
+
+		if (f != NULL && g->state[f->idx] == 0) {
+			n = Module_inline_scope(mod, g, f->idx);
+			if (n == -1) {
+				goto failed;
+			}
+			ret += n;
+		}
+
+		n = f == NULL ? 0 : f->n_params;
+		len = f == NULL ? -1 : Scope_body_len(f);
+		if (n_out + len + 2 > out_size) {
+			grown = realloc(out, sizeof(struct Instruction) *
+			                     (n_out + len + 2) * 2);
+			if (grown == NULL) {
+				goto failed;
+			}
+			out = grown;
+			out_size = (n_out + len + 2) * 2;
+		}
+
+		if (f == NULL ||
+		    g->recursive[f->idx] ||
+		    len == -1 ||
+		    len > mod->inline_max ||
+		    n_out < n ||
+		    !Instructions_pass_args(&out[n_out - n], n)) {
+			out[n_out] = *call;
+			n_out++;
+			continue;
+		}
+
+		/* the body goes behind the argument movs, which it reads,
+		 * then over them */
+		base = s->n_tmp_vals;
+		s->n_tmp_vals += f->n_vars - n + f->n_tmp_vals;
+		for (j = 0; j <= len; j++) {
+			instr = &out[n_out + j];
+			*instr = f->instrs[j];
+			instr->row = call->row;
+
+			if (instr->type == IT_return) {
+				instr->type = IT_mov;
+				instr->n_vals = 2;
+				instr->vals[1] = instr->vals[0];
+				instr->vals[0] = call->vals[0];
+				if (Scope_inline_operand(s, f, &out[n_out - n],
+				                         base, &instr->vals[1])) {
+					goto failed;
+				}
+				continue;
+			}
+			for (v = 0; v < instr->n_vals; v++) {
+				if (Scope_inline_operand(s, f, &out[n_out - n],
+				                         base, &instr->vals[v])) {
+					goto failed;
+				}
+			}
+		}
+		memmove(&out[n_out - n], &out[n_out],
+		        sizeof(struct Instruction) * (len + 1));
+		n_out += len + 1 - n;
+
+		if (f->n_args > s->n_args) {
+			s->n_args = f->n_args;
+		}
+		if (Module_add_inlined(mod, s, call)) {
+			goto failed;
+		}
+		ret++;
+	}
+
+	s->n_instrs = 0;
+	for (i = 0; i < n_out; i++) {
+		if (Scope_add_instruction(s, out[i])) {
+			goto failed;
+		}
+	}
+
+	/* calls, that were inlined, need no arguments anymore */
+	s->n_args = 0;
+	for (i = 0; i < s->n_instrs; i++) {
+		if (s->instrs[i].type == IT_call &&
+		    mod->s[s->instrs[i].vals[1].idx]->n_params > s->n_args) {
+			s->n_args = mod->s[s->instrs[i].vals[1].idx]->n_params;
+		}
+	}
+
+	g->state[k] = 2;
+	free(out);
+	return ret;
+
+failed:
+	free(out);
+	return -1;
+}
+
+int
+Module_inline(
+	struct Module *mod)
+{
+	int k;
+	int n;
+	int ret = 0;
+	int *ints;
+	char *chars;
+	struct CallGraph g;
+
+	mod->n_inlined = 0;
+	if (mod->inline_max <= 0) {
+		return 0;
+	}
+
+	ints = malloc(sizeof(int) * (mod->slen * 3 + 1));
+	chars = calloc(mod->slen * 3 + 1, 1);
+	if (ints == NULL || chars == NULL) {
+		free(ints);
+		free(chars);
+		return -1;
+	}
+	g.index = ints;
+	g.low = &ints[mod->slen];
+	g.stack = &ints[mod->slen * 2];
+	g.n_stack = 0;
+	g.n_searched = 0;
+	g.on_stack = chars;
+	g.recursive = &chars[mod->slen];
+	g.state = &chars[mod->slen * 2];
+	for (k = 0; k < mod->slen; k++) {
+		g.index[k] = -1;
+	}
+
+	for (k = 0; k < mod->slen; k++) {
+		if (g.index[k] == -1) {
+			Module_find_recursion(mod, &g, k);
+		}
+	}
+	for (k = 0; k < mod->slen; k++) {
+		if (g.state[k] != 0) {
+			continue;
+		}
+		n = Module_inline_scope(mod, &g, k);
+		if (n == -1) {
+			ret = -1;
+			break;
+		}
+		ret += n;
+	}
+
+	free(ints);
+	free(chars);
+	return ret;
+}
+
+void
+Module_fprint_inlined(
+	const struct Module *mod,
+	FILE                *f)
+{
+	int i;
+	const struct InlinedCall *c;
+	const struct Scope *callee;
+
+	for (i = 0; i < mod->n_inlined; i++) {
+		c = &mod->inlined[i];
+		callee = mod->s[c->callee];
+		fprintf(f, "%s:%i: inlined %.*s\n",
+		        mod->name,
+		        c->row,
+		        Interner_name_len(&mod->names, callee->sym),
+		        Interner_name(&mod->names, callee->sym));
+	}
+}
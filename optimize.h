@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#ifndef _OPTIMIZE_H
+#define _OPTIMIZE_H
+
+#include "SVM.h"
+
+/* -O0 keeps instructions as translated,
+ * -O1 runs all passes below.
+ * Tmp values are allocated on every level.
+ */
+#define OPTIMIZE_LEVEL_DEFAULT 1
+
+/* Functions of at most this many instructions before their return
+ * are inlined, unless Module.inline_max says otherwise.
+ */
+#define INLINE_MAX_INSTRS 16
+
+/* Writes the result of an operation straight into the variable,
+ * instead of going through a tmp value and a mov.
+ * Returns amount of removed instructions, or -1 if malloc failed.
+ */
+int
+Scope_coalesce_movs(
+	struct Scope *s);
+
+/* Folds math on literals and replaces reads of copied values
+ * with their source.
+ * Returns non zero if malloc failed.
+ */
+int
+Scope_fold_constants(
+	struct Scope *s);
+
+/* Removes writes to tmp values and variables that are never read.
+ * The final values of variables are observable, so they are kept.
+ * Returns amount of removed instructions, or -1 if malloc failed.
+ */
+int
+Scope_remove_dead_stores(
+	struct Scope *s);
+
+/* Drops the literals, that no instruction reads anymore after folding,
+ * and renumbers the others.
+ * Returns amount of removed literals, or -1 if malloc failed.
+ */
+int
+Scope_compact_literals(
+	struct Scope *s);
+
+/* Maps tmp values onto as few slots as possible,
+ * reusing a slot once the last read of its value has passed.
+ * Returns non zero if malloc failed.
+ */
+int
+Scope_allocate_tmps(
+	struct Scope *s);
+
+/* Same as Scope_allocate_tmps, but only for instructions from first on,
+ * which must not share tmp values with earlier ones.
+ */
+int
+Scope_allocate_tmps_from(
+	struct Scope *s,
+	int           first);
+
+/* Replaces calls of small functions with the body of the callee,
+ * in every translated scope.
+ * Parameters become the tmp values, that held the arguments,
+ * and the variables and tmp values of the callee new tmp values,
+ * so the passes below see across the former call.
+ * Callees are inlined into each other first, recursive ones never.
+ * The inlined calls are recorded in mod->inlined.
+ * Returns amount of inlined calls, or -1 if malloc failed.
+ */
+int
+Module_inline(
+	struct Module *mod);
+
+/* Prints the calls, that were inlined, one line each.
+ */
+void
+Module_fprint_inlined(
+	const struct Module *mod,
+	FILE                *f);
+
+/* Runs all passes of the given level on a translated scope.
+ * Returns non zero if malloc failed.
+ */
+int
+Scope_optimize(
+	struct Scope *s,
+	int level);
+
+#endif /* _OPTIMIZE_H */
@@ -0,0 +1,269 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "profile.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <x86intrin.h>
+#endif
+
+/* One row or opcode of the report.
+ */
+struct ProfileEntry {
+	int      idx;
+	long     runs;
+	uint64_t ticks;
+};
+
+static inline uint64_t
+Profile_ticks(void)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+/* Hottest first.
+ */
+static int
+ProfileEntry_compare(
+	const void *a,
+	const void *b)
+{
+	const struct ProfileEntry *l = a;
+	const struct ProfileEntry *r = b;
+
+	if (l->ticks != r->ticks) {
+		return l->ticks < r->ticks ? 1 : -1;
+	}
+	return l->idx - r->idx;
+}
+
+/* Prints row of src without its line break, rows start at 1.
+ */
+static void
+Source_row_fprint(
+	const struct Source *src,
+	int                  row,
+	FILE                *f)
+{
+	int i = 0;
+	int len;
+
+	if (src->buf == NULL) {
+		return;
+	}
+
+	for (row--; row > 0 && i < src->len; i++) {
+		if (src->buf[i] == '\n') {
+			row--;
+		}
+	}
+	for (len = 0; i + len < src->len && src->buf[i + len] != '\n'; len++);
+
+	fprintf(f, "%.*s", len, &src->buf[i]);
+}
+
+int
+Profile_new(
+	struct Profile    *p,
+	const struct Code *c)
+{
+	int i;
+
+	p->n_rows = 1;
+	for (i = 0; i < c->n_ops; i++) {
+		if (c->rows[i] >= p->n_rows) {
+			p->n_rows = c->rows[i] + 1;
+		}
+	}
+
+	p->runs = calloc(p->n_rows * N_OPCODES, sizeof(long));
+	p->ticks = calloc(p->n_rows * N_OPCODES, sizeof(uint64_t));
+	if (p->runs == NULL || p->ticks == NULL) {
+		Profile_free(p);
+		return 1;
+	}
+
+	return 0;
+}
+
+long
+Code_run_profiled(
+	const struct Code  *c,
+	struct Value       *regs,
+	int                *ic,
+	struct Profile     *p,
+	enum RuntimeStatus *rs)
+{
+	int idx;
+	long n_called = 0;
+	uint64_t begin;
+	uint64_t ticks;
+	const struct Op *op;
+
+	*rs = RS_ok;
+
+	for (op = c->ops; op->code != OP_halt; op++) {
+		begin = Profile_ticks();
+		if (op->code == OP_call) {
+			n_called += Code_call(c, op, regs, &regs[c->stack_size],
+			                      0, rs);
+		} else {
+			*rs = Value_apply(&regs[op->a], op->code,
+			                  &regs[op->b], &regs[op->c]);
+		}
+		ticks = Profile_ticks() - begin;
+
+		idx = c->rows[op - c->ops] * N_OPCODES + op->code;
+		p->runs[idx]++;
+		p->ticks[idx] += ticks;
+
+		if (*rs) {
+			*ic = op - c->ops;
+			return n_called + (op - c->ops + 1);
+		}
+	}
+
+	*ic = op - c->ops - 1;
+	return n_called + (op - c->ops);
+}
+
+long
+Module_run_profiled(
+	struct Module      *mod,
+	struct Profile     *p,
+	enum RuntimeStatus *rs)
+{
+	struct Scope *s;
+
+	*rs = RS_ok;
+	if (mod->slen == 0) {
+		return 0;
+	}
+	s = mod->s[0];
+
+	free(s->frame);
+	s->frame = Code_new_frame(&s->code);
+	if (s->frame == NULL) {
+		return -1;
+	}
+
+	return Code_run_profiled(&s->code, s->frame, &mod->ic, p, rs);
+}
+
+void
+Profile_fprint(
+	const struct Profile *p,
+	const struct Source  *src,
+	FILE                 *f)
+{
+	int i;
+	int row;
+	int oc;
+	int n_hot = 0;
+	uint64_t total = 0;
+	struct ProfileEntry ops[N_OPCODES] = {{0}};
+	struct ProfileEntry *rows;
+
+	rows = calloc(p->n_rows, sizeof(struct ProfileEntry));
+	if (rows == NULL) {
+		return;
+	}
+
+	for (oc = 0; oc < N_OPCODES; oc++) {
+		ops[oc].idx = oc;
+	}
+	for (row = 0; row < p->n_rows; row++) {
+		rows[row].idx = row;
+		for (oc = 0; oc < N_OPCODES; oc++) {
+			i = row * N_OPCODES + oc;
+			rows[row].runs += p->runs[i];
+			rows[row].ticks += p->ticks[i];
+			ops[oc].runs += p->runs[i];
+			ops[oc].ticks += p->ticks[i];
+			total += p->ticks[i];
+		}
+	}
+	if (total == 0) {
+		total = 1;
+	}
+
+	qsort(ops, N_OPCODES, sizeof(struct ProfileEntry),
+	      ProfileEntry_compare);
+	qsort(rows, p->n_rows, sizeof(struct ProfileEntry),
+	      ProfileEntry_compare);
+
+	fprintf(f, "%12s %14s %7s  %s\n",
+	        "runs", PROFILE_TICK_UNIT, "%", "opcode");
+	for (i = 0; i < N_OPCODES && ops[i].runs > 0; i++) {
+		fprintf(f, "%12li %14llu %6.2f%%  ",
+		        ops[i].runs, (unsigned long long) ops[i].ticks,
+		        100.0 * ops[i].ticks / total);
+		Opcode_fprint(ops[i].idx, f);
+		fprintf(f, "\n");
+	}
+
+	fprintf(f, "\n%12s %14s %7s  %s\n",
+	        "runs", PROFILE_TICK_UNIT, "%", "row: source");
+	for (i = 0; i < p->n_rows && rows[i].runs > 0; i++) {
+		if (n_hot == PROFILE_HOT_LINES) {
+			break;
+		}
+		n_hot++;
+
+		fprintf(f, "%12li %14llu %6.2f%%  %i: ",
+		        rows[i].runs, (unsigned long long) rows[i].ticks,
+		        100.0 * rows[i].ticks / total, rows[i].idx);
+		Source_row_fprint(src, rows[i].idx, f);
+		fprintf(f, "\n");
+	}
+
+	free(rows);
+}
+
+int
+Profile_write_folded(
+	const struct Profile *p,
+	const char           *name,
+	FILE                 *f)
+{
+	int row;
+	int oc;
+	int i;
+
+	for (row = 0; row < p->n_rows; row++) {
+		for (oc = 0; oc < N_OPCODES; oc++) {
+			i = row * N_OPCODES + oc;
+			if (p->runs[i] == 0) {
+				continue;
+			}
+			fprintf(f, "%s;%s:%i;", name, name, row);
+			Opcode_fprint(oc, f);
+			fprintf(f, " %llu\n", (unsigned long long) p->ticks[i]);
+		}
+	}
+
+	return ferror(f);
+}
+
+void
+Profile_free(
+	struct Profile *p)
+{
+	free(p->runs);
+	free(p->ticks);
+	p->runs = NULL;
+	p->ticks = NULL;
+	p->n_rows = 0;
+}
@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "SVM.h"
+
+#define PROFILE_HOT_LINES 20 /* rows shown by Profile_fprint */
+
+/* Ticks are cycles of the time stamp counter on x86-64,
+ * nanoseconds everywhere else.
+ */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define PROFILE_TICK_UNIT "cycles"
+#else
+#define PROFILE_TICK_UNIT "ns"
+#endif
+
+/* Executions and ticks of each opcode on each source row of one code.
+ * Both arrays are indexed by row * N_OPCODES + opcode.
+ */
+struct Profile {
+	int       n_rows; /* highest row + 1 */
+	long     *runs;
+	uint64_t *ticks;
+};
+
+/* Returns non zero if malloc failed.
+ */
+int
+Profile_new(
+	struct Profile    *p,
+	const struct Code *c);
+
+/* Like Code_run, but measures every op on its own.
+ * This is a separate loop, so Code_run pays nothing for it,
+ * but reading the clock around each op makes this run much slower.
+ * Calls are measured as a whole, on the row of the call.
+ */
+long
+Code_run_profiled(
+	const struct Code  *c,
+	struct Value       *regs,
+	int                *ic,
+	struct Profile     *p,
+	enum RuntimeStatus *rs);
+
+/* Like Module_run, but always interprets and records into p,
+ * which must be made for the code of the global scope.
+ */
+long
+Module_run_profiled(
+	struct Module      *mod,
+	struct Profile     *p,
+	enum RuntimeStatus *rs);
+
+/* Prints ticks per opcode and the hottest source rows,
+ * with their text from src.
+ */
+void
+Profile_fprint(
+	const struct Profile *p,
+	const struct Source  *src,
+	FILE                 *f);
+
+/* Writes one line per row and opcode, as "name;name:row;opcode ticks",
+ * the folded stacks that flamegraph.pl and speedscope read.
+ * Returns non zero if writing failed.
+ */
+int
+Profile_write_folded(
+	const struct Profile *p,
+	const char           *name,
+	FILE                 *f);
+
+void
+Profile_free(
+	struct Profile *p);
+
+#endif /* _PROFILE_H */
@@ -0,0 +1,252 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "repl.h"
+#include "optimize.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char REPL_NAME[] = "stdin";
+
+int
+Repl_new(
+	struct Repl *r)
+{
+	r->mod = Module_new(REPL_NAME);
+	r->mod.names = Interner_new(&r->mod.arena);
+	r->n_regs = 0;
+	r->t = NULL;
+	r->tsize = 0;
+	r->row = 1;
+
+	r->s = Module_add_scope(&r->mod, REPL_NAME, NULL);
+	if (r->s == NULL) {
+		return 1;
+	}
+	r->mod.cur = r->s;
+
+	return 0;
+}
+
+/* Tokenizes a line into r->t.
+ * Returns amount of tokens, or -1 if malloc failed.
+ */
+static int
+Repl_tokenize(
+	struct Repl         *r,
+	const char          *line,
+	int                  len,
+	enum TokenizerError *te)
+{
+	int tlen = 0;
+	struct Tokenizer tz;
+	struct Token *grown;
+
+	Tokenizer_init(&tz, line, len);
+	tz.row = r->row;
+
+	*te = TE_ok;
+	while (!tz.done) {
+		if (*te == TE_tbuf_too_small || r->tsize == 0) {
+			grown = realloc(r->t, sizeof(struct Token) *
+			                      (r->tsize == 0 ? 64 : r->tsize * 2));
+			if (grown == NULL) {
+				return -1;
+			}
+			r->t = grown;
+			r->tsize = r->tsize == 0 ? 64 : r->tsize * 2;
+		}
+		tlen += Tokenizer_read(&tz, &r->t[tlen], r->tsize - tlen, te);
+		if (*te != TE_ok && *te != TE_tbuf_too_small) {
+			printf("%s:%i:%i: Unrecognized token\n",
+			       r->mod.name, tz.row, tz.pos - tz.row_begin);
+			return tlen;
+		}
+	}
+
+	return tlen;
+}
+
+/* Grows the frame stack to the last lowered line and the calls in it.
+ * Variables keep their values, new ones start as int zero,
+ * and the constants are laid out behind the line's tmp values.
+ * Returns non zero if realloc failed.
+ */
+static int
+Repl_fit_frame(
+	struct Repl *r,
+	int          n_vars)
+{
+	int i;
+	struct Value *grown;
+	const struct Code *c = &r->s->code;
+
+	if (c->stack_size > r->n_regs) {
+		grown = realloc(r->s->frame,
+		                sizeof(struct Value) * c->stack_size);
+		if (grown == NULL) {
+			return 1;
+		}
+		/* like Code_new_frame, zero bits are int zeros */
+		memset(&grown[r->n_regs], 0,
+		       sizeof(struct Value) * (c->stack_size - r->n_regs));
+		r->s->frame = grown;
+		r->n_regs = c->stack_size;
+	}
+
+	for (i = n_vars; i < c->n_vars; i++) {
+		r->s->frame[i].type = VT_int;
+		r->s->frame[i].c.i = 0;
+	}
+	memcpy(&r->s->frame[c->n_vars + c->n_tmps],
+	       c->consts,
+	       sizeof(struct Value) * c->n_consts);
+
+	return 0;
+}
+
+int
+Repl_line(
+	struct Repl *r,
+	const char  *line,
+	int          len)
+{
+	int i;
+	int tlen;
+	int first = r->mod.cur->n_instrs;
+	int n_vars = r->s->n_vars;
+	struct Scope *s = r->s;
+	struct Scope *cur = r->mod.cur;
+	const struct Instruction *last;
+	enum TokenizerError te;
+	enum TranslateStatus ts = TS_ok;
+	enum RuntimeStatus rs;
+
+	tlen = Repl_tokenize(r, line, len, &te);
+	r->row++;
+	if (tlen == -1) {
+		return 1;
+	}
+	if (te) {
+		return 0;
+	}
+
+	/* lines never share tmp values, so each starts counting anew,
+	 * but a function is lowered as a whole */
+	if (cur == s) {
+		s->n_tmp_vals = 0;
+	}
+	i = Scope_from_tokens(r->t, tlen, line, cur, &ts);
+	switch (ts) {
+	case TS_new_scope_found:
+		if (Module_append_scope(&r->mod, cur->funcs[cur->n_funcs - 1])) {
+			return 1;
+		}
+		r->mod.cur = r->mod.s[r->mod.slen - 1];
+		return 0;
+
+	case TS_scope_ended:
+		r->mod.cur = cur->parent;
+		return Scope_allocate_tmps_from(cur, 0) ||
+		       Code_from_instructions(&cur->code, cur, 0,
+		                              &r->mod.arena);
+
+	default:
+		break;
+	}
+	if (ts) {
+		cur->n_instrs = first;
+		if (ts == TS_malloc_failed) {
+			return 1;
+		}
+		if (i >= tlen) {
+			i = tlen - 1;
+		}
+		TranslateStatus_print(ts, r->mod.name, r->t[i].row, r->t[i].col);
+		return 0;
+	}
+	/* function bodies only run when called */
+	if (cur != s || s->n_instrs == first) {
+		return 0;
+	}
+
+	/* every function is lowered by now, as none is open */
+	if (Scope_allocate_tmps_from(s, first) ||
+	    Code_from_instructions(&s->code, s, first, &r->mod.arena) ||
+	    Module_link(&r->mod) ||
+	    Repl_fit_frame(r, n_vars)) {
+		s->n_instrs = first;
+		return 1;
+	}
+
+	Code_run(&s->code, s->frame, &r->mod.ic, &rs);
+	if (rs) {
+		RuntimeStatus_print(rs, r->mod.name, s->code.rows[r->mod.ic]);
+		return 0;
+	}
+
+	last = &s->instrs[s->n_instrs - 1];
+	if (last->vals[0].type == OT_var) {
+		i = s->var_names[last->vals[0].idx];
+		printf("%.*s = ",
+		       Interner_name_len(s->names, i),
+		       Interner_name(s->names, i));
+		Value_fprint(&s->frame[last->vals[0].idx], stdout);
+		printf("\n");
+	}
+
+	return 0;
+}
+
+int
+Repl_run(
+	struct Repl *r,
+	FILE        *f)
+{
+	int prompt;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+
+	prompt = isatty(fileno(f));
+
+	while (1) {
+		if (prompt) {
+			printf("> ");
+			fflush(stdout);
+		}
+		len = getline(&line, &size, f);
+		if (len == -1) {
+			break;
+		}
+		if (Repl_line(r, line, len)) {
+			free(line);
+			return 1;
+		}
+		fflush(stdout);
+	}
+
+	if (prompt) {
+		printf("\n");
+	}
+	if (r->mod.cur != r->s) {
+		TranslateStatus_print(TS_expected_scope_end, r->mod.name,
+		                      r->row - 1, 1);
+	}
+	free(line);
+	return 0;
+}
+
+void
+Repl_free(
+	struct Repl *r)
+{
+	free(r->t);
+	r->t = NULL;
+	r->tsize = 0;
+	Module_free(&r->mod);
+}
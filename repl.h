@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#ifndef _REPL_H
+#define _REPL_H
+
+#include <stdio.h>
+
+#include "SVM.h"
+
+/* An interactive session on one live module.
+ * Each line is translated and lowered on its own, appended to the global
+ * scope and run on the values left by the lines before it.
+ * Lines of a function are lowered together, when its scope ends.
+ */
+struct Repl {
+	struct Module mod;
+	struct Scope *s;       /* global scope, its frame holds the values */
+	int           n_regs;  /* values allocated in the frame stack */
+	struct Token *t;       /* of the current line */
+	int           tsize;
+	int           row;     /* of the next line */
+};
+
+/* Returns non zero if malloc failed.
+ */
+int
+Repl_new(
+	struct Repl *r);
+
+/* Runs one line of len characters, holding at most one statement.
+ * Errors and the assigned variable are printed.
+ * A line that fails to translate leaves no instructions behind.
+ * Returns non zero on odd error cases, like mallocs being impossible.
+ */
+int
+Repl_line(
+	struct Repl *r,
+	const char  *line,
+	int          len);
+
+/* Runs lines from f until its end, prompting if it is a terminal.
+ * Returns non zero on odd error cases, like mallocs being impossible.
+ */
+int
+Repl_run(
+	struct Repl *r,
+	FILE        *f);
+
+void
+Repl_free(
+	struct Repl *r);
+
+#endif /* _REPL_H */
@@ -1,12 +1,541 @@
 // SPDX-License-Identifier: LGPL-2.1-only
 // Copyright (C) 2024  Andy Frank Schoknecht
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "tokenize.h"
 #include "SVM.h"
+#include "cache.h"
+#include "emit_c.h"
+#include "optimize.h"
+#include "profile.h"
+#include "repl.h"
+#include "watch.h"
+#include "stats.h"
+
+struct Options {
+	int   stream;
+	int   use_cache;
+	int   emit_c;
+	int   jit_hot_runs;
+	int   opt_level;
+	int   inline_max;
+	int   print_stats;
+	char *tracepath;
+	int   profile;
+	char *foldedpath;
+	int   n_threads; /* 0 for one per core */
+	int   tokenize_threads;
+	int   watch;
+};
+
+enum JobStatus {
+	JS_ok,
+	JS_open_failed,
+	JS_not_a_file,
+	JS_read_failed,
+	JS_tokenize_failed,
+	JS_translate_failed,
+	JS_failed /* odd error cases, like mallocs being impossible */
+};
+
+/* One input file, loaded on any thread, then reported and run in order.
+ */
+struct Job {
+	char                *filepath;
+	char                *filename;
+	int                  idx; /* of the file on the command line */
+	enum JobStatus       status;
+	struct Module        mod;
+	struct Stats         stats;
+	char                *cachepath;
+	enum CacheStatus     cs;
+	enum TokenizerError  te;
+	enum TranslateStatus ts;
+	int                  n_instrs; /* before optimizing */
+};
+
+/* Hands out jobs to worker threads.
+ */
+struct Pool {
+	struct Job           *jobs;
+	int                   n_jobs;
+	int                   next;
+	pthread_mutex_t       lock;
+	const struct Options *opts;
+};
+
+/* Reads a decimal count of at least 0 from str into n.
+ * Returns non zero if str is not such a count.
+ */
+int
+count_from_str(
+	const char *str,
+	int        *n)
+{
+	long l;
+	char *end;
+
+	errno = 0;
+	l = strtol(str, &end, 10);
+	if (end == str || *end != '\0' || errno != 0 || l < 0 || l > INT_MAX) {
+		return 1;
+	}
+	*n = l;
+	return 0;
+}
+
+/* Returns path, with the index of the file appended if there are several.
+ * Returns NULL if malloc failed.
+ */
+char
+*output_path_of(
+	const char *path,
+	int         idx,
+	int         n_files)
+{
+	char *ret;
+
+	ret = malloc(strlen(path) + 16);
+	if (ret == NULL) {
+		return NULL;
+	}
+	if (n_files > 1) {
+		sprintf(ret, "%s.%i", path, idx);
+	} else {
+		strcpy(ret, path);
+	}
+	return ret;
+}
+
+/* Reads, translates, optimizes and lowers one file, or loads it from
+ * its cache, without printing anything.
+ * Only touches the job, so it can run on any thread.
+ */
+void
+Job_load(
+	struct Job           *job,
+	const struct Options *opts)
+{
+	FILE *file;
+	FILE *cachefile;
+	char *tmp;
+	struct Source src;
+	struct Stats *st = NULL;
+
+	job->mod = Module_new(job->filepath);
+	job->stats = Stats_new();
+	job->cachepath = NULL;
+	job->cs = CS_read_failed;
+	job->te = TE_ok;
+	job->ts = TS_ok;
+
+	file = fopen(job->filepath, "r");
+	if (file == NULL) {
+		job->status = JS_open_failed;
+		return;
+	}
+
+	job->filename = job->filepath;
+	while (1) {
+		tmp = strstr(job->filename, "/");
+		if (tmp != NULL) {
+			if (*(tmp + 1) == '\0') {
+				fclose(file);
+				job->status = JS_not_a_file;
+				return;
+			}
+			job->filename = tmp + 1;
+		} else {
+			break;
+		}
+	}
+	job->mod.name = job->filename;
+
+	if (opts->print_stats || opts->tracepath != NULL) {
+		st = &job->stats;
+	}
+
+	if (st != NULL) {
+		Stats_begin(st, "read", NULL);
+	}
+	if (Source_from_file(&src, file)) {
+		fclose(file);
+		Source_free(&src);
+		if (st != NULL) {
+			Stats_end(st, NULL);
+		}
+		job->status = JS_read_failed;
+		return;
+	}
+	fclose(file);
+	if (st != NULL) {
+		Stats_end(st, NULL);
+	}
+
+	/* pipes and devices have no place to keep a cache next to them */
+	if (opts->use_cache && src.mapped) {
+		job->cachepath = Cache_path_of(job->filepath);
+	}
+	cachefile = job->cachepath == NULL ? NULL : fopen(job->cachepath, "rb");
+	if (cachefile != NULL) {
+		if (st != NULL) {
+			Stats_begin(st, "cache load", NULL);
+		}
+		if (Module_from_cache(&job->mod, &src, cachefile, job->filename,
+		                      opts->opt_level, &job->cs)) {
+			fclose(cachefile);
+			Source_free(&src);
+			if (st != NULL) {
+				Stats_end(st, NULL);
+			}
+			job->status = JS_failed;
+			return;
+		}
+		fclose(cachefile);
+		if (st != NULL) {
+			Stats_end(st, NULL);
+		}
+		if (job->cs) {
+			Module_free(&job->mod);
+			job->mod = Module_new(job->filename);
+		}
+	}
+	job->mod.stats = st;
+	job->mod.tokenize_threads = opts->tokenize_threads;
+	job->mod.inline_max = opts->inline_max;
+	if (job->cs == CS_ok) {
+		job->status = JS_ok;
+		return;
+	}
+
+	if ((opts->stream ? Module_from_source_streaming :
+	                    Module_from_source)(&job->mod, &src, job->filename,
+	                                        &job->te, &job->ts)) {
+		job->status = JS_failed;
+		return;
+	}
+
+	if (job->te) {
+		job->status = JS_tokenize_failed;
+		return;
+	}
+	if (job->ts) {
+		job->status = JS_translate_failed;
+		return;
+	}
+
+	job->n_instrs = Module_n_instrs(&job->mod);
+	if (st != NULL) {
+		Stats_begin(st, "optimize", &job->mod.arena);
+	}
+	if (Module_optimize(&job->mod, opts->opt_level)) {
+		if (st != NULL) {
+			Stats_end(st, &job->mod.arena);
+		}
+		job->status = JS_failed;
+		return;
+	}
+	if (st != NULL) {
+		Stats_end(st, &job->mod.arena);
+		Stats_begin(st, "lower", &job->mod.arena);
+	}
+	if (Module_lower(&job->mod)) {
+		if (st != NULL) {
+			Stats_end(st, &job->mod.arena);
+		}
+		job->status = JS_failed;
+		return;
+	}
+	if (st != NULL) {
+		Stats_end(st, &job->mod.arena);
+	}
+
+	/* without a cache, the next run just translates again */
+	if (job->cachepath != NULL && !opts->emit_c) {
+		if (st != NULL) {
+			Stats_begin(st, "cache save", NULL);
+		}
+		Module_save_cache(&job->mod, job->cachepath, opts->opt_level);
+		if (st != NULL) {
+			Stats_end(st, NULL);
+		}
+	}
+
+	job->status = JS_ok;
+}
+
+void
+*Pool_work(
+	void *arg)
+{
+	int i;
+	struct Pool *pool = arg;
+
+	while (1) {
+		pthread_mutex_lock(&pool->lock);
+		i = pool->next;
+		pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (i >= pool->n_jobs) {
+			return NULL;
+		}
+		Job_load(&pool->jobs[i], pool->opts);
+	}
+}
+
+/* Loads all jobs on n_threads threads, the calling one included.
+ * Falls back to fewer threads, if they can not be created.
+ */
+void
+Jobs_load(
+	struct Job           *jobs,
+	int                   n_jobs,
+	int                   n_threads,
+	const struct Options *opts)
+{
+	int i;
+	int n_started;
+	pthread_t *threads;
+	struct Pool pool = {
+		.jobs = jobs,
+		.n_jobs = n_jobs,
+		.next = 0,
+		.opts = opts,
+	};
+
+	if (n_threads > n_jobs) {
+		n_threads = n_jobs;
+	}
+	threads = n_threads > 1 ? malloc(sizeof(pthread_t) * n_threads) : NULL;
+	if (threads == NULL || pthread_mutex_init(&pool.lock, NULL) != 0) {
+		for (i = 0; i < n_jobs; i++) {
+			Job_load(&jobs[i], opts);
+		}
+		free(threads);
+		return;
+	}
+
+	for (n_started = 0; n_started < n_threads - 1; n_started++) {
+		if (pthread_create(&threads[n_started], NULL,
+		                   Pool_work, &pool) != 0) {
+			break;
+		}
+	}
+	Pool_work(&pool);
+	for (i = 0; i < n_started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	pthread_mutex_destroy(&pool.lock);
+	free(threads);
+}
+
+/* Prints how loading went and runs the module, or emits it as C.
+ */
+void
+Job_run(
+	struct Job           *job,
+	int                   n_jobs,
+	const struct Options *opts)
+{
+	char *path;
+	FILE *outfile;
+	long    n_executed;
+	clock_t run_begin;
+	double  run_secs;
+	struct Profile prof = {0};
+	struct Stats *st = job->mod.stats;
+	enum RuntimeStatus rs;
+
+	switch (job->status) {
+	case JS_ok:
+		break;
+
+	case JS_open_failed:
+		fprintf(stderr,
+		        "The given filepath:\n"
+		        "\"%s\"\n"
+		        "is not valid.\n",
+		        job->filepath);
+		return;
+
+	case JS_not_a_file:
+		fprintf(stderr,
+		        "The given filepath:\n"
+		        "\"%s\"\n"
+		        "is not a single file.\n",
+		        job->filepath);
+		return;
+
+	case JS_read_failed:
+		fprintf(stderr, "Reading \"%s\" failed\n", job->filepath);
+		return;
+
+	case JS_tokenize_failed:
+		fprintf(stderr, "Tokenizing failed, cuz you suck lol\n"); // jk
+		return;
+
+	case JS_translate_failed:
+		TranslateStatus_print(job->ts,
+		                      job->filename,
+		                      job->mod.t[job->mod.tc].row,
+		                      job->mod.t[job->mod.tc].col);
+		return;
+
+	case JS_failed:
+		fprintf(stderr, "Whoopsies\n");
+		return;
+	}
+
+	if (job->cs == CS_ok) {
+		printf("loaded %s\n", job->cachepath);
+	} else if (opts->emit_c) {
+		if (Module_emit_c(&job->mod, stdout)) {
+			fprintf(stderr, "Whoopsies\n");
+		}
+		return;
+	} else {
+		printf("-O%i: %i instructions, %i before optimizing\n",
+		       opts->opt_level,
+		       Module_n_instrs(&job->mod),
+		       job->n_instrs);
+		if (opts->print_stats) {
+			Module_fprint_inlined(&job->mod, stderr);
+		}
+	}
+
+	job->mod.jit_hot_runs = opts->jit_hot_runs;
+	if (st != NULL) {
+		Stats_begin(st, "run", &job->mod.arena);
+	}
+	if (opts->profile && Profile_new(&prof, &job->mod.s[0]->code)) {
+		fprintf(stderr, "Whoopsies\n");
+		return;
+	}
+	run_begin = clock();
+	if (opts->profile) {
+		n_executed = Module_run_profiled(&job->mod, &prof, &rs);
+	} else {
+		n_executed = Module_run(&job->mod, &rs);
+	}
+	run_secs = (double) (clock() - run_begin) / CLOCKS_PER_SEC;
+	if (st != NULL) {
+		Stats_end(st, &job->mod.arena);
+	}
+	if (n_executed < 0) {
+		fprintf(stderr, "Whoopsies\n");
+		goto clean;
+	}
+
+	RuntimeStatus_print(rs,
+	                    job->filename,
+	                    job->mod.s[0]->code.rows[job->mod.ic]);
+	if (rs) {
+		goto clean;
+	}
+
+	Module_fprint(&job->mod, stdout);
+	printf("executed %li ops in %f s (%.0f ops/s)\n",
+	       n_executed,
+	       run_secs,
+	       run_secs > 0.0 ? n_executed / run_secs : 0.0);
+
+	/* to stderr, so the output of the script stays as is */
+	if (opts->profile) {
+		Profile_fprint(&prof, &job->mod.src, stderr);
+	}
+	if (opts->foldedpath != NULL) {
+		path = output_path_of(opts->foldedpath, job->idx, n_jobs);
+		outfile = path == NULL ? NULL : fopen(path, "w");
+		if (outfile == NULL ||
+		    Profile_write_folded(&prof, job->filename, outfile)) {
+			fprintf(stderr, "Writing \"%s\" failed\n",
+			        opts->foldedpath);
+		}
+		if (outfile != NULL) {
+			fclose(outfile);
+		}
+		free(path);
+	}
+	if (opts->print_stats) {
+		Stats_fprint(st, &job->mod, stderr);
+	}
+	if (opts->tracepath != NULL) {
+		path = output_path_of(opts->tracepath, job->idx, n_jobs);
+		outfile = path == NULL ? NULL : fopen(path, "w");
+		if (outfile == NULL ||
+		    Stats_write_trace(st, &job->mod, outfile)) {
+			fprintf(stderr, "Writing \"%s\" failed\n",
+			        opts->tracepath);
+		}
+		if (outfile != NULL) {
+			fclose(outfile);
+		}
+		free(path);
+	}
+
+clean:
+	Profile_free(&prof);
+}
+
+void
+Job_free(
+	struct Job *job)
+{
+	free(job->cachepath);
+	Module_free(&job->mod);
+}
+
+/* Runs the interactive mode on stdin.
+ */
+int
+Repl_main(void)
+{
+	int ret = 0;
+	struct Repl repl;
+
+	if (Repl_new(&repl) || Repl_run(&repl, stdin)) {
+		fprintf(stderr, "Whoopsies\n");
+		ret = 1;
+	}
+	Repl_free(&repl);
+	return ret;
+}
+
+/* Runs path again every time it is written.
+ */
+int
+Watch_main(
+	char                 *path,
+	const struct Options *opts)
+{
+	int ret = 0;
+	char *name;
+	struct Watch w;
+
+	name = strrchr(path, '/');
+	name = name == NULL ? path : name + 1;
+
+	if (Watch_new(&w, path, name, opts->opt_level, opts->inline_max,
+	              opts->jit_hot_runs) ||
+	    Watch_run(&w)) {
+		fprintf(stderr, "Whoopsies\n");
+		ret = 1;
+	}
+	Watch_free(&w);
+	return ret;
+}
 
 int
 main(
@@ -14,17 +543,34 @@ main(
 	char *argv[])
 {
 	int i;
-	struct Module mainM;
-	char *filename;
-	char *filepath = NULL;
-	FILE *file;
-	char *tmp;
-	enum TokenizerError  te;
-	enum TranslateStatus ts;
+	int n_jobs = 0;
+	struct Job *jobs;
+	struct Options opts = {
+		.stream = 0,
+		.use_cache = 1,
+		.emit_c = 0,
+		.jit_hot_runs = JIT_HOT_RUNS,
+		.opt_level = OPTIMIZE_LEVEL_DEFAULT,
+		.inline_max = INLINE_MAX_INSTRS,
+		.print_stats = 0,
+		.tracepath = NULL,
+		.profile = 0,
+		.foldedpath = NULL,
+		.n_threads = 0,
+		.tokenize_threads = 1,
+		.watch = 0,
+	};
+
+	jobs = calloc(argc, sizeof(struct Job));
+	if (jobs == NULL) {
+		fprintf(stderr, "Whoopsies\n");
+		return 0;
+	}
 
 	for (i = 1; i < argc; i++) {
 		if (strcmp(argv[i], "-v") == 0) {
 			printf("%s: version %s\n", APP_NAME, APP_VERSION);
+			free(jobs);
 			return 0;
 		} else if (strcmp(argv[i], "-a") == 0) {
 			printf("The source code of \"%s\" v%s is available, "
@@ -37,69 +583,90 @@ main(
 			       APP_LICENSE,
 			       APP_REPO,
 			       APP_LICENSE_URL);
+			free(jobs);
 			return 0;
+		} else if (strcmp(argv[i], "-stream") == 0) {
+			opts.stream = 1;
+		} else if (strcmp(argv[i], "-jit") == 0) {
+			opts.jit_hot_runs = 0;
+		} else if (strcmp(argv[i], "-no-jit") == 0) {
+			opts.jit_hot_runs = -1;
+		} else if (strcmp(argv[i], "-emit-c") == 0) {
+			/* cached modules have no instructions left to emit */
+			opts.emit_c = 1;
+			opts.use_cache = 0;
+		} else if (strcmp(argv[i], "-no-cache") == 0) {
+			opts.use_cache = 0;
+		} else if (strcmp(argv[i], "-O0") == 0) {
+			opts.opt_level = 0;
+		} else if (strcmp(argv[i], "-O1") == 0) {
+			opts.opt_level = 1;
+		} else if (strcmp(argv[i], "-inline") == 0) {
+			i++;
+			if (i >= argc || count_from_str(argv[i], &opts.inline_max)) {
+				fprintf(stderr, "-inline takes a number of "
+				                "instructions\n");
+				free(jobs);
+				return 1;
+			}
+			/* caches are only written with the default threshold */
+			opts.use_cache = 0;
+		} else if (strcmp(argv[i], "-stats") == 0) {
+			opts.print_stats = 1;
+		} else if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc) {
+			i++;
+			opts.tracepath = argv[i];
+		} else if (strcmp(argv[i], "-profile") == 0) {
+			opts.profile = 1;
+		} else if (strcmp(argv[i], "-profile-folded") == 0 &&
+		           i + 1 < argc) {
+			i++;
+			opts.foldedpath = argv[i];
+			opts.profile = 1;
+		} else if (strcmp(argv[i], "-watch") == 0) {
+			opts.watch = 1;
+		} else if (strcmp(argv[i], "-j") == 0) {
+			i++;
+			if (i >= argc || count_from_str(argv[i], &opts.n_threads)) {
+				fprintf(stderr, "-j takes a number of threads\n");
+				free(jobs);
+				return 1;
+			}
 		} else {
-			filepath = argv[i];
+			jobs[n_jobs].filepath = argv[i];
+			jobs[n_jobs].idx = n_jobs;
+			n_jobs++;
 		}
 	}
 
-	if (filepath == NULL) {
-		fprintf(stderr,
-		        "No input file, and interactive mode not yet there\n");
-		return 0;
+	if (n_jobs == 0) {
+		free(jobs);
+		return Repl_main();
 	}
 
-	file = fopen(filepath, "r");
-	if (file == NULL) {
-		fprintf(stderr,
-		        "The given filepath:\n"
-		        "\"%s\"\n"
-		        "is not valid.\n",
-		        filepath);
-		return 0;
-	}
-
-	filename = filepath;
-	while (1) {
-		tmp = strstr(filename, "/");
-		if (tmp != NULL) {
-			if (*(tmp + 1) == '\0') {
-				fprintf(stderr,
-				        "The given filepath:\n"
-				        "\"%s\"\n"
-				        "is not a single file.\n",
-				        filepath);
-				return 0;
-			}
-			filename = tmp + 1;
-		} else {
-			break;
+	if (opts.watch) {
+		i = n_jobs == 1 ? Watch_main(jobs[0].filepath, &opts) : 1;
+		if (n_jobs != 1) {
+			fprintf(stderr, "-watch takes exactly one file\n");
 		}
+		free(jobs);
+		return i;
 	}
 
-	if (Module_from_file(&mainM, file, filename, &te, &ts)) {
-		fprintf(stderr, "Whoopsies\n");
-		goto clean;
+	if (opts.n_threads <= 0) {
+		opts.n_threads = sysconf(_SC_NPROCESSORS_ONLN);
 	}
-
-	if (te) {
-		fprintf(stderr, "Tokenizing failed, cuz you suck lol\n"); // jk
-		goto clean;
+	/* several files already keep the threads busy */
+	if (n_jobs == 1) {
+		opts.tokenize_threads = opts.n_threads;
 	}
+	Jobs_load(jobs, n_jobs, opts.n_threads, &opts);
 
-	TranslateStatus_print(ts,
-	                      filename,
-	                      mainM.t[mainM.tc].row,
-	                      mainM.t[mainM.tc].col);
-	if (ts) {
-		goto clean;
+	for (i = 0; i < n_jobs; i++) {
+		Job_run(&jobs[i], n_jobs, &opts);
+		Job_free(&jobs[i]);
 	}
 
-	Module_fprint(&mainM, stdout);
-
-clean:
-	fclose(file);
-	Module_free(&mainM);
-
+	free(jobs);
 	return 0;
 }
@@ -0,0 +1,230 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats.h"
+#include "SVM.h"
+
+#include <string.h>
+
+/* Memory of a scope, both from the arena and its frame.
+ */
+static size_t
+Scope_n_bytes(
+	const struct Scope *s)
+{
+	size_t ret = sizeof(struct Scope);
+
+	ret += s->lits_size * (sizeof(struct Value) + 2 * sizeof(int));
+	ret += s->vars_size * 3 * sizeof(int);
+	ret += s->instrs_size * sizeof(struct Instruction);
+	if (s->code.ops != NULL) {
+		ret += (s->code.n_ops + 1) * (sizeof(struct Op) + sizeof(int));
+	}
+	if (s->frame != NULL) {
+		ret += s->code.n_regs * sizeof(struct Value);
+	}
+
+	return ret;
+}
+
+static void
+String_json_fprint(
+	const char *str,
+	FILE       *f)
+{
+	fprintf(f, "\"");
+	for (; *str != '\0'; str++) {
+		if (*str == '"' || *str == '\\') {
+			fprintf(f, "\\%c", *str);
+		} else if ((unsigned char) *str < ' ') {
+			fprintf(f, "\\u%04x", (unsigned char) *str);
+		} else {
+			fprintf(f, "%c", *str);
+		}
+	}
+	fprintf(f, "\"");
+}
+
+double
+Stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct Stats
+Stats_new(void)
+{
+	struct Stats ret = {
+		.origin = Stats_now(),
+		.n_phases = 0,
+		.open = NULL,
+	};
+	return ret;
+}
+
+void
+Stats_begin(
+	struct Stats       *st,
+	const char         *name,
+	const struct Arena *arena)
+{
+	int i;
+	struct Phase *p = NULL;
+
+	for (i = 0; i < st->n_phases; i++) {
+		if (strcmp(st->phases[i].name, name) == 0) {
+			p = &st->phases[i];
+			break;
+		}
+	}
+
+	if (p == NULL) {
+		if (st->n_phases == STATS_MAX_PHASES) {
+			st->open = NULL;
+			return;
+		}
+		p = &st->phases[st->n_phases];
+		st->n_phases++;
+		memset(p, 0, sizeof(*p));
+		p->name = name;
+		p->begin = Stats_now() - st->origin;
+	}
+
+	p->spans++;
+	st->open = p;
+	st->open_allocs = arena == NULL ? 0 : arena->n_allocs;
+	st->open_bytes = arena == NULL ? 0 : arena->bytes_allocated;
+	st->open_cpu = clock();
+	st->open_wall = Stats_now();
+}
+
+void
+Stats_end(
+	struct Stats       *st,
+	const struct Arena *arena)
+{
+	struct Phase *p = st->open;
+
+	if (p == NULL) {
+		return;
+	}
+
+	p->wall += Stats_now() - st->open_wall;
+	p->cpu += (double) (clock() - st->open_cpu) / CLOCKS_PER_SEC;
+	if (arena != NULL) {
+		p->n_allocs += arena->n_allocs - st->open_allocs;
+		p->bytes += arena->bytes_allocated - st->open_bytes;
+	}
+	st->open = NULL;
+}
+
+void
+Stats_fprint(
+	const struct Stats  *st,
+	const struct Module *mod,
+	FILE                *f)
+{
+	int i;
+	const struct Phase *p;
+	const struct Scope *s;
+
+	fprintf(f, "%-20s %10s %10s %10s %12s\n",
+	        "phase", "wall ms", "cpu ms", "allocs", "bytes");
+	for (i = 0; i < st->n_phases; i++) {
+		p = &st->phases[i];
+		fprintf(f, "%-20s %10.3f %10.3f %10lu %12lu\n",
+		        p->name, p->wall * 1e3, p->cpu * 1e3,
+		        (unsigned long) p->n_allocs, (unsigned long) p->bytes);
+	}
+
+	fprintf(f, "tokens %i, scopes %i, arena %lu bytes in %lu blocks\n",
+	        mod->n_tokens, mod->slen,
+	        (unsigned long) mod->arena.bytes_allocated,
+	        (unsigned long) mod->arena.n_blocks);
+
+	fprintf(f, "%-20s %12s %8s %8s %8s %8s %10s\n",
+	        "scope", "translate ms", "instrs", "ops", "consts", "tmps",
+	        "bytes");
+	for (i = 0; i < mod->slen; i++) {
+		s = mod->s[i];
+		/* nested scopes have no name */
+		if (s->name == NULL) {
+			fprintf(f, "#%-19i", i);
+		} else {
+			fprintf(f, "%-20s", s->name);
+		}
+		fprintf(f, " %12.3f %8i %8i %8i %8i %10lu\n",
+		        s->translate_secs * 1e3, s->n_instrs, s->code.n_ops,
+		        s->code.n_consts, s->code.n_tmps,
+		        (unsigned long) Scope_n_bytes(s));
+	}
+}
+
+int
+Stats_write_trace(
+	const struct Stats  *st,
+	const struct Module *mod,
+	FILE                *f)
+{
+	int i;
+	double ts = 0;
+	const struct Phase *p;
+	const struct Scope *s;
+
+	fprintf(f, "{\"traceEvents\": [\n"
+	           "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+	           "\"tid\": 1, \"args\": {\"name\": \"phases\"}},\n"
+	           "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+	           "\"tid\": 2, \"args\": {\"name\": \"scopes\"}}");
+
+	for (i = 0; i < st->n_phases; i++) {
+		p = &st->phases[i];
+		fprintf(f, ",\n{\"name\": ");
+		String_json_fprint(p->name, f);
+		fprintf(f, ", \"cat\": \"phase\", \"ph\": \"X\", "
+		           "\"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": 1, "
+		           "\"args\": {\"cpu_us\": %.3f, \"allocs\": %lu, "
+		           "\"bytes\": %lu, \"spans\": %i}}",
+		        p->begin * 1e6, p->wall * 1e6, p->cpu * 1e6,
+		        (unsigned long) p->n_allocs, (unsigned long) p->bytes,
+		        p->spans);
+
+		if (strcmp(p->name, "translate") == 0) {
+			ts = p->begin;
+		}
+	}
+
+	/* scopes are translated interleaved, so their times are summed up
+	 * and laid out one after another from the begin of translating */
+	for (i = 0; i < mod->slen; i++) {
+		s = mod->s[i];
+		if (s->name == NULL) {
+			fprintf(f, ",\n{\"name\": \"#%i\"", i);
+		} else {
+			fprintf(f, ",\n{\"name\": ");
+			String_json_fprint(s->name, f);
+		}
+		fprintf(f, ", \"cat\": \"scope\",\"ph\": \"X\", "
+		           "\"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": 2, "
+		           "\"args\": {\"instrs\": %i, \"ops\": %i, "
+		           "\"consts\": %i, \"tmps\": %i, \"vars\": %i, "
+		           "\"bytes\": %lu}}",
+		        ts * 1e6, s->translate_secs * 1e6,
+		        s->n_instrs, s->code.n_ops, s->code.n_consts,
+		        s->code.n_tmps, s->code.n_vars,
+		        (unsigned long) Scope_n_bytes(s));
+		ts += s->translate_secs;
+	}
+
+	fprintf(f, "\n],\n\"otherData\": {\"module\": ");
+	String_json_fprint(mod->name, f);
+	fprintf(f, ", \"tokens\": %i, \"arena_bytes\": %lu}}\n",
+	        mod->n_tokens, (unsigned long) mod->arena.bytes_allocated);
+
+	return ferror(f);
+}
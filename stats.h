@@ -0,0 +1,89 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "arena.h"
+
+#define STATS_MAX_PHASES 16
+
+struct Module;
+
+/* Time and arena allocations of one phase of loading or running a module.
+ * A phase that is entered again, like when streaming,
+ * adds up and keeps its first begin.
+ */
+struct Phase {
+	const char *name;
+	int         spans;    /* times entered */
+	double      begin;    /* wall secs since Stats_new */
+	double      wall;     /* secs */
+	double      cpu;      /* secs */
+	size_t      n_allocs; /* from the arena */
+	size_t      bytes;
+};
+
+/* Collects phases while a module is loaded and run.
+ * Only one phase is open at a time.
+ */
+struct Stats {
+	double        origin;
+	int           n_phases;
+	struct Phase  phases[STATS_MAX_PHASES];
+	struct Phase *open;
+	double        open_wall;
+	clock_t       open_cpu;
+	size_t        open_allocs;
+	size_t        open_bytes;
+};
+
+/* Returns seconds of a monotonic wall clock.
+ */
+double
+Stats_now(void);
+
+struct Stats
+Stats_new(void);
+
+/* Opens the phase called name, a static string.
+ * Allocations are counted from arena, which may be NULL.
+ * Phases beyond STATS_MAX_PHASES are not recorded.
+ */
+void
+Stats_begin(
+	struct Stats       *st,
+	const char         *name,
+	const struct Arena *arena);
+
+/* Closes the open phase.
+ * The arena must be the one given to Stats_begin.
+ */
+void
+Stats_end(
+	struct Stats       *st,
+	const struct Arena *arena);
+
+/* Prints a table of all phases, followed by the sizes of each scope.
+ */
+void
+Stats_fprint(
+	const struct Stats  *st,
+	const struct Module *mod,
+	FILE                *f);
+
+/* Writes all phases and scopes as Chrome trace events,
+ * see chrome://tracing or https://ui.perfetto.dev.
+ * Returns non zero if writing failed.
+ */
+int
+Stats_write_trace(
+	const struct Stats  *st,
+	const struct Module *mod,
+	FILE                *f);
+
+#endif /* _STATS_H */
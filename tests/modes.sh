@@ -0,0 +1,90 @@
+#!/bin/sh
+# SPDX-License-Identifier: LGPL-2.1-only
+# Copyright (C) 2024  Andy Frank Schoknecht
+
+# Runs each tests/*.son in every mode of sonne, and compares the
+# variables and errors it prints with tests/*.out.
+# A tests/*.ops lists opcodes, that the -O0 code of the script must use,
+# so that the paths they take are known to be run.
+# With CC set, the output of -emit-c is compiled and compared too.
+# usage: tests/modes.sh SONNE
+
+sonne=$1
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+failed=0
+
+# keeps the variables and errors of a run, and sanitizer reports
+results() {
+	grep -E '^var |\.son:[0-9]+(:[0-9]+)?: |Sanitizer|runtime error'
+}
+
+# compares $tmp/got with file $1, for the run named $2
+check() {
+	if ! diff -u "$1" "$tmp/got" > "$tmp/diff"; then
+		echo "FAIL: $2"
+		cat "$tmp/diff"
+		failed=1
+	fi
+}
+
+for son in "$dir"/*.son; do
+	out=${son%.son}.out
+	for mode in "-O0 -no-jit" "-O1 -no-jit" "-inline 0 -no-jit" \
+	            "-O0 -jit" "-O1 -jit" "-inline 0 -jit" "-O0" "-stream"; do
+		$sonne -no-cache $mode "$son" 2>&1 | results > "$tmp/got"
+		check "$out" "$son $mode"
+	done
+	if [ -f "${son%.son}.ops" ]; then
+		$sonne -no-cache -O0 -no-jit "$son" > "$tmp/dump"
+		for oc in $(cat "${son%.son}.ops"); do
+			if ! grep -Eq "^ +[0-9]+: $oc " "$tmp/dump"; then
+				echo "FAIL: $son -O0 does not use $oc"
+				failed=1
+			fi
+		done
+	fi
+	if [ -z "$CC" ]; then
+		continue
+	fi
+	for mode in "-O0" "-inline 0"; do
+		: > "$tmp/got"
+		$sonne -no-cache $mode -emit-c "$son" > "$tmp/son.c" &&
+		$CC -std=c99 -Wall -Werror -o "$tmp/son" "$tmp/son.c" -lm &&
+		"$tmp/son" 2>&1 | results > "$tmp/got"
+		check "$out" "$son $mode -emit-c"
+	done
+done
+
+# a text long enough to be tokenized in chunks on several threads,
+# which must read the same as the chunks of -stream and one thread
+awk 'BEGIN {
+	print "sq(a) {\n\treturn a * a\n}"
+	print "alpha = 1\naveryveryverylongidentifierthatspansblocks = 0"
+	for (i = 0; i < 4000; i++) {
+		print "alpha = alpha + 3 # " i
+		print "\t\tbeta   =   sq(alpha % 7) - 2.5"
+		print "gamma = beta * 0.5 + averyveryverylongidentifierthatspansblocks"
+		print "averyveryverylongidentifierthatspansblocks = " i % 10
+	}
+}' > "$tmp/big.son"
+$sonne -no-cache -O0 -j 1 "$tmp/big.son" 2>&1 | results > "$tmp/one"
+if ! grep -q '^var gamma' "$tmp/one"; then
+	echo "FAIL: big.son does not run"
+	failed=1
+fi
+for mode in "-j 4" "-stream"; do
+	$sonne -no-cache -O0 $mode "$tmp/big.son" 2>&1 | results > "$tmp/got"
+	check "$tmp/one" "big.son $mode"
+done
+
+# files run on several threads, so their output is compared sorted
+$sonne -no-cache -j 4 "$dir"/*.son 2>&1 | results | sort > "$tmp/got"
+cat "$dir"/*.out | sort > "$tmp/all"
+check "$tmp/all" "-j 4"
+
+if [ $failed -eq 0 ]; then
+	echo "$sonne: all modes agree"
+fi
+exit $failed
@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+/* Runs the same programs of libsonne on several threads at once,
+ * each with its own runs, and checks every result.
+ * Built with -fsanitize=thread by make check, which reports any race.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../libsonne.h"
+
+#define N_THREADS 8
+#define N_RUNS    200
+
+static const char TEXT[] =
+	"sq(a) {\n"
+	"\treturn a * a\n"
+	"}\n"
+	"cube(a) {\n"
+	"\treturn sq(a) * a\n"
+	"}\n"
+	"x = 3\n"
+	"y = sq(x) + 4 * x\n"
+	"z = cube(y) % 5\n"
+	"w = x * 2.5 - 0.5 + 7.5 % 2.0\n"
+	"u = sq(0.5) * x\n";
+
+/* Ints are compared as float, which holds all of them exactly.
+ */
+struct Expected {
+	const char *name;
+	float       v;
+};
+
+static const struct Expected EXPECTED[] = {
+	{"x", 3},
+	{"y", 21},
+	{"z", 1},
+	{"w", 8.5},
+	{"u", 0.75},
+};
+
+#define N_EXPECTED ((int) (sizeof(EXPECTED) / sizeof(EXPECTED[0])))
+
+/* Returns amount of wrong results of n runs of p.
+ */
+static int
+check_runs(
+	const struct SonneProgram *p,
+	int                        n)
+{
+	int i;
+	int k;
+	float v;
+	int n_wrong = 0;
+	struct SonneError err;
+	struct SonneRun *r;
+
+	r = SonneRun_new(p);
+	if (r == NULL) {
+		return 1;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (SonneRun_exec(r, &err)) {
+			n_wrong++;
+			continue;
+		}
+		for (k = 0; k < N_EXPECTED; k++) {
+			if (SonneRun_get_float(r, EXPECTED[k].name,
+			                       &v) != SS_ok ||
+			    v != EXPECTED[k].v) {
+				n_wrong++;
+			}
+		}
+	}
+	if (SonneRun_get_float(r, "nope", &v) != SS_unknown_variable) {
+		n_wrong++;
+	}
+
+	SonneRun_free(r);
+	return n_wrong;
+}
+
+struct Worker {
+	pthread_t                  thread;
+	const struct SonneProgram *p;
+	int                        started;
+	int                        n_wrong;
+};
+
+static void
+*Worker_run(
+	void *arg)
+{
+	struct Worker *w = arg;
+
+	w->n_wrong = check_runs(w->p, N_RUNS);
+	return NULL;
+}
+
+/* Returns non zero if any thread got a wrong result.
+ */
+static int
+check_program(
+	int opt_level,
+	int jit)
+{
+	int i;
+	int n_wrong = 0;
+	struct SonneError err;
+	struct SonneProgram *p;
+	struct Worker workers[N_THREADS];
+
+	p = SonneProgram_compile(TEXT, strlen(TEXT), opt_level, jit, &err);
+	if (p == NULL) {
+		printf("-O%i jit %i: %s\n", opt_level, jit,
+		       SonneStatus_str(err.status));
+		return 1;
+	}
+
+	for (i = 0; i < N_THREADS; i++) {
+		workers[i].p = p;
+		workers[i].n_wrong = 0;
+		workers[i].started = pthread_create(&workers[i].thread, NULL,
+		                                    Worker_run,
+		                                    &workers[i]) == 0;
+	}
+	for (i = 0; i < N_THREADS; i++) {
+		if (!workers[i].started) {
+			n_wrong++;
+			continue;
+		}
+		pthread_join(workers[i].thread, NULL);
+		n_wrong += workers[i].n_wrong;
+	}
+
+	SonneProgram_free(p);
+	printf("-O%i jit %i: %i threads, %i wrong results\n",
+	       opt_level, jit, N_THREADS, n_wrong);
+	return n_wrong != 0;
+}
+
+int
+main(void)
+{
+	int failed = 0;
+
+	failed |= check_program(0, 0);
+	failed |= check_program(0, 1);
+	failed |= check_program(1, 0);
+	failed |= check_program(1, 1);
+
+	return failed;
+}
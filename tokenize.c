@@ -1,22 +1,74 @@
 // SPDX-License-Identifier: LGPL-2.1-only
 // Copyright (C) 2024  Andy Frank Schoknecht
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "tokenize.h"
 
-#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Keeps the rare paths out of Token_from_str.
+ */
+#if defined(__GNUC__)
+#define TOKENIZE_COLD __attribute__((noinline))
+#else
+#define TOKENIZE_COLD
+#endif
+
+#define SOURCE_READ_SIZE 65536
+
+/* Most runs are short, so Token_from_str tests up to this many bytes
+ * inline and only calls out for longer runs.
+ */
+#define SCAN_INLINE_BYTES 8
+#define SCAN_INLINE(cursor, end, is, n)                       \
+	for ((n) = 0;                                         \
+	     (n) < SCAN_INLINE_BYTES && (cursor) < (end) && is(*(cursor)); \
+	     (n)++) {                                         \
+		(cursor)++;                                   \
+	}
 
-#define FILE_LINE_SIZE 128 /* if you have more, stop it, get some help */
-
-char
+/* Lines of a text, tokenized on one thread of Tokens_from_text_parallel.
+ */
+struct TokenChunk {
+	const char         *buf;
+	int                 begin;
+	int                 end;   /* after a line break, or the end of text */
+	int                 last;  /* of the text */
+	struct Token       *t;
+	int                 tsize;
+	int                 tlen;
+	int                 rows;  /* line breaks in the chunk */
+	int                 failed; /* malloc */
+	enum TokenizerError err;
+};
+
+const char
 *Token_from_str(
 	struct Token        *t,
-	char                *cursor,
+	const char          *src,
+	const char          *cursor,
+	const char          *end,
 	enum TokenizerError *err,
 	int row,
 	int col);
 
+/* Like Tokenizer_read, but with statement set, also stops after
+ * the first end of statement.
+ */
+int
+Tokenizer_read_tokens(
+	struct Tokenizer    *tz,
+	struct Token        *t,
+	int                  buflen,
+	int                  statement,
+	enum TokenizerError *err);
+
 void
 ValueType_fprint(
 	enum ValueType vt,
@@ -48,40 +100,254 @@ Value_fprint(
 	}
 }
 
-char
+int
+Value_equal(
+	const struct Value *a,
+	const struct Value *b)
+{
+	return a->type == b->type &&
+	       memcmp(&a->c, &b->c, sizeof(a->c)) == 0;
+}
+
+int
+Source_from_file(
+	struct Source *src,
+	FILE          *f)
+{
+	struct stat st;
+	int size;
+	size_t n;
+	void *map;
+
+	src->buf = NULL;
+	src->len = 0;
+	src->mapped = 0;
+
+	if (fstat(fileno(f), &st) == 0 &&
+	    S_ISREG(st.st_mode) &&
+	    st.st_size > 0 &&
+	    st.st_size <= INT_MAX) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+		           fileno(f), 0);
+		if (map != MAP_FAILED) {
+			src->buf = map;
+			src->len = st.st_size;
+			src->mapped = 1;
+			return 0;
+		}
+	}
+
+	/* not mappable, like pipes, so read it in big blocks */
+	size = 0;
+	do {
+		if (src->len + SOURCE_READ_SIZE > size) {
+			if (size > INT_MAX / 2) {
+				return 1;
+			}
+			size = size == 0 ? SOURCE_READ_SIZE : size * 2;
+			src->buf = realloc(src->buf, size);
+			if (src->buf == NULL) {
+				src->len = 0;
+				return 1;
+			}
+		}
+		n = fread(&src->buf[src->len], 1, SOURCE_READ_SIZE, f);
+		src->len += n;
+	} while (n == SOURCE_READ_SIZE);
+
+	if (ferror(f)) {
+		return 1;
+	}
+
+	return 0;
+}
+
+void
+Source_advise_sequential(
+	struct Source *src)
+{
+	if (src->mapped) {
+		posix_madvise(src->buf, src->len, POSIX_MADV_SEQUENTIAL);
+	}
+}
+
+void
+Source_free(
+	struct Source *src)
+{
+	if (src->mapped) {
+		munmap(src->buf, src->len);
+	} else {
+		free(src->buf);
+	}
+	src->buf = NULL;
+	src->len = 0;
+	src->mapped = 0;
+}
+
+#define IS_BLANK(c)  ((c) == ' ' || (c) == '\t')
+#define IS_DIGIT(c)  ((c) >= '0' && (c) <= '9')
+#define IS_LETTER(c) (((c) >= 'A' && (c) <= 'Z') || ((c) >= 'a' && (c) <= 'z'))
+
+/* Defines a function that returns the first position at or after
+ * cursor, that is not part of the run, or end.
+ */
+#define SCAN_RUN(name, is)               \
+static const char                        \
+*name(                                   \
+	const char *cursor,              \
+	const char *end)                 \
+{                                        \
+	while (cursor < end && is(*cursor)) { \
+		cursor++;                \
+	}                                \
+	return cursor;                   \
+}
+
+SCAN_RUN(scan_blanks, IS_BLANK)
+SCAN_RUN(scan_digits, IS_DIGIT)
+SCAN_RUN(scan_letters, IS_LETTER)
+
+void
+Tokenizer_init(
+	struct Tokenizer *tz,
+	const char       *buf,
+	int               len)
+{
+	tz->buf = buf;
+	tz->len = len;
+	tz->pos = 0;
+	tz->row = 1;
+	tz->row_begin = 0;
+	tz->done = 0;
+}
+
+TOKENIZE_COLD static const char
+*Token_from_comment(
+	struct Token *t,
+	const char   *src,
+	const char   *cursor,
+	const char   *end)
+{
+	const char *begin = cursor;
+
+	/* memchr is vectorized by the libc already */
+	cursor = memchr(cursor, '\n', end - cursor);
+	if (cursor == NULL) {
+		cursor = end;
+	}
+
+	t->type = TT_comment;
+	t->c.comment.off = begin - src;
+	t->c.comment.len = cursor - begin;
+	return cursor;
+}
+
+TOKENIZE_COLD static const char
+*Token_from_long_identifier(
+	struct Token *t,
+	const char   *src,
+	const char   *begin,
+	const char   *cursor,
+	const char   *end)
+{
+	cursor = scan_letters(cursor, end);
+
+	t->type = TT_identifier;
+	t->c.identifier.off = begin - src;
+	t->c.identifier.len = cursor - begin;
+	return cursor;
+}
+
+/* Reads a float literal like 2.5 at cursor into t.
+ * Digits beyond what a double holds are ignored.
+ */
+TOKENIZE_COLD static const char
+*Token_read_float(
+	struct Token *t,
+	const char   *cursor,
+	const char   *end)
+{
+	double d = 0;
+	double scale = 1;
+
+	for (; IS_DIGIT(*cursor); cursor++) {
+		d = d * 10 + (*cursor - '0');
+	}
+	cursor++; /* '.' */
+	for (; cursor < end && IS_DIGIT(*cursor); cursor++) {
+		if (scale < 1e300) {
+			d = d * 10 + (*cursor - '0');
+			scale *= 10;
+		}
+	}
+
+	t->c.literal.type = VT_float;
+	t->c.literal.c.f = d / scale;
+	return cursor;
+}
+
+/* Adds the digits at cursor to the literal of t,
+ * or reads a float literal, if the digits are followed by a fraction.
+ */
+TOKENIZE_COLD static const char
+*Token_read_digits(
+	struct Token        *t,
+	const char          *cursor,
+	const char          *end,
+	enum TokenizerError *err)
+{
+	int n;
+	int digit;
+	const char *run_end = cursor;
+
+	SCAN_INLINE(run_end, end, IS_DIGIT, n);
+	if (n == SCAN_INLINE_BYTES) {
+		run_end = scan_digits(run_end, end);
+	}
+	if (end - run_end >= 2 && run_end[0] == '.' && IS_DIGIT(run_end[1])) {
+		return Token_read_float(t, cursor, end);
+	}
+
+	for (; cursor < run_end; cursor++) {
+		digit = *cursor - '0';
+		if (t->c.literal.c.i > (INT_MAX - digit) / 10) {
+			*err = TE_int_read_failed;
+		} else {
+			t->c.literal.c.i = t->c.literal.c.i * 10 + digit;
+		}
+	}
+
+	return cursor;
+}
+
+const char
 *Token_from_str(
 	struct Token        *t,
-	char                *cursor,
+	const char          *src,
+	const char          *cursor,
+	const char          *end,
 	enum TokenizerError *err,
 	int row,
 	int col)
 {
-	char *begin;
-	int read_len;
-	char tmp;
+	const char *begin;
+	int n;
 
 	t->row = row;
 	t->col = col;
 
+	if (cursor >= end) {
+		t->type = TT_separator;
+		t->c.separator = '\n';
+		return cursor;
+	}
+
 	switch (*cursor) {
 	case '#':
-		begin = cursor;
-		while (*cursor != '\n' && *cursor != '\0') {
-			cursor++;
-		}
-		read_len = (cursor - begin);
-
-		t->type = TT_comment;
-		t->c.comment = malloc(read_len + 1);
-		if (t->c.comment == NULL) {
-			*err = TE_malloc_failed;
-			return cursor;
-		}
-		t->c.comment[read_len] = '\0';
-		strncpy(t->c.comment, begin, read_len);
-		return cursor;
+		return Token_from_comment(t, src, cursor, end);
 		break;
-	
+
 	case '=':
 	case '+':
 	case '-':
@@ -99,14 +365,9 @@ char
 	case '{':
 	case '}':
 	case ',':
-		t->c.separator = *cursor;
-		goto after_separator_assignment;
 	case '\n':
-	case '\0':
-		t->c.separator = '\n';
-
-after_separator_assignment:
 		t->type = TT_separator;
+		t->c.separator = *cursor;
 		cursor++;
 		return cursor;
 		break;
@@ -115,51 +376,40 @@ after_separator_assignment:
 		break;
 	}
 
+	/* long runs leave through tail calls,
+	 * so that the common path needs no stack frame */
 	begin = cursor;
-	while (*cursor == ' ' || *cursor == '\t') {
-		cursor++;
-	}
+	SCAN_INLINE(cursor, end, IS_BLANK, n);
 	if (cursor > begin) {
 		t->type = TT_whitespace;
+		if (n == SCAN_INLINE_BYTES) {
+			return scan_blanks(cursor, end);
+		}
 		return cursor;
 	}
 
-	begin = cursor;
-	while (*cursor >= '0' && *cursor <= '9') {
-		cursor++;
-	}
-	if (cursor > begin) {
+	if (IS_DIGIT(*cursor)) {
 		t->type = TT_literal;
-
-		tmp = *cursor;
-		*cursor = '\0';
 		t->c.literal.type = VT_int;
-		errno = 0;
-		t->c.literal.c.i = strtol(begin, NULL, 10);
-		if (errno) {
-			*err = TE_int_read_failed;
-		}
-		*cursor = tmp;
-
-		return cursor;
+		t->c.literal.c.i = 0;
+		return Token_read_digits(t, cursor, end, err);
 	}
 
 	begin = cursor;
-	while ((*cursor >= 'A' && *cursor <= 'Z') ||
-	       (*cursor >= 'a' && *cursor <= 'z')) {
-		cursor++;
+	SCAN_INLINE(cursor, end, IS_LETTER, n);
+	if (n == SCAN_INLINE_BYTES) {
+		return Token_from_long_identifier(t, src, begin, cursor, end);
 	}
 	if (cursor > begin) {
-		read_len = (cursor - begin);
-
-		t->type = TT_identifier;
-		t->c.identifier = malloc(read_len + 1);
-		if (t->c.identifier == NULL) {
-			*err = TE_malloc_failed;
+		/* keywords are short, so long identifiers never are one */
+		if (cursor - begin == 6 && memcmp(begin, "return", 6) == 0) {
+			t->type = TT_keyword;
+			t->c.keyword = KW_return;
 			return cursor;
 		}
-		t->c.identifier[read_len] = '\0';
-		strncpy(t->c.identifier, begin, read_len);
+		t->type = TT_identifier;
+		t->c.identifier.off = begin - src;
+		t->c.identifier.len = cursor - begin;
 		return cursor;
 	}
 
@@ -170,15 +420,18 @@ after_separator_assignment:
 void
 Token_fprint(
 	const struct Token *t,
+	const char *src,
 	FILE *f)
 {
 	switch (t->type) {
 	case TT_comment:
-		fprintf(f, "TT_comment(%s)", t->c.comment);
+		fprintf(f, "TT_comment(%.*s)",
+		        t->c.comment.len, &src[t->c.comment.off]);
 		break;
 
 	case TT_identifier:
-		fprintf(f, "TT_identifier(%s)", t->c.identifier);
+		fprintf(f, "TT_identifier(%.*s)",
+		        t->c.identifier.len, &src[t->c.identifier.off]);
 		break;
 
 	case TT_keyword:
@@ -205,71 +458,224 @@ Token_fprint(
 	}
 }
 
-void
-Token_free(
-	struct Token *t)
+int
+Tokenizer_read(
+	struct Tokenizer    *tz,
+	struct Token        *t,
+	int                  buflen,
+	enum TokenizerError *err)
 {
-	switch (t->type) {
-	case TT_comment:
-		free(t->c.comment);
-		break;
-	case TT_identifier:
-		free(t->c.identifier);
-		break;
-	default:
-		break;
-	}
+	return Tokenizer_read_tokens(tz, t, buflen, 0, err);
 }
 
 int
-Tokens_from_file(
-	FILE                *f,
+Tokenizer_read_statement(
+	struct Tokenizer    *tz,
 	struct Token        *t,
 	int                  buflen,
 	enum TokenizerError *err)
 {
-	char                *cursor;
-	int                  i = 0;
-	int                  row;
-	int                  col;
-	char                 line[FILE_LINE_SIZE];
-	int                  file_done = 0;
-	int                  row_done = 0;
-
-	for (row = 1; !file_done; row++) {
-		errno = 0;
-		line[0] = '\0';
-		fgets(line, FILE_LINE_SIZE, f);
-		if (feof(f)) {
-			file_done = 1;
-		}
-		if (errno != 0) {
-			*err = TE_file_read_failed;
+	return Tokenizer_read_tokens(tz, t, buflen, 1, err);
+}
+
+int
+Tokenizer_read_tokens(
+	struct Tokenizer    *tz,
+	struct Token        *t,
+	int                  buflen,
+	int                  statement,
+	enum TokenizerError *err)
+{
+	const char *cursor = &tz->buf[tz->pos];
+	const char *end = &tz->buf[tz->len];
+	int         i;
+
+	*err = TE_ok;
+
+	for (i = 0; !tz->done; i++) {
+		if (i >= buflen) {
+			*err = TE_tbuf_too_small;
 			return i;
 		}
 
-		*err = TE_ok;
-		cursor = line;
-		row_done = 0;
-		for (; !row_done; i++) {
-			if (i >= buflen) {
-				*err = TE_tbuf_too_small;
-				return i;
-			}
+		if (cursor >= end) {
+			/* text always ends with a statement end */
+			Token_from_str(&t[i], tz->buf, cursor, end, err,
+			               tz->row, tz->pos - tz->row_begin);
+			tz->done = 1;
+			continue;
+		}
 
-			col = cursor - line;
-			cursor = Token_from_str(&t[i], cursor, err, row, col);
-			if (*err) {
-				return i;
+		cursor = Token_from_str(&t[i], tz->buf, cursor, end, err,
+		                        tz->row, tz->pos - tz->row_begin);
+		if (*err) {
+			return i;
+		}
+		tz->pos = cursor - tz->buf;
+
+		if (t[i].type == TT_separator &&
+		    t[i].c.separator == '\n') {
+			tz->row++;
+			tz->row_begin = tz->pos;
+			if (statement) {
+				return i + 1;
 			}
-			
-			if (t[i].type == TT_separator &&
-			    t[i].c.separator == '\n') {
-				row_done = 1;
+		}
+	}
+
+	return i;
+}
+
+/* Tokenizes one chunk as if it was the whole text, starting at row 1.
+ */
+static void
+*TokenChunk_read(
+	void *arg)
+{
+	struct TokenChunk *c = arg;
+	struct Tokenizer tz;
+	struct Token *grown;
+
+	tz.buf = c->buf;
+	tz.len = c->end;
+	tz.pos = c->begin;
+	tz.row = 1;
+	tz.row_begin = c->begin;
+	tz.done = 0;
+
+	c->tsize = 64 + (c->end - c->begin) / 4;
+	c->t = malloc(sizeof(struct Token) * c->tsize);
+	if (c->t == NULL) {
+		c->failed = 1;
+		return NULL;
+	}
+
+	do {
+		if (c->err == TE_tbuf_too_small) {
+			grown = realloc(c->t, sizeof(struct Token) * c->tsize * 2);
+			if (grown == NULL) {
+				c->failed = 1;
+				return NULL;
 			}
+			c->t = grown;
+			c->tsize *= 2;
 		}
+		c->tlen += Tokenizer_read(&tz, &c->t[c->tlen],
+		                          c->tsize - c->tlen, &c->err);
+	} while (c->err == TE_tbuf_too_small);
+
+	/* only the text, not each chunk, ends with an extra statement end */
+	if (c->err == TE_ok && !c->last) {
+		c->tlen--;
 	}
+	c->rows = tz.row - 1;
+	return NULL;
+}
+
+int
+Tokens_from_text_parallel(
+	const char          *buf,
+	int                  len,
+	int                  n_threads,
+	struct Arena        *arena,
+	struct Token       **t,
+	int                 *tsize,
+	enum TokenizerError *err)
+{
+	int i;
+	int k;
+	int n_chunks = 0;
+	int begin = 0;
+	int end;
+	int row = 0;
+	int ret = 0;
+	const char *nl;
+	struct TokenChunk *chunks;
+	pthread_t *threads;
+	char *started;
 
 	*err = TE_ok;
-	return i;
+	if (n_threads < 1) {
+		n_threads = 1;
+	}
+
+	chunks = calloc(n_threads, sizeof(struct TokenChunk));
+	threads = calloc(n_threads, sizeof(pthread_t));
+	started = calloc(n_threads, 1);
+	if (chunks == NULL || threads == NULL || started == NULL) {
+		free(chunks);
+		free(threads);
+		free(started);
+		return -1;
+	}
+
+	/* each chunk ends right after a line break,
+	 * so no token is split and statements stay whole */
+	for (i = 0; i < n_threads && begin < len; i++) {
+		end = (long) len * (i + 1) / n_threads;
+		if (end < begin) {
+			end = begin;
+		}
+		nl = end < len ? memchr(&buf[end], '\n', len - end) : NULL;
+		end = i == n_threads - 1 || nl == NULL ? len : nl - buf + 1;
+
+		chunks[n_chunks].buf = buf;
+		chunks[n_chunks].begin = begin;
+		chunks[n_chunks].end = end;
+		n_chunks++;
+		begin = end;
+	}
+	if (n_chunks == 0) {
+		n_chunks = 1;
+		chunks[0].buf = buf;
+	}
+	chunks[n_chunks - 1].last = 1;
+
+	for (i = 1; i < n_chunks; i++) {
+		started[i] = pthread_create(&threads[i], NULL,
+		                            TokenChunk_read, &chunks[i]) == 0;
+	}
+	TokenChunk_read(&chunks[0]);
+	for (i = 1; i < n_chunks; i++) {
+		if (started[i]) {
+			pthread_join(threads[i], NULL);
+		} else {
+			TokenChunk_read(&chunks[i]);
+		}
+	}
+
+	*tsize = 1;
+	for (i = 0; i < n_chunks; i++) {
+		*tsize += chunks[i].tlen;
+		if (chunks[i].failed) {
+			ret = -1;
+		}
+	}
+	*t = ret == 0 ? Arena_alloc(arena, sizeof(struct Token) * *tsize) :
+	                NULL;
+	if (*t == NULL) {
+		ret = -1;
+	}
+
+	for (i = 0; i < n_chunks && ret != -1; i++) {
+		for (k = 0; k < chunks[i].tlen; k++) {
+			(*t)[ret] = chunks[i].t[k];
+			(*t)[ret].row += row;
+			ret++;
+		}
+		row += chunks[i].rows;
+
+		if (chunks[i].err) {
+			*err = chunks[i].err;
+			break;
+		}
+	}
+
+	for (i = 0; i < n_chunks; i++) {
+		free(chunks[i].t);
+	}
+	free(chunks);
+	free(threads);
+	free(started);
+	return ret;
 }
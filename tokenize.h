@@ -6,9 +6,16 @@
 
 #include <stdio.h>
 
+#include "arena.h"
+
+/* Texts shorter than this are always tokenized on one thread.
+ */
+#define TOKENIZE_CHUNK_MIN 262144
+
 enum Keyword {
 	KW_int,
-	KW_float
+	KW_float,
+	KW_return
 };
 
 enum ValueType {
@@ -45,9 +52,16 @@ enum TokenType {
 	TT_whitespace
 };
 
+/* Part of a source, see struct Source.
+ */
+struct Slice {
+	int off;
+	int len;
+};
+
 union TokenC {
-	char                 *comment;
-	char                 *identifier;
+	struct Slice          comment;
+	struct Slice          identifier;
 	enum Keyword          keyword;
 	char                  separator;
 	char                  operator;
@@ -71,26 +85,111 @@ Value_fprint(
 	const struct Value *v,
 	FILE *f);
 
+/* Returns non zero if both are of same type and bit pattern.
+ */
+int
+Value_equal(
+	const struct Value *a,
+	const struct Value *b);
+
+/* The whole text of a source file.
+ * Regular files are memory mapped, anything else is read into heap.
+ * The text is not null terminated.
+ */
+struct Source {
+	char *buf;
+	int   len;
+	int   mapped;
+};
+
+/* Returns non zero if the file could not be read.
+ */
+int
+Source_from_file(
+	struct Source *src,
+	FILE          *f);
+
+/* Tells the system the text will be read once, front to back,
+ * so mapped pages can be dropped behind the reader.
+ */
+void
+Source_advise_sequential(
+	struct Source *src);
+
+void
+Source_free(
+	struct Source *src);
+
+/* Holds the position of an ongoing tokenization of a text.
+ */
+struct Tokenizer {
+	const char *buf;
+	int         len;
+	int         pos;
+	int         row;
+	int         row_begin; /* pos of the first character in row */
+	int         done;
+};
+
+void
+Tokenizer_init(
+	struct Tokenizer *tz,
+	const char       *buf,
+	int               len);
+
 void
 Token_fprint(
 	const struct Token *t,
+	const char *src,
 	FILE *f);
 
-void
-Token_free(
-	struct Token *t);
-
-/* f:      file
+/* tz:     tokenizer, which keeps its position between calls
  * t:      token array
  * buflen: amount elemens that can be held by t
  * err:    pointer to error, if function runs as expected writes ok value here
+ * Token slices are offsets into the tokenizer's text.
+ * After the end of text was reached, tz->done is set.
+ * If err is TE_tbuf_too_small, the function can be called again,
+ * to continue where it stopped.
  * Returns amount of read tokens.
  */
 int
-Tokens_from_file(
-	FILE                *f,
+Tokenizer_read(
+	struct Tokenizer    *tz,
 	struct Token        *t,
 	int                  buflen,
 	enum TokenizerError *err);
 
+/* Like Tokenizer_read, but stops after the first end of statement,
+ * which then is the last token in t.
+ * If err is TE_tbuf_too_small, the statement continues in the next call.
+ */
+int
+Tokenizer_read_statement(
+	struct Tokenizer    *tz,
+	struct Token        *t,
+	int                  buflen,
+	enum TokenizerError *err);
+
+/* Tokenizes a whole text, with the same result as calling Tokenizer_read
+ * until done.
+ * The text is split at line breaks into up to n_threads chunks,
+ * which are tokenized on their own threads and then stitched together,
+ * with rows counted on from the chunks before.
+ * t:      receives the tokens, allocated from arena
+ * tsize:  receives the capacity of t
+ * err:    pointer to error, if function runs as expected writes ok value here
+ * On errors, t ends with the last token before the error.
+ * Returns amount of read tokens, or -1 if malloc failed.
+ */
+int
+Tokens_from_text_parallel(
+	const char          *buf,
+	int                  len,
+	int                  n_threads,
+	struct Arena        *arena,
+	struct Token       **t,
+	int                 *tsize,
+	enum TokenizerError *err);
+
 #endif /* _TOKENIZE_H */
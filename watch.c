@@ -0,0 +1,808 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "watch.h"
+#include "optimize.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+int
+Watch_new(
+	struct Watch *w,
+	char         *path,
+	char         *name,
+	int           opt_level,
+	int           inline_max,
+	int           jit_hot_runs)
+{
+	w->path = path;
+	w->name = name;
+	w->opt_level = opt_level;
+	w->inline_max = inline_max;
+	w->jit_hot_runs = jit_hot_runs;
+	w->tr = Module_new(name);
+	w->tr.names = Interner_new(&w->tr.arena);
+	w->run = Module_new(name);
+	w->n_lines = 0;
+	w->n_translated = 0;
+	w->failed = 0;
+	w->tlen = 0;
+	w->tsize = 64;
+	w->t = malloc(sizeof(struct Token) * w->tsize);
+	w->n_tokenized = 0;
+	w->n_retranslated = 0;
+
+	w->lines_size = 64;
+	w->lines = calloc(w->lines_size, sizeof(struct WatchLine));
+	w->s = Module_add_scope(&w->tr, name, NULL);
+	if (w->lines == NULL || w->t == NULL || w->s == NULL) {
+		return 1;
+	}
+	w->tr.cur = w->s;
+
+	return 0;
+}
+
+/* Returns the last line, that begins within the first n characters
+ * of the current text, the end of text counting as a line.
+ */
+static int
+Watch_line_at(
+	const struct Watch *w,
+	int                 n)
+{
+	int lo = 0;
+	int hi = w->n_lines;
+	int mid;
+
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (w->lines[mid].off <= n) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+
+	return lo;
+}
+
+/* Tokenizes text from begin to end, where a line begins, as line first.
+ * Returns amount of tokens in *t, or -1 if it failed.
+ */
+static int
+Watch_tokenize(
+	const struct Watch *w,
+	const char         *text,
+	int                 begin,
+	int                 end,
+	int                 first,
+	struct Token      **t)
+{
+	int tlen = 0;
+	int tsize = 64 + (end - begin) / 4;
+	struct Tokenizer tz;
+	struct Token *grown;
+	enum TokenizerError te = TE_ok;
+
+	Tokenizer_init(&tz, text, end);
+	tz.pos = begin;
+	tz.row = first + 1;
+	tz.row_begin = begin;
+
+	*t = malloc(sizeof(struct Token) * tsize);
+	if (*t == NULL) {
+		return -1;
+	}
+
+	do {
+		if (te == TE_tbuf_too_small) {
+			grown = realloc(*t, sizeof(struct Token) * tsize * 2);
+			if (grown == NULL) {
+				return -1;
+			}
+			*t = grown;
+			tsize *= 2;
+		}
+		tlen += Tokenizer_read(&tz, &(*t)[tlen], tsize - tlen, &te);
+	} while (te == TE_tbuf_too_small);
+
+	if (te) {
+		printf("%s:%i:%i: Unrecognized token\n",
+		       w->name, tz.row, tz.pos - tz.row_begin);
+		return -1;
+	}
+
+	/* lines keep their own statement ends, the one of the text is extra */
+	return tlen - 1;
+}
+
+/* Translates lines from up to before to, recording where each begins.
+ * On failure, the scope is left as it was before the failing line.
+ * Returns status of the failing line, which is printed, or TS_ok.
+ */
+static enum TranslateStatus
+Watch_translate(
+	struct Watch *w,
+	int           from,
+	int           to)
+{
+	int l;
+	int i;
+	int n;
+	struct Scope *s = w->s;
+	struct WatchLine *line;
+	enum TranslateStatus ts = TS_ok;
+
+	for (l = from; l < to; l++) {
+		line = &w->lines[l];
+		line->instr = s->n_instrs;
+		line->var = s->n_vars;
+		line->lit = s->n_literals;
+		line->tmp = s->n_tmp_vals;
+
+		n = w->lines[l + 1].tok - line->tok;
+		i = Module_translate_tokens(&w->tr, &w->t[line->tok], n, &ts);
+		w->n_retranslated++;
+		if (ts == TS_ok) {
+			continue;
+		}
+
+		Scope_truncate(s, line->instr, line->var, line->lit, line->tmp);
+		w->n_translated = l;
+		if (ts != TS_malloc_failed && n > 0) {
+			if (i >= n) {
+				i = n - 1;
+			}
+			TranslateStatus_print(ts, w->name,
+			                      w->t[line->tok + i].row,
+			                      w->t[line->tok + i].col);
+		}
+		return ts;
+	}
+
+	return TS_ok;
+}
+
+/* Where the saved variables and literals of the unchanged lines went,
+ * after an edit, -1 if not known yet.
+ */
+struct WatchMap {
+	const int          *old_vars;
+	const struct Value *old_lits;
+	int                *vars;
+	int                *lits;
+	int                 var0; /* first saved one */
+	int                 lit0;
+	int                 dtmp;
+};
+
+/* Moves an operand of a saved instruction to the current scope.
+ * Returns 1 if done, 0 if it reads a variable that is not there anymore,
+ * or -1 if malloc failed.
+ */
+static int
+WatchMap_operand(
+	struct WatchMap *m,
+	struct Scope    *s,
+	struct Operand  *o,
+	int              dest)
+{
+	int i;
+
+	switch (o->type) {
+	case OT_tmp:
+		o->idx += m->dtmp;
+		break;
+
+	case OT_literal:
+		if (o->idx < m->lit0) {
+			break;
+		}
+		i = o->idx - m->lit0;
+		if (m->lits[i] == -1) {
+			m->lits[i] = Scope_add_literal(s, m->old_lits[i]);
+			if (m->lits[i] == -1) {
+				return -1;
+			}
+		}
+		o->idx = m->lits[i];
+		break;
+
+	case OT_var:
+		if (o->idx < m->var0) {
+			break;
+		}
+		i = o->idx - m->var0;
+		if (m->vars[i] == -1) {
+			m->vars[i] = Scope_find_var(s, m->old_vars[i]);
+		}
+		if (m->vars[i] == -1) {
+			if (!dest) {
+				return 0;
+			}
+			m->vars[i] = Scope_add_var(s, m->old_vars[i]);
+			if (m->vars[i] == -1) {
+				return -1;
+			}
+		}
+		o->idx = m->vars[i];
+		break;
+
+	case OT_arg:
+	case OT_func:
+		/* only in texts with functions, which are never reused */
+		break;
+	}
+
+	return 1;
+}
+
+/* Appends the translation of the unchanged lines after an edit,
+ * as saved before it, with variables, literals and tmp values moved to
+ * where the edit left them.
+ * This gives what translating them again would, as long as they do not
+ * read a variable, that the edit removed.
+ * old_last: the first unchanged line, as it was before the edit
+ * old_end:  totals before the edit
+ * Returns 1 if it was appended, 0 if not, or -1 if malloc failed.
+ */
+static int
+Watch_reuse(
+	struct Watch             *w,
+	const struct WatchLine   *at,
+	const struct WatchLine   *old_last,
+	const struct WatchLine   *old_end,
+	const int                *old_vars,
+	const struct Value       *old_lits,
+	const struct Instruction *old_instrs,
+	int                       first_reused,
+	int                       drow)
+{
+	int i;
+	int v;
+	int l;
+	int ret = -1;
+	struct Instruction instr;
+	struct WatchLine before;
+	struct WatchLine next;
+	struct Scope *s = w->s;
+	struct WatchMap m = {
+		.old_vars = old_vars,
+		.old_lits = old_lits,
+		.var0 = at->var,
+		.lit0 = at->lit,
+		.dtmp = s->n_tmp_vals - old_last->tmp,
+	};
+
+	before.instr = s->n_instrs;
+	before.var = s->n_vars;
+	before.lit = s->n_literals;
+	before.tmp = s->n_tmp_vals;
+
+	m.vars = malloc(sizeof(int) * (old_end->var - at->var + 1));
+	m.lits = malloc(sizeof(int) * (old_end->lit - at->lit + 1));
+	if (m.vars == NULL || m.lits == NULL) {
+		goto cleanup;
+	}
+	for (i = 0; i < old_end->var - at->var; i++) {
+		m.vars[i] = -1;
+	}
+	for (i = 0; i < old_end->lit - at->lit; i++) {
+		m.lits[i] = -1;
+	}
+
+	/* lines still hold where they began before the edit */
+	next = w->lines[first_reused];
+	for (l = first_reused; l < w->n_lines; l++) {
+		i = next.instr - old_last->instr;
+		s->n_tmp_vals = next.tmp + m.dtmp;
+		next = w->lines[l + 1];
+
+		w->lines[l].instr = s->n_instrs;
+		w->lines[l].var = s->n_vars;
+		w->lines[l].lit = s->n_literals;
+		w->lines[l].tmp = s->n_tmp_vals;
+
+		for (; i < next.instr - old_last->instr; i++) {
+			instr = old_instrs[i];
+			instr.row += drow;
+
+			/* sources are resolved before the destination */
+			for (v = instr.n_vals - 1; v >= 0; v--) {
+				ret = WatchMap_operand(&m, s, &instr.vals[v],
+				                       v == 0);
+				if (ret != 1) {
+					goto failed;
+				}
+			}
+			if (Scope_add_instruction(s, instr)) {
+				ret = -1;
+				goto failed;
+			}
+		}
+	}
+	s->n_tmp_vals = old_end->tmp + m.dtmp;
+	ret = 1;
+	goto cleanup;
+
+failed:
+	Scope_truncate(s, before.instr, before.var, before.lit, before.tmp);
+
+cleanup:
+	free(m.vars);
+	free(m.lits);
+	return ret;
+}
+
+int
+Watch_update(
+	struct Watch *w,
+	char         *text,
+	int           len)
+{
+	int i;
+	int l;
+	int p;
+	int first;
+	int last;
+	int begin;
+	int end;
+	int n_mid = 0;
+	int mid_tlen;
+	int new_n;
+	int drow;
+	int doff;
+	int dtok;
+	int reused = 0;
+	int ret = 1;
+	int old_n = w->n_lines;
+	int old_len = w->tr.src.len;
+	const char *old = w->tr.src.buf;
+	const char *nl;
+	void *grown;
+	struct Token *mid = NULL;
+	int *old_vars = NULL;
+	struct Value *old_lits = NULL;
+	struct Instruction *old_instrs = NULL;
+	struct WatchLine at;
+	struct WatchLine old_last;
+	struct WatchLine old_end;
+	enum TranslateStatus ts;
+
+	/* lines that are wholly the same at the front */
+	for (p = 0; p < len && p < old_len && old[p] == text[p]; p++);
+	first = Watch_line_at(w, p);
+	if (first == old_n && old_n > 0 && old[old_len - 1] != '\n') {
+		first--;
+	}
+	if (first > w->n_translated) {
+		first = w->n_translated;
+	}
+
+	/* lines only record the global scope, so functions are always
+	 * translated again, with everything around them */
+	if (w->tr.slen > 1) {
+		first = 0;
+	}
+
+	/* and at the back, after a line break that is the same too */
+	begin = w->lines[first].off;
+	for (p = 0;
+	     p < old_len - begin && p < len - begin &&
+	     old[old_len - 1 - p] == text[len - 1 - p];
+	     p++);
+	last = Watch_line_at(w, old_len - p) + 1;
+	if (last > old_n) {
+		last = old_n;
+	}
+	end = len - (old_len - w->lines[last].off);
+
+	for (nl = &text[begin];
+	     (nl = memchr(nl, '\n', &text[end] - nl)) != NULL;
+	     nl++) {
+		n_mid++;
+	}
+	if (end > begin && text[end - 1] != '\n') {
+		n_mid++;
+	}
+
+	mid_tlen = Watch_tokenize(w, text, begin, end, first, &mid);
+	if (mid_tlen == -1) {
+		/* the next update compares against the last good text */
+		w->failed = 1;
+		free(mid);
+		free(text);
+		return 0;
+	}
+
+	at = w->lines[first];
+	old_last = w->lines[last];
+	old_end = w->lines[old_n];
+	if (w->n_translated == old_n && old_n > 0 && w->tr.slen == 1) {
+		old_vars = malloc(sizeof(int) * (old_end.var - at.var + 1));
+		old_lits = malloc(sizeof(struct Value) *
+		                  (old_end.lit - at.lit + 1));
+		old_instrs = malloc(sizeof(struct Instruction) *
+		                    (old_end.instr - old_last.instr + 1));
+		if (old_vars == NULL || old_lits == NULL ||
+		    old_instrs == NULL) {
+			goto cleanup;
+		}
+		for (i = 0; i < old_end.var - at.var; i++) {
+			old_vars[i] = w->s->var_names[at.var + i];
+		}
+		for (i = 0; i < old_end.lit - at.lit; i++) {
+			old_lits[i] = w->s->literals[at.lit + i];
+		}
+		for (i = 0; i < old_end.instr - old_last.instr; i++) {
+			old_instrs[i] = w->s->instrs[old_last.instr + i];
+		}
+	}
+
+	/* splice the new lines between the unchanged ones */
+	new_n = first + n_mid + (old_n - last);
+	if (new_n + 1 > w->lines_size) {
+		grown = realloc(w->lines, sizeof(struct WatchLine) * (new_n + 1) * 2);
+		if (grown == NULL) {
+			goto cleanup;
+		}
+		w->lines = grown;
+		w->lines_size = (new_n + 1) * 2;
+	}
+	i = at.tok + mid_tlen + (w->tlen - old_last.tok);
+	if (i > w->tsize) {
+		grown = realloc(w->t, sizeof(struct Token) * i * 2);
+		if (grown == NULL) {
+			goto cleanup;
+		}
+		w->t = grown;
+		w->tsize = i * 2;
+	}
+
+	drow = first + n_mid - last;
+	doff = len - old_len;
+	dtok = at.tok + mid_tlen - old_last.tok;
+
+	/* edits within a line often leave the rest where it was */
+	if (drow != 0) {
+		memmove(&w->lines[first + n_mid], &w->lines[last],
+		        sizeof(struct WatchLine) * (old_n - last + 1));
+	}
+	if (dtok != 0) {
+		memmove(&w->t[at.tok + mid_tlen], &w->t[old_last.tok],
+		        sizeof(struct Token) * (w->tlen - old_last.tok));
+	}
+	memcpy(&w->t[at.tok], mid, sizeof(struct Token) * mid_tlen);
+	w->tlen = i;
+	w->n_lines = new_n;
+
+	for (i = at.tok + mid_tlen;
+	     (drow != 0 || doff != 0) && i < w->tlen;
+	     i++) {
+		w->t[i].row += drow;
+		if (w->t[i].type == TT_identifier) {
+			w->t[i].c.identifier.off += doff;
+		} else if (w->t[i].type == TT_comment) {
+			w->t[i].c.comment.off += doff;
+		}
+	}
+	for (l = first + n_mid; (doff != 0 || dtok != 0) && l <= new_n; l++) {
+		w->lines[l].off += doff;
+		w->lines[l].tok += dtok;
+	}
+
+	i = 0;
+	p = begin;
+	for (l = first; l < first + n_mid; l++) {
+		w->lines[l].off = p;
+		w->lines[l].tok = at.tok + i;
+		while (i < mid_tlen && mid[i].row == l + 1) {
+			i++;
+		}
+		nl = memchr(&text[p], '\n', end - p);
+		p = nl == NULL ? end : nl - text + 1;
+	}
+
+	Source_free(&w->tr.src);
+	w->tr.src.buf = text;
+	w->tr.src.len = len;
+	text = NULL;
+
+	/* translate again from the first changed line on */
+	w->n_tokenized = n_mid;
+	w->n_retranslated = 0;
+	Scope_truncate(w->s, at.instr, at.var, at.lit, at.tmp);
+	w->s->n_funcs = 0;
+	w->tr.slen = 1;
+	w->tr.cur = w->s;
+	w->n_translated = first;
+
+	ts = Watch_translate(w, first, first + n_mid);
+	if (ts == TS_malloc_failed) {
+		goto cleanup;
+	}
+	if (ts == TS_ok && old_vars != NULL && w->tr.slen == 1) {
+		reused = Watch_reuse(w, &at, &old_last, &old_end,
+		                     old_vars, old_lits, old_instrs,
+		                     first + n_mid, drow);
+		if (reused == -1) {
+			goto cleanup;
+		}
+	}
+	if (ts == TS_ok && !reused) {
+		ts = Watch_translate(w, first + n_mid, new_n);
+		if (ts == TS_malloc_failed) {
+			goto cleanup;
+		}
+	}
+	if (ts == TS_ok && w->tr.cur != w->s) {
+		ts = TS_expected_scope_end;
+		TranslateStatus_print(ts, w->name,
+		                      w->t[w->tlen - 1].row,
+		                      w->t[w->tlen - 1].col);
+	}
+	w->failed = ts != TS_ok;
+	if (ts == TS_ok) {
+		w->lines[new_n].instr = w->s->n_instrs;
+		w->lines[new_n].var = w->s->n_vars;
+		w->lines[new_n].lit = w->s->n_literals;
+		w->lines[new_n].tmp = w->s->n_tmp_vals;
+		w->n_translated = new_n;
+	}
+	ret = 0;
+
+cleanup:
+	free(text);
+	free(mid);
+	free(old_vars);
+	free(old_lits);
+	free(old_instrs);
+	return ret;
+}
+
+/* Copies a translated scope to the end of the run module,
+ * where it gets the same index.
+ * Returns non zero if malloc failed.
+ */
+static int
+Watch_copy_scope(
+	struct Watch       *w,
+	const struct Scope *from)
+{
+	int i;
+	struct Scope *s;
+
+	s = Module_add_scope(&w->run, from->name,
+	                     from->parent == NULL ?
+	                     NULL : w->run.s[from->parent->idx]);
+	if (s == NULL) {
+		return 1;
+	}
+	for (i = 0; i < from->n_literals; i++) {
+		if (Scope_add_literal(s, from->literals[i]) == -1) {
+			return 1;
+		}
+	}
+	for (i = 0; i < from->n_vars; i++) {
+		if (Scope_add_var(s, from->var_names[i]) == -1) {
+			return 1;
+		}
+	}
+	for (i = 0; i < from->n_instrs; i++) {
+		if (Scope_add_instruction(s, from->instrs[i])) {
+			return 1;
+		}
+	}
+	s->n_tmp_vals = from->n_tmp_vals;
+	s->sym = from->sym;
+	s->n_params = from->n_params;
+	s->n_args = from->n_args;
+
+	return 0;
+}
+
+/* Copies the translated scopes into a new module, then optimizes
+ * and lowers that.
+ * Returns non zero on odd error cases, like mallocs being impossible.
+ */
+static int
+Watch_lower(
+	struct Watch *w)
+{
+	int i;
+
+	Module_free(&w->run);
+	w->run = Module_new(w->name);
+	w->run.names = w->tr.names;
+	w->run.jit_hot_runs = w->jit_hot_runs;
+	w->run.inline_max = w->inline_max;
+
+	for (i = 0; i < w->tr.slen; i++) {
+		if (Watch_copy_scope(w, w->tr.s[i])) {
+			return 1;
+		}
+	}
+
+	return Module_optimize(&w->run, w->opt_level) ||
+	       Module_lower(&w->run);
+}
+
+int
+Watch_reload(
+	struct Watch *w)
+{
+	FILE *f;
+	char *text;
+	long n_executed;
+	double secs;
+	struct Source src;
+	enum RuntimeStatus rs;
+
+	f = fopen(w->path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "File \"%s\" could not be opened\n", w->path);
+		return 0;
+	}
+	if (Source_from_file(&src, f)) {
+		fclose(f);
+		Source_free(&src);
+		fprintf(stderr, "Reading \"%s\" failed\n", w->path);
+		return 0;
+	}
+	fclose(f);
+
+	/* a mapped file could change under the next comparison */
+	text = malloc(src.len > 0 ? src.len : 1);
+	if (text == NULL) {
+		Source_free(&src);
+		return 1;
+	}
+	memcpy(text, src.buf, src.len);
+
+	secs = Stats_now();
+	if (Watch_update(w, text, src.len)) {
+		Source_free(&src);
+		return 1;
+	}
+	Source_free(&src);
+	if (w->failed) {
+		return 0;
+	}
+	if (Watch_lower(w)) {
+		return 1;
+	}
+	secs = Stats_now() - secs;
+
+	printf("reloaded %s: %i lines tokenized, %i translated, in %f s\n",
+	       w->name, w->n_tokenized, w->n_retranslated, secs);
+
+	n_executed = Module_run(&w->run, &rs);
+	if (n_executed < 0) {
+		return 1;
+	}
+	RuntimeStatus_print(rs, w->name, w->run.s[0]->code.rows[w->run.ic]);
+	if (rs == RS_ok) {
+		Module_fprint(&w->run, stdout);
+	}
+	fflush(stdout);
+
+	return 0;
+}
+
+#ifdef __linux__
+
+int
+Watch_run(
+	struct Watch *w)
+{
+	int fd;
+	int len;
+	int changed;
+	char *dir;
+	char *p;
+	const struct inotify_event *ev;
+	union {
+		struct inotify_event ev;
+		char buf[4096];
+	} events;
+
+	if (Watch_reload(w)) {
+		return 1;
+	}
+
+	/* editors often save by renaming a new file over the old one,
+	 * which only the directory notices */
+	len = w->name - w->path;
+	dir = malloc(len + 2);
+	if (dir == NULL) {
+		return 1;
+	}
+	if (len == 0) {
+		strcpy(dir, ".");
+	} else {
+		memcpy(dir, w->path, len);
+		dir[len] = '\0';
+	}
+
+	fd = inotify_init();
+	if (fd == -1 ||
+	    inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+		fprintf(stderr, "Watching \"%s\" failed\n", dir);
+		free(dir);
+		return 0;
+	}
+	free(dir);
+
+	while ((len = read(fd, events.buf, sizeof(events.buf))) > 0) {
+		changed = 0;
+		for (p = events.buf; p < events.buf + len;
+		     p += sizeof(struct inotify_event) + ev->len) {
+			ev = (const struct inotify_event *) p;
+			if (ev->len > 0 && strcmp(ev->name, w->name) == 0) {
+				changed = 1;
+			}
+		}
+		if (changed && Watch_reload(w)) {
+			close(fd);
+			return 1;
+		}
+	}
+
+	close(fd);
+	return 0;
+}
+
+#else
+
+int
+Watch_run(
+	struct Watch *w)
+{
+	struct stat st;
+	struct timespec last = {0};
+	off_t last_size = -1;
+	struct timespec pause = {
+		.tv_sec = WATCH_POLL_MS / 1000,
+		.tv_nsec = WATCH_POLL_MS % 1000 * 1000000,
+	};
+
+	while (1) {
+		if (stat(w->path, &st) == 0 &&
+		    (st.st_mtime != last.tv_sec || st.st_size != last_size)) {
+			last.tv_sec = st.st_mtime;
+			last_size = st.st_size;
+			if (Watch_reload(w)) {
+				return 1;
+			}
+		}
+		nanosleep(&pause, NULL);
+	}
+
+	return 0;
+}
+
+#endif /* __linux__ */
+
+void
+Watch_free(
+	struct Watch *w)
+{
+	Module_free(&w->run);
+	Module_free(&w->tr);
+	free(w->lines);
+	free(w->t);
+	w->lines = NULL;
+	w->t = NULL;
+}
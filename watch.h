@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+// Copyright (C) 2024  Andy Frank Schoknecht
+
+#ifndef _WATCH_H
+#define _WATCH_H
+
+#include "SVM.h"
+
+/* Time between checks of the file, where inotify is not available.
+ */
+#define WATCH_POLL_MS 250
+
+/* Where one line of the watched text begins, in each stage.
+ * The amounts are those of the translated scope before the line.
+ */
+struct WatchLine {
+	int off;   /* in the text */
+	int tok;   /* first token */
+	int instr; /* first instruction */
+	int var;
+	int lit;
+	int tmp;
+};
+
+/* Keeps a file translated across changes.
+ * Only lines that changed are tokenized and translated again,
+ * the lines after them keep their tokens and, unless they read a variable
+ * that the change removed, also their instructions.
+ * Optimizing, lowering and running always happen on a copy of it all.
+ */
+struct Watch {
+	char             *path;
+	char             *name;
+	int               opt_level;
+	int               inline_max;
+	int               jit_hot_runs;
+	struct Module     tr;    /* translated text, never optimized */
+	struct Scope     *s;     /* global scope of tr */
+	struct Module     run;   /* optimized copy of tr, of the last reload */
+	struct WatchLine *lines; /* n_lines + 1, the last one holds totals */
+	int               n_lines;
+	int               lines_size;
+	int               n_translated; /* lines, less after failing */
+	int               failed;       /* the last update had errors */
+	struct Token     *t;     /* of all lines, never NULL */
+	int               tlen;
+	int               tsize;
+	int               n_tokenized;  /* lines, by the last update */
+	int               n_retranslated;
+};
+
+/* Returns non zero if malloc failed.
+ */
+int
+Watch_new(
+	struct Watch *w,
+	char         *path,
+	char         *name,
+	int           opt_level,
+	int           inline_max,
+	int           jit_hot_runs);
+
+/* Replaces the watched text with text of len characters,
+ * which must come from malloc and is taken over.
+ * Errors in the text are printed, and the next update starts over from
+ * the last text that could be tokenized.
+ * Returns non zero on odd error cases, like mallocs being impossible.
+ */
+int
+Watch_update(
+	struct Watch *w,
+	char         *text,
+	int           len);
+
+/* Reads the file, updates, and runs it if it translated.
+ * Returns non zero on odd error cases, like mallocs being impossible.
+ */
+int
+Watch_reload(
+	struct Watch *w);
+
+/* Reloads the file every time it was written, until that fails.
+ * Returns non zero on odd error cases, like mallocs being impossible.
+ */
+int
+Watch_run(
+	struct Watch *w);
+
+void
+Watch_free(
+	struct Watch *w);
+
+#endif /* _WATCH_H */